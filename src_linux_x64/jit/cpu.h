@@ -1,4 +1,5 @@
 #pragma once
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <string>
@@ -30,30 +31,85 @@ enum Flag86 : uint16_t {
 
 static constexpr uint16_t FLAGS_MASK = 0x0FD5; // all arithmetic flags
 
-struct CPU8086 {
+// Deferred flag computation: ALU ops record what they did instead of saving
+// RFLAGS, and the flags are rebuilt only when something reads them
+enum LazyOp : uint32_t {
+    LAZY_NONE = 0,  // cpu.flags is up to date
+    LAZY_ADD, LAZY_ADC, LAZY_SUB, LAZY_SBB,   // SUB also covers CMP/CMPS/SCAS
+    LAZY_AND, LAZY_OR, LAZY_XOR,              // AND also covers TEST
+    LAZY_INC, LAZY_DEC, LAZY_NEG,
+    LAZY_OP_COUNT,
+    LAZY_WORD = 0x10  // or'd in for 16-bit operands
+};
+
+// Guest memory size: 1MB for full 20-bit addressing, followed by the
+// 64K that seg*16 + offset can reach past it (see GuestMemory)
+static constexpr uint32_t MEMORY_SIZE = 0x100000;
+static constexpr uint32_t MEMORY_WRAP = 0x10000;
+
+// The registers and everything generated code touches on most instructions
+// come first, in one cache-line-aligned block that disp8 reaches. Guest
+// memory lives apart from it and is addressed through its own host
+// register.
+struct alignas(64) CPU8086 {
     uint16_t regs[8];       // offset 0:  AX,CX,DX,BX,SP,BP,SI,DI
     uint16_t sregs[4];      // offset 16: ES,CS,SS,DS
     uint16_t ip;            // offset 24
     uint16_t flags;         // offset 26
-    uint8_t  memory[1048576]; // offset 28 — 1MB for full 20-bit addressing
-    int32_t  pending_int;     // offset 1048604 (-1 = none)
-    bool     halted;          // offset 1048608
-    uint64_t instr_count;     // (approx, after padding)
+    uint32_t seg_base[4];   // offset 28: sregs[n] * 16, written with sregs by setSreg()
+    uint32_t lazy_op;       // offset 44: LazyOp of the last flag-producing instruction
+    uint32_t lazy_dst;      // offset 48: its destination operand (before the op)
+    uint32_t lazy_src;      // offset 52: its source operand
+    uint32_t lazy_cin;      // offset 56: carry in, for ADC/SBB
+    int32_t  pending_int;   // offset 60 (-1 = none)
+    uint64_t instr_budget;  // offset 64: instructions generated code may still run
+    uint64_t instr_count;   // offset 72
+    uint8_t  smc_exit;      // offset 80: a store just invalidated the running block
+    bool     halted;        // offset 81
+    uint32_t dirty_lo;      // guest range written by C++ handlers since the JIT last looked
+    uint32_t dirty_hi;
+    uint8_t* memory;        // offset 96: MEMORY_SIZE + MEMORY_WRAP bytes, from GuestMemory
+    uint8_t  code_pages[4352];// offset 104: per 256-byte page up to MEMORY_SIZE + MEMORY_WRAP, nonzero = holds translated code
+    uint8_t  code_bits[8192]; // offset 4456: per byte of the first 64K, set = translated code
 
     void reset() {
         memset(regs, 0, sizeof(regs));
         memset(sregs, 0, sizeof(sregs));
+        memset(seg_base, 0, sizeof(seg_base));
         ip = 0x0100;
         flags = 0x0002; // bit 1 always set on 8086
-        memset(memory, 0, sizeof(memory));
+        memset(memory, 0, MEMORY_SIZE + MEMORY_WRAP);
         pending_int = -1;
         halted = false;
         instr_count = 0;
+        instr_budget = 0;
+        memset(code_pages, 0, sizeof(code_pages));
+        memset(code_bits, 0, sizeof(code_bits));
+        smc_exit = 0;
+        dirty_lo = UINT32_MAX;
+        dirty_hi = 0;
+        lazy_op = LAZY_NONE;
+        lazy_dst = lazy_src = lazy_cin = 0;
         regs[R_SP] = 0xFFFE;
-        sregs[S_CS] = 0;
-        sregs[S_DS] = 0;
-        sregs[S_SS] = 0;
-        sregs[S_ES] = 0;
+        setSreg(S_CS, 0);
+        setSreg(S_DS, 0);
+        setSreg(S_SS, 0);
+        setSreg(S_ES, 0);
+    }
+
+    // Segment registers are only written through here (and the generated
+    // code's equivalent), so seg_base stays in step
+    void setSreg(int n, uint16_t value) {
+        sregs[n] = value;
+        seg_base[n] = (uint32_t)value << 4;
+    }
+
+    // C++ code that writes guest memory (DOS/BIOS handlers) reports the range
+    // here so the JIT can drop translated code it overwrote
+    void noteWrite(uint32_t phys, uint32_t len) {
+        if (len == 0) return;
+        if (phys < dirty_lo) dirty_lo = phys;
+        if (phys + len > dirty_hi) dirty_hi = phys + len;
     }
 
     bool loadCOM(const std::vector<uint8_t>& data) {
@@ -76,18 +132,39 @@ static constexpr int OFF_REGS     = 0;
 static constexpr int OFF_SREGS    = 16;
 static constexpr int OFF_IP       = 24;
 static constexpr int OFF_FLAGS    = 26;
-static constexpr int OFF_MEMORY   = 28;
-static constexpr int OFF_PENDING  = 1048604;
-static constexpr int OFF_HALTED   = 1048608;
+static constexpr int OFF_SEG_BASE = 28;
+static constexpr int OFF_LAZY_OP     = 44;
+static constexpr int OFF_LAZY_DST    = 48;
+static constexpr int OFF_LAZY_SRC    = 52;
+static constexpr int OFF_LAZY_CIN    = 56;
+static constexpr int OFF_PENDING  = 60;
+static constexpr int OFF_INSTR_BUDGET = 64;
+static constexpr int OFF_INSTR_COUNT = 72;
+static constexpr int OFF_SMC_EXIT    = 80;
+static constexpr int OFF_HALTED   = 81;
+static constexpr int OFF_MEMORY   = 96;
+static constexpr int OFF_CODE_PAGES  = 104;
+static constexpr int OFF_CODE_BITS   = 4456;
 
 // Compile-time layout checks
 static_assert(offsetof(CPU8086, regs)        == OFF_REGS,    "regs offset");
 static_assert(offsetof(CPU8086, sregs)       == OFF_SREGS,   "sregs offset");
 static_assert(offsetof(CPU8086, ip)          == OFF_IP,      "ip offset");
 static_assert(offsetof(CPU8086, flags)       == OFF_FLAGS,   "flags offset");
-static_assert(offsetof(CPU8086, memory)      == OFF_MEMORY,  "memory offset");
+static_assert(offsetof(CPU8086, seg_base)    == OFF_SEG_BASE, "seg_base offset");
+static_assert(offsetof(CPU8086, lazy_op)     == OFF_LAZY_OP,     "lazy_op offset");
+static_assert(offsetof(CPU8086, lazy_dst)    == OFF_LAZY_DST,    "lazy_dst offset");
+static_assert(offsetof(CPU8086, lazy_src)    == OFF_LAZY_SRC,    "lazy_src offset");
+static_assert(offsetof(CPU8086, lazy_cin)    == OFF_LAZY_CIN,    "lazy_cin offset");
 static_assert(offsetof(CPU8086, pending_int) == OFF_PENDING, "pending_int offset");
+static_assert(offsetof(CPU8086, instr_budget) == OFF_INSTR_BUDGET, "instr_budget offset");
+static_assert(offsetof(CPU8086, instr_count) == OFF_INSTR_COUNT, "instr_count offset");
+static_assert(offsetof(CPU8086, smc_exit)    == OFF_SMC_EXIT,    "smc_exit offset");
 static_assert(offsetof(CPU8086, halted)      == OFF_HALTED,  "halted offset");
+static_assert(offsetof(CPU8086, memory)      == OFF_MEMORY,  "memory offset");
+static_assert(offsetof(CPU8086, code_pages)  == OFF_CODE_PAGES,  "code_pages offset");
+static_assert(offsetof(CPU8086, code_bits)   == OFF_CODE_BITS,   "code_bits offset");
+static_assert(OFF_MEMORY < 128, "the hot state must be reachable with disp8");
 
 // Helper: offset of 16-bit register n within CPU struct
 inline constexpr int regOff16(int n) { return OFF_REGS + n * 2; }
@@ -99,3 +176,36 @@ inline constexpr int regOff8(int n) {
 
 // Helper: offset of segment register
 inline constexpr int sregOff(int n) { return OFF_SREGS + n * 2; }
+
+// Helper: offset of segment register n's base (n * 16)
+inline constexpr int segBaseOff(int n) { return OFF_SEG_BASE + n * 4; }
+
+// The CPU8086 and the guest memory it points at (guest_mem.cpp). Memory
+// starts on a 2MB boundary; where the host allows it, the MEMORY_WRAP bytes
+// past MEMORY_SIZE are a second mapping of the pages of memory[0, 64K):
+// seg*16 + offset then reaches the byte the 8086's 20-bit wraparound would
+// without being masked, and a word at FFFFFh reads its high byte from 0.
+class GuestMemory {
+public:
+    GuestMemory();
+    ~GuestMemory();
+    GuestMemory(const GuestMemory&) = delete;
+    GuestMemory& operator=(const GuestMemory&) = delete;
+
+    CPU8086& cpu() const { return *cpu_; }
+    // memory[MEMORY_SIZE, +MEMORY_WRAP) aliases memory[0, 64K)
+    bool wraps() const { return wraps_; }
+    // Back guest memory with one transparent huge page instead (Linux).
+    // That takes the double mapping away, so wraps() turns false. Keeps the
+    // contents.
+    void setHugePages(bool on);
+
+private:
+    bool mapWrapped();
+    void mapPrivate(bool huge);
+
+    uint8_t* base_ = nullptr;  // 2MB-aligned span guest memory is mapped in
+    CPU8086* cpu_ = nullptr;
+    bool wraps_ = false;
+    bool huge_ = false;
+};
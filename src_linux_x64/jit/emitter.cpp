@@ -13,6 +13,17 @@ CodeBuffer::~CodeBuffer() {
     if (buf_) munmap(buf_, capacity_);
 }
 
+void CodeBuffer::resize(size_t capacity) {
+    uint8_t* buf = (uint8_t*)mmap(nullptr, capacity, PROT_READ | PROT_WRITE | PROT_EXEC,
+                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) throw std::runtime_error("mmap failed");
+    if (buf_) munmap(buf_, capacity_);
+    buf_ = buf;
+    capacity_ = capacity;
+    pos_ = 0;
+    epoch_++;
+}
+
 void CodeBuffer::emit8(uint8_t b) {
     if (pos_ + 1 > capacity_) throw std::runtime_error("CodeBuffer overflow");
     buf_[pos_++] = b;
@@ -44,8 +55,10 @@ void CodeBuffer::emitBytes(const uint8_t* data, size_t len) {
 
 void CodeBuffer::patch32(size_t offset, uint32_t val) {
     memcpy(&buf_[offset], &val, 4);
+    epoch_++;
 }
 
 void CodeBuffer::patch8(size_t offset, uint8_t val) {
     buf_[offset] = val;
+    epoch_++;
 }
@@ -1,4 +1,5 @@
 #pragma once
+#include "x64enc.h"
 #include <cstdint>
 #include <cstddef>
 
@@ -17,15 +18,30 @@ public:
     void emit32(uint32_t d);
     void emit64(uint64_t q);
     void emitBytes(const uint8_t* data, size_t len);
+    void emit(const X64Insn& insn) { emitBytes(insn.bytes, insn.len); }
 
     size_t size() const { return pos_; }
+    size_t capacity() const { return capacity_; }
     uint8_t* data() { return buf_; }
-    void reset() { pos_ = 0; }
+    void reset() { pos_ = 0; epoch_++; }
+
+    // Replace the buffer with an empty one of a different capacity
+    void resize(size_t capacity);
+
+    // Discard everything emitted after a previously saved cursor()
+    void rewind(size_t pos) { pos_ = pos; epoch_++; }
+
+    // Address of emitted code at a given offset
+    uint8_t* at(size_t offset) { return buf_ + offset; }
 
     // Get function pointer to emitted code
     template<typename F>
     F getFunc() { return reinterpret_cast<F>(buf_); }
 
+    // Get function pointer to code emitted at a given offset
+    template<typename F>
+    F getFunc(size_t offset) { return reinterpret_cast<F>(buf_ + offset); }
+
     // Patch a 32-bit value at a given offset
     void patch32(size_t offset, uint32_t val);
 
@@ -35,8 +51,14 @@ public:
     // Current write position (for computing relative offsets)
     size_t cursor() const { return pos_; }
 
+    // Bumped by every patch and rewind. Code emitted in one epoch is known
+    // to run straight on from what came before it; a patch usually means a
+    // jump now lands at the cursor.
+    uint64_t epoch() const { return epoch_; }
+
 private:
     uint8_t* buf_;
     size_t   capacity_;
     size_t   pos_;
+    uint64_t epoch_ = 0;
 };
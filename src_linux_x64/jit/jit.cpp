@@ -5,25 +5,19 @@
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <iterator>
+#include <chrono>
 #include <sstream>
-
-// x64 register encoding constants
-enum X64 : uint8_t {
-    RAX = 0, RCX = 1, RDX = 2, RBX = 3,
-    RSP = 4, RBP = 5, RSI = 6, RDI = 7,
-    R8 = 8, R9 = 9, R10 = 10, R11 = 11,
-    R12 = 12, R13 = 13
-};
-
-// REX prefix bits
-static constexpr uint8_t REX_W = 0x48;  // 64-bit operand
-static constexpr uint8_t REX_R = 0x44;  // ext MODRM.reg
-static constexpr uint8_t REX_B = 0x41;  // ext MODRM.rm or SIB.base
+#include <stdexcept>
+#include <immintrin.h>
+#include <cpuid.h>
 
 JitEngine::JitEngine()
-    : cpu_storage_(std::make_unique<CPU8086>()),
-      cpu_(*cpu_storage_),
-      code_(8192) {}
+    : cpu_(guest_.cpu()),
+      code_(DEFAULT_CODE_CACHE_SIZE),
+      block_map_(65536, nullptr),
+      seg_misses_(65536, 0),
+      page_blocks_(256) {}
 JitEngine::~JitEngine() {}
 
 void JitEngine::setEvents(std::vector<KeyEvent> triggered, std::vector<InputEvent> sequential) {
@@ -53,6 +47,31 @@ void JitEngine::setArgs(const std::string& args) {
     program_args_ = args;
 }
 
+void JitEngine::setJitThreshold(uint32_t n) {
+    jit_threshold_ = n;
+}
+
+void JitEngine::setEager(bool on) {
+    eager_ = on;
+}
+
+void JitEngine::setCodeCacheSize(size_t bytes) {
+    bytes = std::min(std::max(bytes, MIN_CODE_CACHE_SIZE), MAX_CODE_CACHE_SIZE);
+    if (bytes == code_.capacity()) return;
+    code_.resize(bytes);
+    flushBlocks();
+}
+
+void JitEngine::setStats(bool on) {
+    stats_ = on;
+}
+
+void JitEngine::setHugePages(bool on) {
+    guest_.setHugePages(on);
+    // Translations depend on guest_.wraps()
+    flushBlocks();
+}
+
 // CP437 → Unicode codepoint table (all 256 entries)
 static const uint32_t cp437_to_unicode[256] = {
     // 0x00-0x1F: control chars → visible CP437 glyphs
@@ -199,98 +218,169 @@ static void emitModRMDisp(CodeBuffer& c, uint8_t reg, int32_t disp) {
     }
 }
 
+// Guest memory at the physical address in EAX: [r12 + rax], R12 holding
+// CPU8086::memory for the whole block
+static constexpr X64Mem kGuestMem = x64::mem(R12, RAX, 0);
+
+// Host registers holding the guest registers for the whole block, indexed
+// by 8086 register number (AX CX DX BX SP BP SI DI). Each holds the 16-bit
+// value zero-extended; CPU8086::regs is only current outside generated code.
+static constexpr uint8_t kPinned[8] = { R8, R9, R11, R13, R14, R15, RSI, RDI };
+
+// Pinned registers as a host register mask
+static constexpr uint16_t kPinnedMask = (1u << R8) | (1u << R9) | (1u << R11) | (1u << R13) |
+                                        (1u << R14) | (1u << R15) | (1u << RSI) | (1u << RDI);
+
+// Callee-saved registers the prologue pushes, in push order
+static constexpr int kCalleeSaved[] = { RBX, RBP, R12, R13, R14, R15 };
+
+bool JitEngine::peepValid() const {
+    return peep_.end == code_.cursor() && peep_.epoch == code_.epoch();
+}
+
+void JitEngine::peepReset() {
+    peep_ = PeepState();
+}
+
+void JitEngine::peepBoundary() {
+    // Each holds its 16-bit guest register zero-extended between instructions
+    if (!peepValid()) peepReset();
+    peep_.zext |= kPinnedMask;
+    peep_.end = code_.cursor();
+    peep_.epoch = code_.epoch();
+}
+
+JitEngine::PeepState JitEngine::peepSave() const {
+    return peepValid() ? peep_ : PeepState();
+}
+
+// Untyped code emitted since peepSave() rejoins here on every path, with
+// only the clobbered registers changed and no CPU state but lazy flags
+// written
+void JitEngine::peepRestore(const PeepState& saved, uint16_t clobbered) {
+    peep_ = saved;
+    peep_.zext &= ~clobbered;
+    peep_.end = code_.cursor();
+    peep_.epoch = code_.epoch();
+}
+
+void JitEngine::emitInsn(const X64Insn& insn) {
+    if (!peepValid()) peepReset();
+    uint16_t bit = insn.dst >= 0 ? (uint16_t)(1u << insn.dst) : 0;
+    // mov r32, r32 / movzx r32, r16 of one register that is already
+    // zero-extended: nothing to do
+    if (bit && insn.src == insn.dst && (peep_.zext & bit)) {
+        peep_saved_bytes_ += insn.len;
+        peep_elided_++;
+        return;
+    }
+    code_.emit(insn);
+    if (bit) {
+        bool zext = insn.zext == X64Insn::ZX_SET ||
+                    (insn.zext == X64Insn::ZX_KEEP && (peep_.zext & bit)) ||
+                    (insn.zext == X64Insn::ZX_COPY && (peep_.zext >> insn.src & 1));
+        peep_.zext = zext ? (peep_.zext | bit) : (peep_.zext & ~bit);
+    }
+    peep_.zext &= ~insn.clobber;
+    peep_.end = code_.cursor();
+    peep_.epoch = code_.epoch();
+}
+
 void JitEngine::emitPrologue() {
+    peepReset();
     // System V AMD64 ABI: first arg arrives in RDI
     // Move to RCX, which the rest of the generated code uses as base pointer
-    code_.emit8(0x48); // REX.W
-    code_.emit8(0x89); // MOV r/m64, r64
-    code_.emit8(0xF9); // ModR/M: dst=RCX, src=RDI  →  mov rcx, rdi
-    // Save RBX (callee-saved) — we use it as scratch
-    code_.emit8(0x53); // push rbx
-    // Save RBP (callee-saved)
-    code_.emit8(0x55); // push rbp
-    // Save R12 (callee-saved) — used as scratch
-    code_.emit8(REX_B); code_.emit8(0x50 | (R12 & 7)); // push r12
+    emitInsn(x64::mov(x64::Q64, RCX, RDI));
+    // Save RBX, RBP (scratch), R12 (guest memory base) and R13-R15 (pinned
+    // guest registers)
+    for (int r : kCalleeSaved) emitInsn(x64::push(r));
+    // 6 pushes + 8 keep the stack 16-byte aligned
+    emitInsn(x64::aluImm(x64::SUB, x64::Q64, RSP, 8));
+    // mov r12, [rcx + OFF_MEMORY]
+    emitInsn(x64::mov(x64::Q64, R12, x64::mem(RCX, OFF_MEMORY)));
+    emitFillRegs();
 }
 
 void JitEngine::emitEpilogue() {
+    emitSpillRegs();
     // Restore callee-saved and return
-    code_.emit8(REX_B); code_.emit8(0x58 | (R12 & 7)); // pop r12
-    code_.emit8(0x5D); // pop rbp
-    code_.emit8(0x5B); // pop rbx
-    code_.emit8(0xC3); // ret
+    emitInsn(x64::aluImm(x64::ADD, x64::Q64, RSP, 8));
+    for (size_t k = std::size(kCalleeSaved); k-- > 0; ) emitInsn(x64::pop(kCalleeSaved[k]));
+    emitInsn(x64::ret());
+}
+
+// Load the guest registers: movzx pinned32, word [rcx + regOff16(n)]
+void JitEngine::emitFillRegs() {
+    for (int n = 0; n < 8; n++)
+        emitInsn(x64::movzx16(kPinned[n], x64::mem(RCX, regOff16(n))));
+}
+
+// Write the guest registers back: mov word [rcx + regOff16(n)], pinned16
+void JitEngine::emitSpillRegs() {
+    for (int n = 0; n < 8; n++)
+        emitInsn(x64::mov(x64::W16, x64::mem(RCX, regOff16(n)), kPinned[n]));
 }
 
 void JitEngine::emitSetIP(uint16_t newIP) {
-    // mov word [rcx + OFF_IP], newIP
-    code_.emit8(0x66); // operand size prefix for 16-bit
-    code_.emit8(0xC7); // MOV r/m16, imm16
-    emitModRMDisp(code_, 0, OFF_IP);
-    code_.emit16(newIP);
+    emitInsn(x64::movImm(x64::W16, x64::mem(RCX, OFF_IP), newIP));
 }
 
-// Load 16-bit reg from CPU struct into x64 register (zero-extended to 64-bit)
-// movzx x64reg, word [rcx + regOff16(reg86)]
+// Copy a 16-bit guest register into an x64 register (zero-extended)
+// mov x64reg32, pinned32
 void JitEngine::emitLoadReg16(int x64reg, int reg86) {
-    int off = regOff16(reg86);
-    if (x64reg >= 8) {
-        code_.emit8(REX_R); // REX.R for extended reg
-    }
-    code_.emit8(0x0F);
-    code_.emit8(0xB7); // MOVZX r, r/m16
-    emitModRMDisp(code_, x64reg & 7, off);
+    emitInsn(x64::mov(x64::D32, x64reg, kPinned[reg86]));
 }
 
-// Store 16-bit from x64 register to CPU struct
-// mov word [rcx + regOff16(reg86)], x64reg
+// Set a 16-bit guest register from an x64 register
+// movzx pinned32, x64reg16
 void JitEngine::emitStoreReg16(int reg86, int x64reg) {
-    int off = regOff16(reg86);
-    code_.emit8(0x66); // 16-bit operand
-    if (x64reg >= 8) {
-        code_.emit8(REX_R);
-    }
-    code_.emit8(0x89); // MOV r/m16, r16
-    emitModRMDisp(code_, x64reg & 7, off);
+    emitInsn(x64::movzx16(kPinned[reg86], x64reg));
 }
 
-// Load 8-bit reg from CPU struct into x64 register (zero-extended)
-// movzx x64reg, byte [rcx + regOff8(reg86)]
+// Copy an 8-bit guest register into an x64 register (zero-extended)
+// low:  movzx x64reg32, pinned8
+// high: mov x64reg32, pinned32; shr x64reg32, 8  (clobbers host flags)
 void JitEngine::emitLoadReg8(int x64reg, int reg86) {
-    int off = regOff8(reg86);
-    if (x64reg >= 8) {
-        code_.emit8(REX_R);
+    if (reg86 >= 4) {
+        emitLoadReg16(x64reg, reg86 - 4);
+        emitInsn(x64::shift(x64::SHR, x64::D32, x64reg, 8));
+        return;
     }
-    code_.emit8(0x0F);
-    code_.emit8(0xB6); // MOVZX r, r/m8
-    emitModRMDisp(code_, x64reg & 7, off);
+    emitInsn(x64::movzx8(x64reg, kPinned[reg86]));
 }
 
-// Store 8-bit from x64 register to CPU struct
-// mov byte [rcx + regOff8(reg86)], x64reg_low8
+// Set an 8-bit guest register from the low byte of an x64 register
+// low:  mov pinned8, x64reg8
+// high: ror pinned16, 8; mov pinned8, x64reg8; rol pinned16, 8
+//       (clobbers host CF/OF; callers capture flags before storing)
 void JitEngine::emitStoreReg8(int reg86, int x64reg) {
-    int off = regOff8(reg86);
-    // Need REX prefix for uniform access to low bytes of all registers
-    uint8_t rex = 0x40;
-    if (x64reg >= 8) rex |= 0x04; // REX.R
-    code_.emit8(rex);
-    code_.emit8(0x88); // MOV r/m8, r8
-    emitModRMDisp(code_, x64reg & 7, off);
+    int pin = kPinned[reg86 & 3];
+    bool high = reg86 >= 4;
+    if (high) emitInsn(x64::shift(x64::ROR, x64::W16, pin, 8));
+    emitInsn(x64::mov(x64::B8, pin, x64reg));
+    if (high) emitInsn(x64::shift(x64::ROL, x64::W16, pin, 8));
 }
 
-// Add segment_reg * 16 to EAX, mask to 20 bits. Uses RDX as scratch.
+// Add segment_reg * 16 to EAX, mask to 20 bits. Nothing in a flat-model
+// block, where every segment base is 0.
 void JitEngine::emitApplySegment(int seg_reg) {
-    // movzx edx, word [rcx + sregOff(seg_reg)]
-    code_.emit8(0x0F); code_.emit8(0xB7);
-    emitModRMDisp(code_, RDX, sregOff(seg_reg));
-    // shl edx, 4
-    code_.emit8(0xC1); code_.emit8(0xE2); code_.emit8(0x04);
-    // add eax, edx
-    code_.emit8(0x01); code_.emit8(0xD0);
-    // and eax, 0xFFFFF
-    code_.emit8(0x25); code_.emit32(0x000FFFFF);
+    if (flat_) return;
+    int base = loop_.active ? loop_.seg_base[seg_reg] : -1;
+    if (base >= 0) {
+        // add eax, base — seg*16, loaded once before the loop
+        emitInsn(x64::alu(x64::ADD, x64::D32, RAX, base));
+    } else {
+        // add eax, [rcx + segBaseOff(seg)]
+        emitInsn(x64::alu(x64::ADD, x64::D32, RAX, x64::mem(RCX, segBaseOff(seg_reg))));
+    }
+    emitWrapAddress();
+}
+
+void JitEngine::emitWrapAddress() {
+    if (!flat_ && !guest_.wraps()) emitInsn(x64::aluImm(x64::AND, x64::D32, RAX, 0x000FFFFF));
 }
 
-// Compute seg*16 + reg_value → EAX. Uses RDX as scratch.
+// Compute seg*16 + reg_value → EAX
 void JitEngine::emitSegAddr(int seg_reg, int offset_reg) {
     emitLoadReg16(RAX, offset_reg);
     emitApplySegment(seg_reg);
@@ -298,40 +388,38 @@ void JitEngine::emitSegAddr(int seg_reg, int offset_reg) {
 
 // Compute effective address into RAX (physical 20-bit address with segmentation)
 void JitEngine::emitComputeEA(const OpdDesc& opd) {
+    uint32_t phys;
+    if (foldedAddress(opd, phys)) {
+        // mov eax, seg*16 + disp — the segment is known for this block
+        emitInsn(x64::movImm32(RAX, phys));
+        if (!flat_) seg_folded_++;
+        return;
+    }
     if (opd.direct) {
         // Direct address: mov eax, disp (16-bit offset)
-        code_.emit8(0xB8); // MOV EAX, imm32
-        code_.emit32((uint16_t)opd.disp);
+        emitInsn(x64::movImm32(RAX, (uint16_t)opd.disp));
     } else {
         bool has_base = (opd.base >= 0);
         bool has_index = (opd.index >= 0);
 
         if (!has_base && !has_index) {
-            code_.emit8(0xB8);
-            code_.emit32((uint16_t)opd.disp);
+            emitInsn(x64::movImm32(RAX, (uint16_t)opd.disp));
         } else {
             if (has_base) {
                 emitLoadReg16(RAX, opd.base);
                 if (has_index) {
                     emitLoadReg16(RDX, opd.index);
-                    code_.emit8(0x01); code_.emit8(0xD0); // ADD EAX, EDX
+                    emitInsn(x64::alu(x64::ADD, x64::D32, RAX, RDX));
                 }
             } else {
                 emitLoadReg16(RAX, opd.index);
             }
 
-            if (opd.has_disp && opd.disp != 0) {
-                if (opd.disp >= -128 && opd.disp <= 127) {
-                    code_.emit8(0x83); code_.emit8(0xC0);
-                    code_.emit8((uint8_t)(int8_t)opd.disp);
-                } else {
-                    code_.emit8(0x05);
-                    code_.emit32((uint32_t)(int32_t)opd.disp);
-                }
-            }
+            if (opd.has_disp && opd.disp != 0)
+                emitInsn(x64::aluImm(x64::ADD, x64::D32, RAX, opd.disp));
 
             // Mask to 16-bit offset: movzx eax, ax
-            code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xC0);
+            emitInsn(x64::movzx16(RAX, RAX));
         }
     }
 
@@ -357,62 +445,24 @@ void JitEngine::emitLoadOperand(int x64reg, const OpdDesc& opd, bool is_word) {
         emitLoadReg8(x64reg, opd.reg);
         break;
     case OpdKind::SREG:
-        // movzx x64reg, word [rcx + sregOff(opd.reg)]
-        if (x64reg >= 8) code_.emit8(REX_R);
-        code_.emit8(0x0F); code_.emit8(0xB7);
-        emitModRMDisp(code_, x64reg & 7, sregOff(opd.reg));
+        emitInsn(x64::movzx16(x64reg, x64::mem(RCX, sregOff(opd.reg))));
         break;
     case OpdKind::IMM8:
-        // mov x64reg, imm32 (zero extended)
-        if (x64reg >= 8) { code_.emit8(REX_B); }
-        code_.emit8(0xB8 | (x64reg & 7));
-        code_.emit32(opd.imm);
-        break;
     case OpdKind::IMM16:
-        if (x64reg >= 8) { code_.emit8(REX_B); }
-        code_.emit8(0xB8 | (x64reg & 7));
-        code_.emit32(opd.imm);
+        emitInsn(x64::movImm32(x64reg, opd.imm));
         break;
     case OpdKind::MEM: {
-        // Compute EA into RAX (or save/restore if x64reg==RAX)
-        if (x64reg == RAX) {
-            emitComputeEA(opd);
-            // Now load from [rcx + rax + OFF_MEMORY]
-            if (is_word) {
-                // movzx eax, word [rcx + rax + OFF_MEMORY]
-                code_.emit8(0x0F); code_.emit8(0xB7);
-                // Need SIB for [rcx + rax + disp32]
-                code_.emit8(0x84); // mod=10 if disp32, mod=00 if disp fits... use mod=10 for safety
-                code_.emit8(0x01); // SIB: scale=0, index=RAX, base=RCX
-                code_.emit32(OFF_MEMORY);
-            } else {
-                // movzx eax, byte [rcx + rax + OFF_MEMORY]
-                code_.emit8(0x0F); code_.emit8(0xB6);
-                code_.emit8(0x84);
-                code_.emit8(0x01);
-                code_.emit32(OFF_MEMORY);
-            }
-        } else {
-            // Save x64reg, compute EA in RAX, then load into x64reg
-            emitComputeEA(opd);
-            if (is_word) {
-                uint8_t rex = 0;
-                if (x64reg >= 8) rex = REX_R;
-                if (rex) code_.emit8(rex);
-                code_.emit8(0x0F); code_.emit8(0xB7);
-                code_.emit8(0x84 | ((x64reg & 7) << 3));
-                code_.emit8(0x01); // SIB
-                code_.emit32(OFF_MEMORY);
-            } else {
-                uint8_t rex = 0;
-                if (x64reg >= 8) rex = REX_R;
-                if (rex) code_.emit8(rex);
-                code_.emit8(0x0F); code_.emit8(0xB6);
-                code_.emit8(0x84 | ((x64reg & 7) << 3));
-                code_.emit8(0x01);
-                code_.emit32(OFF_MEMORY);
-            }
+        uint32_t phys;
+        if (foldedAddress(opd, phys)) {
+            // movzx x64reg, word/byte [r12 + phys]
+            X64Mem m = x64::mem(R12, (int32_t)phys);
+            emitInsn(is_word ? x64::movzx16(x64reg, m) : x64::movzx8(x64reg, m));
+            if (!flat_) seg_folded_++;
+            break;
         }
+        // Compute EA into RAX, then movzx x64reg, word/byte [guest memory]
+        emitComputeEA(opd);
+        emitInsn(is_word ? x64::movzx16(x64reg, kGuestMem) : x64::movzx8(x64reg, kGuestMem));
         break;
     }
     default:
@@ -430,39 +480,26 @@ void JitEngine::emitStoreOperand(const OpdDesc& opd, int x64reg, bool is_word) {
         emitStoreReg8(opd.reg, x64reg);
         break;
     case OpdKind::SREG:
-        // mov word [rcx + sregOff(opd.reg)], x64reg_16
-        code_.emit8(0x66);
-        if (x64reg >= 8) code_.emit8(REX_R);
-        code_.emit8(0x89);
-        emitModRMDisp(code_, x64reg & 7, sregOff(opd.reg));
+        emitStoreSreg(opd.reg, x64reg);
+        emitFlatCheck();
         break;
     case OpdKind::MEM: {
+        uint32_t phys;
+        if (foldedAddress(opd, phys)) {
+            // mov [r12 + phys], x64reg; EAX = phys for the check
+            emitInsn(x64::mov(is_word ? x64::W16 : x64::B8,
+                              x64::mem(R12, (int32_t)phys), x64reg));
+            emitInsn(x64::movImm32(RAX, phys));
+            emitCodeWriteCheck(is_word ? 2 : 1);
+            if (!flat_) seg_folded_++;
+            break;
+        }
         // We need EA in a register that's not x64reg. Use R10.
         // Save value to R10 first, compute EA in RAX, then store from R10
-        // mov r10, x64reg
-        if (x64reg != R10) {
-            uint8_t rex = REX_W | 0x01; // REX.W + REX.B (R10 in r/m field)
-            if (x64reg >= 8) rex |= 0x04; // REX.R for source
-            code_.emit8(rex);
-            code_.emit8(0x89); // MOV r/m64, r64
-            code_.emit8(0xC0 | ((x64reg & 7) << 3) | (R10 & 7));
-        }
+        if (x64reg != R10) emitInsn(x64::mov(x64::D32, R10, x64reg));
         emitComputeEA(opd);
-        // Store: mov [rcx + rax + OFF_MEMORY], r10b/r10w
-        if (is_word) {
-            code_.emit8(0x66); // 16-bit operand
-            code_.emit8(REX_R); // REX.R for R10
-            code_.emit8(0x89); // MOV r/m16, r16
-            code_.emit8(0x84 | ((R10 & 7) << 3)); // ModR/M
-            code_.emit8(0x01); // SIB: RAX + RCX
-            code_.emit32(OFF_MEMORY);
-        } else {
-            code_.emit8(REX_R); // REX.R for R10
-            code_.emit8(0x88); // MOV r/m8, r8
-            code_.emit8(0x84 | ((R10 & 7) << 3));
-            code_.emit8(0x01);
-            code_.emit32(OFF_MEMORY);
-        }
+        emitInsn(x64::mov(is_word ? x64::W16 : x64::B8, kGuestMem, R10));
+        emitCodeWriteCheck(is_word ? 2 : 1);
         break;
     }
     default:
@@ -470,54 +507,1631 @@ void JitEngine::emitStoreOperand(const OpdDesc& opd, int x64reg, bool is_word) {
     }
 }
 
-// Capture RFLAGS after ALU op → merge into cpu.flags
-// pushfq; pop rax; and eax, FLAGS_MASK; mov [rcx+OFF_FLAGS], ax
+// Set a segment register from the low word of an x64 register, and its
+// base: mov [rcx + sregOff(s)], x64reg16; movzx r10d, x64reg16;
+// shl r10d, 4; mov [rcx + segBaseOff(s)], r10d. Clobbers R10.
+void JitEngine::emitStoreSreg(int sreg, int x64reg) {
+    emitInsn(x64::mov(x64::W16, x64::mem(RCX, sregOff(sreg)), x64reg));
+    emitInsn(x64::movzx16(R10, x64reg));
+    emitInsn(x64::shift(x64::SHL, x64::D32, R10, 4));
+    emitInsn(x64::mov(x64::D32, x64::mem(RCX, segBaseOff(sreg)), R10));
+}
+
+void JitEngine::emitFlatCheck() {
+    // Branches return to the dispatcher anyway, and so does a scratch
+    // instruction
+    if (!flat_ || !cur_block_) return;
+    PeepState peep = peepSave();
+    // All four segment registers at once
+    emitInsn(x64::aluImm(x64::CMP, x64::Q64, x64::mem(RCX, OFF_SREGS), 0));
+    // je → still flat
+    code_.emit8(0x74);
+    size_t patch = code_.cursor();
+    code_.emit8(0);
+    emitInsn(x64::movImm(x64::B8, x64::mem(RCX, OFF_SMC_EXIT), 1));
+    code_.patch8(patch, (uint8_t)(code_.cursor() - patch - 1));
+    peepRestore(peep, 0);
+    code_write_checked_ = true;  // compileBlock emits the smc_exit check
+}
+
+// Capture RFLAGS → cpu.flags arithmetic bits, and mark them current.
+// IF reads back set and TF clear as the host has them; DF is the guest's.
+// LAHF/SETO rather than PUSHFQ where the host has them: the low byte of
+// RFLAGS is already laid out as the 8086's, and OF is the only arithmetic
+// flag above it.
 void JitEngine::emitCaptureFlags() {
-    code_.emit8(0x9C); // pushfq
-    code_.emit8(0x58); // pop rax
-    code_.emit8(0x25); // AND EAX, imm32
-    code_.emit32(FLAGS_MASK);
-    code_.emit8(0x66); // 16-bit
-    code_.emit8(0x89); // MOV r/m16, r16
-    emitModRMDisp(code_, RAX, OFF_FLAGS);
+    emitHostFlagBits();
+    emitInsn(x64::aluImm(x64::AND, x64::D32, RAX, F_CF | F_PF | F_AF | F_ZF | F_SF | F_OF));
+    // Keep the guest's DF, IF reads back set
+    emitInsn(x64::movzx16(RDX, x64::mem(RCX, OFF_FLAGS)));
+    emitInsn(x64::aluImm(x64::AND, x64::D32, RDX, F_DF));
+    emitInsn(x64::alu(x64::OR, x64::D32, RAX, RDX));
+    emitInsn(x64::aluImm(x64::OR, x64::D32, RAX, F_IF));
+    emitInsn(x64::mov(x64::W16, x64::mem(RCX, OFF_FLAGS), RAX));
+    emitInsn(x64::movImm(x64::D32, x64::mem(RCX, OFF_LAZY_OP), LAZY_NONE));
 }
 
-// Capture flags but preserve CF (for INC/DEC)
-void JitEngine::emitCaptureFlagsPreserveCF() {
-    // Load old CF (MOVZX doesn't modify flags — safe before pushfq)
-    code_.emit8(0x0F); code_.emit8(0xB7);
-    emitModRMDisp(code_, RBX, OFF_FLAGS);
+// RFLAGS → AX in the cpu.flags layout: LAHF gives the low byte, SETO and a
+// rotate put OF at bit 11. Bits outside CF/PF/AF/ZF/SF/OF are undefined.
+void JitEngine::emitHostFlagBits() {
+    if (!lahf_sahf_) {
+        emitInsn(x64::pushfq());
+        emitInsn(x64::pop(RAX));
+        return;
+    }
+    emitInsn(x64::lahf());
+    emitInsn(x64::setcc(x64::CC_O, RAX));
+    emitInsn(x64::shift(x64::SHL, x64::B8, RAX, 3));
+    emitInsn(x64::shift(x64::ROL, x64::W16, RAX, 8));
+}
 
-    // Save ALU flags BEFORE any flag-modifying ops
-    code_.emit8(0x9C); // pushfq
+// Load cpu.flags' arithmetic bits into RFLAGS (for Jcc evaluation).
+// SAHF takes SF/ZF/AF/PF/CF and leaves TF/IF/DF alone; OF comes from an
+// ADD that overflows exactly when the guest's OF is set.
+void JitEngine::emitRestoreFlags() {
+    if (!lahf_sahf_) {
+        // Only the arithmetic flags: never TF/IF on the host
+        emitInsn(x64::movzx16(RAX, x64::mem(RCX, OFF_FLAGS)));
+        emitInsn(x64::aluImm(x64::AND, x64::D32, RAX, F_CF | F_PF | F_AF | F_ZF | F_SF | F_OF));
+        emitInsn(x64::push(RAX));
+        emitInsn(x64::popfq());
+        return;
+    }
+    // Rotated, AH = SF:ZF:0:AF:0:PF:1:CF and AL bit 3 = OF
+    emitInsn(x64::movzx16(RAX, x64::mem(RCX, OFF_FLAGS)));
+    emitInsn(x64::shift(x64::ROL, x64::W16, RAX, 8));
+    emitInsn(x64::aluImm(x64::AND, x64::B8, RAX, F_OF >> 8));
+    emitInsn(x64::aluImm(x64::ADD, x64::B8, RAX, 0x78));  // 08h + 78h overflows
+    emitInsn(x64::sahf());
+}
 
-    // Now safe to modify flags
-    code_.emit8(0x83); code_.emit8(0xE3); code_.emit8(0x01); // AND EBX, 1
+// RFLAGS → reg in the cpu.flags layout, keeping RAX (an ALU result) intact
+// in EDX meanwhile. The host flags are clobbered afterwards.
+void JitEngine::emitHostFlags(int reg) {
+    if (!lahf_sahf_) {
+        emitInsn(x64::pushfq());
+        emitInsn(x64::pop(reg));
+        return;
+    }
+    emitInsn(x64::mov(x64::D32, RDX, RAX));
+    emitHostFlagBits();
+    emitInsn(x64::mov(x64::D32, reg, RAX));
+    emitInsn(x64::mov(x64::D32, RAX, RDX));
+}
 
-    // Get saved ALU flags
-    code_.emit8(0x58); // pop rax
-    code_.emit8(0x25); // AND EAX, imm32
-    code_.emit32(FLAGS_MASK & ~F_CF); // all flags except CF
+bool JitEngine::hostHasLahfSahf() {
+    unsigned a, b, c, d;
+    return __get_cpuid(0x80000001, &a, &b, &c, &d) && (c & 1);
+}
 
-    // OR in old CF
-    code_.emit8(0x09); code_.emit8(0xD8); // OR EAX, EBX
+// =====================================================================
+// Lazy condition flags
+// =====================================================================
+//
+// ALU instructions don't save RFLAGS. They store their opcode and input
+// operands in cpu.lazy_*, and whatever needs the flags replays the op on
+// the host: a Jcc straight into RFLAGS, PUSHF/LAHF/etc. into cpu.flags.
+// lazy_state_ tracks lazy_op through the block being translated, so most
+// consumers know which op to replay; at a block entry it's unknown and the
+// shared stub dispatches on lazy_op at run time.
+
+void JitEngine::emitSetLazy(uint32_t op, bool is_word, bool has_src) {
+    if (is_word) op |= LAZY_WORD;
+    emitInsn(x64::mov(x64::D32, x64::mem(RCX, OFF_LAZY_DST), RAX));
+    if (has_src) emitInsn(x64::mov(x64::D32, x64::mem(RCX, OFF_LAZY_SRC), RDX));
+    if (lazy_state_ != (int)op) emitInsn(x64::movImm(x64::D32, x64::mem(RCX, OFF_LAZY_OP), op));
+    lazy_state_ = (int)op;
+}
 
-    // Store
-    code_.emit8(0x66);
-    code_.emit8(0x89);
-    emitModRMDisp(code_, RAX, OFF_FLAGS);
+void JitEngine::emitRegenFlags(uint32_t op) {
+    uint32_t base = op & ~LAZY_WORD;
+    bool is_word = (op & LAZY_WORD) != 0;
+
+    if (base == LAZY_ADC || base == LAZY_SBB) {
+        // bt dword [rcx+OFF_LAZY_CIN], 0 → CF = carry in
+        code_.emit8(0x0F); code_.emit8(0xBA);
+        emitModRMDisp(code_, 4, OFF_LAZY_CIN);
+        code_.emit8(0);
+    } else if (base == LAZY_INC || base == LAZY_DEC) {
+        // INC/DEC leave CF alone: start from the guest's
+        code_.emit8(0x0F); code_.emit8(0xBA);
+        emitModRMDisp(code_, 4, OFF_FLAGS);
+        code_.emit8(0);
+    }
+
+    // mov ebx, [rcx+OFF_LAZY_DST]
+    code_.emit8(0x8B);
+    emitModRMDisp(code_, RBX, OFF_LAZY_DST);
+
+    if (is_word) code_.emit8(0x66);
+    switch (base) {
+    case LAZY_INC:
+        code_.emit8(is_word ? 0xFF : 0xFE); code_.emit8(0xC3); // INC BX/BL
+        return;
+    case LAZY_DEC:
+        code_.emit8(is_word ? 0xFF : 0xFE); code_.emit8(0xCB); // DEC BX/BL
+        return;
+    case LAZY_NEG:
+        code_.emit8(is_word ? 0xF7 : 0xF6); code_.emit8(0xDB); // NEG BX/BL
+        return;
+    default:
+        break;
+    }
+
+    // <op> bx/bl, [rcx+OFF_LAZY_SRC]
+    uint8_t opc;
+    switch (base) {
+    case LAZY_ADD: opc = 0x02; break;
+    case LAZY_OR:  opc = 0x0A; break;
+    case LAZY_ADC: opc = 0x12; break;
+    case LAZY_SBB: opc = 0x1A; break;
+    case LAZY_AND: opc = 0x22; break;
+    case LAZY_SUB: opc = 0x2A; break;
+    default:       opc = 0x32; break; // LAZY_XOR
+    }
+    code_.emit8(opc | (is_word ? 1 : 0));
+    emitModRMDisp(code_, RBX, OFF_LAZY_SRC);
 }
 
-// Push cpu.flags to native stack and popfq (for Jcc evaluation)
-// CRITICAL: mask out TF (bit 8) and IF (bit 9) to avoid native traps
-void JitEngine::emitRestoreFlags() {
-    // movzx rax, word [rcx+OFF_FLAGS]
+void JitEngine::emitMaterializeFlags() {
+    if (lazy_state_ == LAZY_NONE) return;
+    if (lazy_state_ > 0) {
+        emitRegenFlags((uint32_t)lazy_state_);
+        emitCaptureFlags();
+    } else {
+        // call flags stub
+        code_.emit8(0xE8);
+        code_.emit32((uint32_t)(flags_stub_ - (code_.cursor() + 4)));
+    }
+    lazy_state_ = LAZY_NONE;
+}
+
+void JitEngine::emitLoadHostFlags() {
+    if (lazy_state_ > 0) {
+        emitRegenFlags((uint32_t)lazy_state_);
+        return;
+    }
+    emitMaterializeFlags();
+    emitRestoreFlags();
+}
+
+void JitEngine::emitFlagsReplaced() {
+    if (lazy_state_ != LAZY_NONE) {
+        code_.emit8(0xC7);
+        emitModRMDisp(code_, 0, OFF_LAZY_OP);
+        code_.emit32(LAZY_NONE);
+    }
+    lazy_state_ = LAZY_NONE;
+}
+
+void JitEngine::emitStringCompareFlags(bool is_word) {
+    if (flag_plan_ == FLAGS_DEAD) return;
+    code_.emit8(0x89); code_.emit8(0xC2); // MOV EDX, EAX
+    code_.emit8(0x89); code_.emit8(0xD8); // MOV EAX, EBX
+    if (flag_plan_ == FLAGS_KEEP) {
+        emitSetLazy(LAZY_SUB, is_word, true);
+        return;
+    }
+    if (is_word) code_.emit8(0x66);
+    code_.emit8(is_word ? 0x29 : 0x28); code_.emit8(0xD0); // SUB AX/AL, DX/DL
+    emitCarryOut();
+}
+
+void JitEngine::emitCarryOut() {
+    // setc byte [rcx+OFF_LAZY_CIN]
+    code_.emit8(0x0F); code_.emit8(0x92);
+    emitModRMDisp(code_, 0, OFF_LAZY_CIN);
+    lazy_state_ = LAZY_IN_CIN;
+}
+
+void JitEngine::emitSaveCarryIn() {
+    if (lazy_state_ == LAZY_IN_CIN) return;
+    uint32_t base = (uint32_t)lazy_state_ & ~LAZY_WORD;
+    if (lazy_state_ > 0 && base != LAZY_INC && base != LAZY_DEC) {
+        emitRegenFlags((uint32_t)lazy_state_);
+        // setc byte [rcx+OFF_LAZY_CIN]
+        code_.emit8(0x0F); code_.emit8(0x92);
+        emitModRMDisp(code_, 0, OFF_LAZY_CIN);
+        return;
+    }
+    // CF is in cpu.flags (after INC/DEC it always is)
+    if (lazy_state_ < 0) emitMaterializeFlags();
     code_.emit8(0x0F); code_.emit8(0xB7);
     emitModRMDisp(code_, RAX, OFF_FLAGS);
-    // Mask to only arithmetic flags — never set TF/IF on native CPU
-    code_.emit8(0x25); code_.emit32(F_CF | F_PF | F_AF | F_ZF | F_SF | F_OF); // AND EAX, 0x08D5
-    code_.emit8(0x50); // push rax
-    code_.emit8(0x9D); // popfq
+    code_.emit8(0x83); code_.emit8(0xE0); code_.emit8(F_CF); // AND EAX, CF
+    code_.emit8(0x89);
+    emitModRMDisp(code_, RAX, OFF_LAZY_CIN);
+}
+
+void JitEngine::emitSyncCarry() {
+    uint32_t base = (uint32_t)lazy_state_ & ~LAZY_WORD;
+    if (lazy_state_ == LAZY_NONE || base == LAZY_INC || base == LAZY_DEC) return;
+    if (lazy_state_ < 0) {
+        emitMaterializeFlags();
+        return;
+    }
+    emitRegenFlags((uint32_t)lazy_state_);
+    code_.emit8(0x0F); code_.emit8(0x92); code_.emit8(0xC3); // SETC BL
+    // and byte [rcx+OFF_FLAGS], ~CF; or byte [rcx+OFF_FLAGS], bl
+    code_.emit8(0x80);
+    emitModRMDisp(code_, 4, OFF_FLAGS);
+    code_.emit8((uint8_t)~F_CF);
+    code_.emit8(0x08);
+    emitModRMDisp(code_, RBX, OFF_FLAGS);
+}
+
+void JitEngine::emitFlagsHelpers() {
+    // Stub: called with RCX = CPU*, clobbers RAX, RBX, RDX
+    flags_stub_ = code_.cursor();
+    code_.emit8(0x8B);
+    emitModRMDisp(code_, RAX, OFF_LAZY_OP);       // mov eax, [lazy_op]
+    code_.emit8(0x85); code_.emit8(0xC0);         // test eax, eax
+    code_.emit8(0x0F); code_.emit8(0x84);         // jz done
+    size_t toDone = code_.cursor();
+    code_.emit32(0);
+    code_.emit8(0x48); code_.emit8(0x8D); code_.emit8(0x15); // lea rdx, [rip+table]
+    size_t toTable = code_.cursor();
+    code_.emit32(0);
+    code_.emit8(0x48); code_.emit8(0x63); code_.emit8(0x04); code_.emit8(0x82); // movsxd rax, [rdx+rax*4]
+    code_.emit8(0x48); code_.emit8(0x01); code_.emit8(0xD0); // add rax, rdx
+    code_.emit8(0xFF); code_.emit8(0xE0);                    // jmp rax
+
+    const uint32_t TABLE_SIZE = LAZY_WORD * 2;
+    std::vector<size_t> cases(TABLE_SIZE, 0);
+    for (uint32_t op = 1; op < TABLE_SIZE; op++) {
+        if ((op & ~LAZY_WORD) == 0 || (op & ~LAZY_WORD) >= LAZY_OP_COUNT) continue;
+        cases[op] = code_.cursor();
+        emitRegenFlags(op);
+        emitCaptureFlags();
+        code_.emit8(0xC3); // ret
+    }
+    size_t done = code_.cursor();
+    code_.emit8(0xC3); // ret
+    code_.patch32(toDone, (uint32_t)(done - (toDone + 4)));
+
+    size_t table = code_.cursor();
+    code_.patch32(toTable, (uint32_t)(table - (toTable + 4)));
+    for (uint32_t op = 0; op < TABLE_SIZE; op++)
+        code_.emit32((uint32_t)((cases[op] ? cases[op] : done) - table));
+
+    // Entry for the dispatcher
+    flags_entry_ = code_.cursor();
+    emitPrologue();
+    code_.emit8(0xE8);
+    code_.emit32((uint32_t)(flags_stub_ - (code_.cursor() + 4)));
+    emitEpilogue();
+}
+
+void JitEngine::syncFlags() {
+    if (cpu_.lazy_op != LAZY_NONE)
+        code_.getFunc<void(*)(CPU8086*)>(flags_entry_)(&cpu_);
+}
+
+// =====================================================================
+// Translation cache
+// =====================================================================
+
+// Instructions that emit their own exit (IP write + epilogue)
+static bool isBranch(OpType op) {
+    switch (op) {
+    case OpType::JMP: case OpType::CALL: case OpType::RET: case OpType::RETF:
+    case OpType::IRET: case OpType::JCXZ: case OpType::LOOP:
+    case OpType::LOOPE: case OpType::LOOPNE:
+        return true;
+    default:
+        return op >= OpType::JO && op <= OpType::JNLE;
+    }
+}
+
+// DOS/BIOS services that translated blocks call in place (the rest go
+// through pending_int and the dispatcher)
+static bool isServiceInt(const DecodedInstr& in) {
+    if (in.op != OpType::INT) return false;
+    uint8_t num = (uint8_t)in.dst.imm;
+    return num == 0x10 || num == 0x16 || num == 0x21;
+}
+
+// Instructions after which control must return to the dispatcher
+static bool endsBlock(const DecodedInstr& in) {
+    switch (in.op) {
+    case OpType::INT:
+        return !isServiceInt(in);
+    case OpType::INTO: case OpType::HLT:
+        return true;
+    case OpType::AAM:
+        return (uint8_t)in.dst.imm == 0; // divide error
+    default:
+        return isBranch(in.op);
+    }
+}
+
+// =====================================================================
+// Flag liveness
+// =====================================================================
+
+static constexpr uint16_t ARITH_FLAGS = F_CF | F_PF | F_AF | F_ZF | F_SF | F_OF;
+
+// Could leave the block right after it: stores check for code overwrites
+static bool mayStore(const DecodedInstr& in) {
+    switch (in.op) {
+    case OpType::PUSH: case OpType::PUSHA: case OpType::PUSHF: case OpType::CALL:
+    case OpType::MOVSB: case OpType::MOVSW: case OpType::STOSB: case OpType::STOSW:
+    case OpType::INT:
+        return true;
+    case OpType::CMP: case OpType::TEST:
+        return false;
+    default:
+        return in.dst.kind == OpdKind::MEM;
+    }
+}
+
+// Arithmetic flags an instruction reads (given those live after it) and
+// writes. Anything that materializes FLAGS reads all of them.
+static void flagEffects(const DecodedInstr& in, uint16_t liveOut,
+                        uint16_t& uses, uint16_t& defs) {
+    static const uint16_t jccUses[] = {
+        F_OF, F_OF, F_CF, F_CF, F_ZF, F_ZF, F_CF | F_ZF, F_CF | F_ZF,
+        F_SF, F_SF, F_PF, F_PF, F_SF | F_OF, F_SF | F_OF,
+        F_ZF | F_SF | F_OF, F_ZF | F_SF | F_OF
+    };
+    bool zeroCount = (in.src.kind == OpdKind::IMM8 && (in.src.imm & 0x1F) == 0);
+    uses = defs = 0;
+    switch (in.op) {
+    case OpType::ADD: case OpType::SUB: case OpType::AND: case OpType::OR:
+    case OpType::XOR: case OpType::CMP: case OpType::TEST: case OpType::NEG:
+    case OpType::CMPSB: case OpType::CMPSW: case OpType::SCASB: case OpType::SCASW:
+    case OpType::MUL: case OpType::IMUL: case OpType::POPF: case OpType::IRET:
+        defs = ARITH_FLAGS;
+        break;
+    case OpType::ADC: case OpType::SBB:
+        uses = F_CF;
+        defs = ARITH_FLAGS;
+        break;
+    case OpType::INC: case OpType::DEC:
+        defs = ARITH_FLAGS & ~F_CF;
+        break;
+    case OpType::DAA: case OpType::DAS:
+        uses = F_CF | F_AF;
+        defs = F_CF | F_AF | F_ZF | F_SF | F_PF;
+        break;
+    case OpType::AAA: case OpType::AAS:
+        uses = F_AF;
+        defs = F_CF | F_AF;
+        break;
+    case OpType::AAM: case OpType::AAD:
+        if (in.op == OpType::AAD || (uint8_t)in.dst.imm != 0)
+            defs = F_ZF | F_SF | F_PF;
+        break;
+    case OpType::SHL: case OpType::SHR: case OpType::SAR:
+        if (in.src.kind == OpdKind::IMM8) {
+            if (!zeroCount) defs = ARITH_FLAGS;
+        } else if (liveOut) {
+            uses = ARITH_FLAGS; // CL = 0 keeps them
+        }
+        break;
+    case OpType::ROL: case OpType::ROR:
+        if (liveOut && !zeroCount) uses = ARITH_FLAGS; // merges CF/OF
+        break;
+    case OpType::RCL: case OpType::RCR:
+    case OpType::PUSHF: case OpType::LAHF: case OpType::SAHF:
+    case OpType::CLC: case OpType::STC: case OpType::CMC:
+    case OpType::CLI: case OpType::STI: case OpType::INT: case OpType::INTO:
+    case OpType::LOOPE: case OpType::LOOPNE:
+        uses = ARITH_FLAGS;
+        break;
+    default:
+        if (in.op >= OpType::JO && in.op <= OpType::JNLE)
+            uses = jccUses[(int)in.op - (int)OpType::JO];
+        break;
+    }
+}
+
+// Jcc, LOOP/LOOPE/LOOPNE/JCXZ and JMP rel: the branches a loop superblock
+// can keep inside itself. Sets target to the branch destination.
+static bool relBranch(const DecodedInstr& in, uint16_t ip, uint16_t& target) {
+    switch (in.op) {
+    case OpType::JMP:
+        if (in.dst.kind != OpdKind::REL8 && in.dst.kind != OpdKind::REL16) return false;
+        break;
+    case OpType::LOOP: case OpType::LOOPE: case OpType::LOOPNE: case OpType::JCXZ:
+        break;
+    default:
+        if (in.op < OpType::JO || in.op > OpType::JNLE) return false;
+        break;
+    }
+    target = (uint16_t)(ip + in.len + in.dst.rel);
+    return true;
+}
+
+// Index of the instruction starting at target in a loop superblock, or -1
+static int loopIndex(const std::vector<uint16_t>& ips, uint16_t target) {
+    auto it = std::lower_bound(ips.begin(), ips.end(), target);
+    return (it != ips.end() && *it == target) ? (int)(it - ips.begin()) : -1;
+}
+
+// Jump targets inside a loop superblock, and the instruction after each
+// branch (reached by a jump when the branch isn't taken)
+static std::vector<bool> loopLabels(const std::vector<DecodedInstr>& instrs,
+                                    const std::vector<uint16_t>& ips) {
+    size_t n = instrs.size();
+    std::vector<bool> label(n, false);
+    for (size_t i = 0; i < n; i++) {
+        uint16_t target;
+        int t;
+        if (relBranch(instrs[i], ips[i], target) && (t = loopIndex(ips, target)) > 0)
+            label[t] = true;
+        if (isBranch(instrs[i].op) && i + 1 < n) label[i + 1] = true;
+    }
+    return label;
+}
+
+// Backward pass over a block: how each instruction should handle the flags
+// it produces. Everything is live at the block's exits. For a loop
+// superblock (ips = instruction addresses) forward jumps inside the loop
+// see the flags live at their targets instead.
+static std::vector<FlagPlan> planFlags(const std::vector<DecodedInstr>& instrs,
+                                       const std::vector<uint16_t>* ips = nullptr) {
+    size_t n = instrs.size();
+    std::vector<FlagPlan> plan(n, FLAGS_KEEP);
+    std::vector<uint16_t> liveIn(n + 1, ARITH_FLAGS);  // [n]: falls out of the block
+    std::vector<bool> label = ips ? loopLabels(instrs, *ips) : std::vector<bool>(n, false);
+    size_t nextTouch = n; // next instruction that reads or writes flags
+    for (size_t i = n; i-- > 0;) {
+        const DecodedInstr& in = instrs[i];
+        uint16_t live = liveIn[i + 1], target;
+        if (ips && relBranch(in, (*ips)[i], target)) {
+            // Only forward jumps stay in the loop body; the back edge may
+            // stop at the budget check, so everything else is an exit
+            int t = loopIndex(*ips, target);
+            uint16_t taken = t > (int)i ? liveIn[t] : ARITH_FLAGS;
+            live = in.op == OpType::JMP ? taken : (uint16_t)(live | taken);
+        }
+        if (mayStore(in)) live = ARITH_FLAGS;
+        uint16_t uses, defs;
+        flagEffects(in, live, uses, defs);
+
+        plan[i] = FLAGS_KEEP;
+        if ((live & (defs ? defs : ARITH_FLAGS)) == 0) {
+            plan[i] = FLAGS_DEAD;
+        } else if (live == F_CF && nextTouch < n &&
+                   (instrs[nextTouch].op == OpType::ADC || instrs[nextTouch].op == OpType::SBB)) {
+            switch (in.op) {
+            case OpType::ADD: case OpType::ADC: case OpType::SUB: case OpType::SBB:
+            case OpType::AND: case OpType::OR:  case OpType::XOR: case OpType::CMP:
+            case OpType::TEST: case OpType::NEG:
+            case OpType::CMPSB: case OpType::CMPSW: case OpType::SCASB: case OpType::SCASW:
+                plan[i] = FLAGS_CARRY;
+                break;
+            default:
+                break;
+            }
+        }
+
+        liveIn[i] = uses | (live & ~defs);
+        if (uses | defs) nextTouch = i;
+        // CF can't be handed over in lazy_cin across a branch or into a
+        // jump target: the other path doesn't set it
+        if (label[i] || (ips && isBranch(in.op))) nextTouch = n;
+    }
+    return plan;
+}
+
+std::vector<DecodedInstr> JitEngine::decodeBlock(uint16_t ip, uint32_t max_instrs) {
+    std::vector<DecodedInstr> instrs;
+    uint16_t end = ip;
+    for (DecodedInstr instr = decode8086(cpu_.memory, ip); ;) {
+        if (instr.op == OpType::INVALID) break;
+        instrs.push_back(instr);
+        end += instr.len;
+        if (endsBlock(instr) || instr.has_rep) break;
+        if (instrs.size() >= max_instrs || end < ip) break;
+        if (hasDirective(end)) break;  // the dispatcher handles it first
+        instr = decode8086(cpu_.memory, end);
+        if (instr.has_rep) break;
+    }
+    return instrs;
+}
+
+std::vector<DecodedInstr> JitEngine::decodeLoop(uint16_t ip) {
+    std::vector<DecodedInstr> instrs;
+    if (hasDirective(ip)) return instrs;  // the dispatcher sees every arrival
+    size_t body = 0;  // instructions up to the last branch back to ip
+    for (uint16_t cur = ip; instrs.size() < MAX_BLOCK_INSTRS; ) {
+        if (cur != ip && hasDirective(cur)) break;
+        DecodedInstr instr = decode8086(cpu_.memory, cur);
+        if (instr.op == OpType::INVALID || instr.has_rep) break;
+        uint16_t target = 0;
+        bool rel = relBranch(instr, cur, target);
+        if (!rel && endsBlock(instr)) break;
+        instrs.push_back(instr);
+        if (rel && target == ip) body = instrs.size();
+        uint16_t next = cur + instr.len;
+        if (next < cur) break;
+        cur = next;
+    }
+    instrs.resize(body);
+    return instrs;
+}
+
+static bool flatSegments(const CPU8086& cpu) {
+    return (cpu.sregs[0] | cpu.sregs[1] | cpu.sregs[2] | cpu.sregs[3]) == 0;
+}
+
+static bool segmentsMatch(const CPU8086& cpu, const JitBlock* blk) {
+    for (int s = 0; s < 4; s++)
+        if ((blk->seg_fold & (1 << s)) && cpu.sregs[s] != blk->seg_value[s]) return false;
+    return true;
+}
+
+// Memory accesses per segment register and segment registers written, for
+// choosing the segment bases a loop superblock keeps in host registers
+static void segmentUse(const DecodedInstr& in, int uses[4], bool written[4]) {
+    int seg = in.seg_override != 0xFF ? in.seg_override : (int)S_DS;
+    for (const OpdDesc* o : {&in.dst, &in.src}) {
+        if (o->kind == OpdKind::MEM && in.op != OpType::LEA)
+            uses[in.seg_override != 0xFF ? in.seg_override : (o->base == R_BP ? (int)S_SS : (int)S_DS)]++;
+    }
+    if (in.dst.kind == OpdKind::SREG && in.op != OpType::PUSH) written[in.dst.reg] = true;
+    switch (in.op) {
+    case OpType::LDS: written[S_DS] = true; break;
+    case OpType::LES: written[S_ES] = true; break;
+    case OpType::INT:  // DOS calls return segments (AH=2Fh, 35h, ...)
+        for (int i = 0; i < 4; i++) written[i] = true;
+        break;
+    case OpType::MOVSB: case OpType::MOVSW: case OpType::CMPSB: case OpType::CMPSW:
+        uses[seg]++; uses[S_ES]++; break;
+    case OpType::LODSB: case OpType::LODSW: case OpType::XLAT:
+        uses[seg]++; break;
+    case OpType::STOSB: case OpType::STOSW: case OpType::SCASB: case OpType::SCASW:
+        uses[S_ES]++; break;
+    case OpType::PUSH: case OpType::POP: case OpType::PUSHF: case OpType::POPF:
+        uses[S_SS]++; break;
+    default: break;
+    }
+}
+
+JitBlock* JitEngine::compileBlock(uint16_t ip, uint32_t max_instrs) {
+    DecodedInstr first = decode8086(cpu_.memory, ip);
+    if (first.op == OpType::INVALID) return nullptr;
+
+    auto blk = std::make_unique<JitBlock>();
+    blk->ip = ip;
+
+    if (first.has_rep) {
+        // REP string ops iterate in the dispatcher
+        blk->len = (uint16_t)first.len;
+        blk->instr_count = 1;
+        blk->code_off = 0;
+        blk->is_rep = true;
+        blk->rep_instr = first;
+    } else {
+        // Decode the whole block first so flag liveness can look ahead; a
+        // loop head takes the whole loop body as one superblock
+        std::vector<DecodedInstr> instrs = decodeLoop(ip);
+        bool loop = !instrs.empty();
+        if (!loop) instrs = decodeBlock(ip, max_instrs);
+
+        // A full cache is flushed and the block retranslated from scratch;
+        // an instruction that can't be emitted ends the block before it
+        bool stopped = false;
+        for (int flushes = 0; ; ) {
+            size_t start = code_.cursor();
+            uint16_t cur = ip;
+            uint32_t count = 0;
+            block_exits_.clear();
+            block_relocs_.clear();
+            link_exits_ = true;
+            std::vector<std::pair<size_t, uint32_t>> smcFixups;  // (patch, count so far)
+            std::vector<bool> label;
+            loop_ = LoopState();
+            if (loop) {
+                loop_.active = true;
+                for (const DecodedInstr& instr : instrs) {
+                    loop_.ips.push_back(cur);
+                    cur += instr.len;
+                }
+                cur = ip;
+                loop_.offs.resize(instrs.size());
+                label = loopLabels(instrs, loop_.ips);
+                chooseSegmentBases(instrs);
+            }
+            seg_fold_ = chooseSegmentFolds(instrs, ip);
+            std::vector<FlagPlan> plans = planFlags(instrs, loop ? &loop_.ips : nullptr);
+            lazy_state_ = LAZY_UNKNOWN;
+            bool failed = false;
+            try {
+                emitPrologue();
+                blk->chain_off = code_.cursor();
+                emitSegmentGuard(ip);
+                if (loop) {
+                    emitLoadSegmentBases();
+                    loop_.head_off = code_.cursor();
+                }
+                size_t countPos = emitBudgetCheck(ip);
+                for (const DecodedInstr& instr : instrs) {
+                    if (loop) {
+                        loop_.index = count;
+                        loop_.offs[count] = code_.cursor();
+                        if (label[count]) {
+                            // more than one way in
+                            lazy_state_ = LAZY_UNKNOWN;
+                            peepReset();
+                        }
+                    }
+                    peepBoundary();
+                    code_write_checked_ = false;
+                    cur_block_ = isBranch(instr.op) ? nullptr : blk.get();
+                    flag_plan_ = plans[count];
+                    if (!emitInstruction(instr, cur)) {
+                        failed = true;
+                        break;
+                    }
+                    count++;
+                    cur += instr.len;
+                    if (code_write_checked_ && !isBranch(instr.op))
+                        smcFixups.emplace_back(emitCodeWriteExit(cur), count);
+                }
+                flag_plan_ = FLAGS_KEEP;
+                if (!failed) {
+                    const DecodedInstr& last = instrs.back();
+                    if (isBranch(last.op)) {
+                        // emitted its own exits
+                    } else if (stopped || endsBlock(last)) {
+                        // Stopped before an instruction that can't be
+                        // emitted: the dispatcher reports the failure when
+                        // execution actually reaches it
+                        emitSetIP(cur);
+                        emitEpilogue();
+                    } else {
+                        emitExit(cur);
+                    }
+                    code_.patch32(countPos, count);
+                    for (auto& f : smcFixups) code_.patch32(f.first, count - f.second);
+                    for (auto& f : loop_.fixups)
+                        code_.patch32(f.first, (uint32_t)(int32_t)((int64_t)loop_.offs[f.second] -
+                                                                   (int64_t)(f.first + 4)));
+                }
+            } catch (const std::runtime_error&) {
+                flag_plan_ = FLAGS_KEEP;
+                loop_.active = false;
+                seg_fold_ = 0;
+                if (flushes++ > 0) throw;
+                evictAll();
+                continue;
+            }
+            loop_.active = false;
+            if (failed && loop) {
+                // Not everything in the loop can be emitted: fall back to
+                // the plain block
+                code_.rewind(start);
+                instrs = decodeBlock(ip, max_instrs);
+                loop = false;
+                continue;
+            }
+            if (failed) {
+                // Retranslate without it (liveness changes with the block end)
+                code_.rewind(start);
+                if (count == 0) {
+                    link_exits_ = false;
+                    cur_block_ = nullptr;
+                    seg_fold_ = 0;
+                    return nullptr;
+                }
+                instrs.resize(count);
+                stopped = true;
+                continue;
+            }
+            link_exits_ = false;
+            cur_block_ = nullptr;
+            blk->len = (uint16_t)(cur - ip);
+            blk->instr_count = count;
+            blk->code_off = start;
+            blk->exits = block_exits_;
+            blk->relocs = block_relocs_;
+            blk->seg_fold = seg_fold_;
+            for (int s = 0; s < 4; s++)
+                if (seg_fold_ & (1 << s)) blk->seg_value[s] = cpu_.sregs[s];
+            seg_fold_ = 0;
+            cache_dirty_ = true;
+            break;
+        }
+    }
+
+    JitBlock* raw = blk.get();
+    blocks_.push_back(std::move(blk));
+    block_map_[ip] = raw;
+    markCodePages(raw);
+    if (!raw->is_rep) linkBlock(raw);
+    return raw;
+}
+
+void JitEngine::chooseSegmentBases(const std::vector<DecodedInstr>& instrs) {
+    int uses[4] = {0, 0, 0, 0};
+    bool written[4] = {false, false, false, false};
+    if (flat_) return;
+    for (const DecodedInstr& instr : instrs) {
+        // PUSHA/POPA borrow RBP
+        if (instr.op == OpType::PUSHA || instr.op == OpType::POPA) return;
+        segmentUse(instr, uses, written);
+    }
+    int best = -1;
+    for (int s = 0; s < 4; s++) {
+        if (uses[s] > 0 && !written[s] && (best < 0 || uses[s] > uses[best]))
+            best = s;
+    }
+    if (best >= 0) loop_.seg_base[best] = RBP;
+}
+
+void JitEngine::emitLoadSegmentBases() {
+    for (int s = 0; s < 4; s++) {
+        int reg = loop_.seg_base[s];
+        if (reg < 0) continue;
+        // mov reg, [rcx + segBaseOff(s)]
+        emitInsn(x64::mov(x64::D32, reg, x64::mem(RCX, segBaseOff(s))));
+    }
+}
+
+uint8_t JitEngine::chooseSegmentFolds(const std::vector<DecodedInstr>& instrs, uint16_t ip) const {
+    // Flat-model blocks fold every [disp16] operand without a guard
+    if (flat_ || seg_misses_[ip] >= MAX_SEG_RETRANSLATIONS) return 0;
+    int uses[4] = {0, 0, 0, 0};
+    bool written[4] = {false, false, false, false};
+    uint8_t direct = 0;
+    for (const DecodedInstr& instr : instrs) {
+        segmentUse(instr, uses, written);
+        if (instr.op == OpType::LEA) continue;
+        for (const OpdDesc* o : {&instr.dst, &instr.src}) {
+            if (o->kind == OpdKind::MEM && o->direct)
+                direct |= 1 << (instr.seg_override != 0xFF ? instr.seg_override : (int)S_DS);
+        }
+    }
+    uint8_t fold = 0;
+    for (int s = 0; s < 4; s++)
+        if ((direct & (1 << s)) && !written[s]) fold |= 1 << s;
+    return fold;
+}
+
+void JitEngine::emitSegmentGuard(uint16_t ip) {
+    if (!seg_fold_) return;
+    std::vector<size_t> miss;
+    for (int s = 0; s < 4; s++) {
+        if (!(seg_fold_ & (1 << s))) continue;
+        // cmp word [rcx + sregOff(s)], value
+        code_.emit8(0x66); code_.emit8(0x81);
+        emitModRMDisp(code_, 7, sregOff(s));
+        code_.emit16(cpu_.sregs[s]);
+        // jne → retranslate
+        code_.emit8(0x75);
+        miss.push_back(code_.cursor());
+        code_.emit8(0);
+    }
+    // jmp → guard passed
+    code_.emit8(0xEB);
+    size_t pass = code_.cursor();
+    code_.emit8(0);
+    for (size_t p : miss) code_.patch8(p, (uint8_t)(code_.cursor() - p - 1));
+    emitSetIP(ip);
+    emitEpilogue();
+    code_.patch8(pass, (uint8_t)(code_.cursor() - pass - 1));
+    peepReset();
+}
+
+bool JitEngine::foldedAddress(const OpdDesc& opd, uint32_t& phys) const {
+    if (!opd.direct || seg_override_ == SEG_NONE) return false;
+    if (flat_) {
+        phys = (uint16_t)opd.disp;
+        return true;
+    }
+    int seg = seg_override_ != 0xFF ? seg_override_ : (int)S_DS;
+    if (!(seg_fold_ & (1 << seg))) return false;
+    phys = ((uint32_t)cpu_.sregs[seg] * 16 + (uint16_t)opd.disp) & 0xFFFFF;
+    return true;
+}
+
+size_t JitEngine::emitScratch(const DecodedInstr& instr, uint16_t ip) {
+    cur_block_ = nullptr;
+    for (int attempt = 0; ; attempt++) {
+        size_t start = code_.cursor();
+        lazy_state_ = LAZY_UNKNOWN;
+        try {
+            emitPrologue();
+            peepBoundary();
+            if (!emitInstruction(instr, ip)) {
+                code_.rewind(start);
+                return SIZE_MAX;
+            }
+            if (!isBranch(instr.op)) {
+                emitSetIP(ip + instr.len);
+                emitEpilogue();
+            }
+            return start;
+        } catch (const std::runtime_error&) {
+            if (attempt > 0) throw;
+            evictAll();
+        }
+    }
+}
+
+size_t JitEngine::translateReachable(uint32_t image_end) {
+    // Follow static successors from the entry point. Indirect jumps and
+    // calls, code only reached through them and anything outside the loaded
+    // image (zeroed memory decodes as endless ADDs) are left to the JIT.
+    std::vector<uint16_t> work = {cpu_.ip};
+    static_ips_.assign(0x10000, false);
+    size_t reserve = std::min(STATIC_CACHE_RESERVE, code_.capacity() / 4);
+    size_t blocks = 0;
+    eager_untranslated_ = 0;
+    while (!work.empty()) {
+        uint16_t ip = work.back();
+        work.pop_back();
+        if (static_ips_[ip] || ip < 0x100 || ip >= image_end) continue;
+        static_ips_[ip] = true;
+        // A flush would drop everything translated so far. Past that point
+        // the walk only decodes, so the rest still counts as found up front.
+        if (code_.cursor() + reserve > code_.capacity()) {
+            std::vector<DecodedInstr> instrs = decodeBlock(ip, MAX_BLOCK_INSTRS);
+            if (instrs.empty()) continue;
+            eager_untranslated_++;
+            uint16_t a = ip;
+            for (const DecodedInstr& in : instrs) {
+                uint16_t target = 0;
+                bool call = (in.op == OpType::CALL && in.dst.kind == OpdKind::REL16);
+                if (call) target = (uint16_t)(a + in.len + in.dst.rel);
+                if (call || relBranch(in, a, target)) work.push_back(target);
+                a += in.len;
+            }
+            switch (instrs.back().op) {
+            case OpType::JMP: case OpType::RET: case OpType::RETF: case OpType::IRET:
+                break;
+            default:
+                work.push_back(a);
+                break;
+            }
+            continue;
+        }
+        JitBlock* blk = block_map_[ip];
+        if (!blk && !cached_.empty()) blk = adoptCached(ip);
+        if (!blk) blk = compileBlock(ip, MAX_BLOCK_INSTRS);
+        if (!blk) continue;
+        blocks++;
+        for (const ChainSlot& slot : blk->exits) work.push_back(slot.target);
+        // Execution comes back after the last instruction unless it is a
+        // jump or return (a CALL returns there; so does an INT or HLT
+        // handled by the dispatcher)
+        DecodedInstr last;
+        for (uint16_t a = ip; (uint16_t)(a - ip) < blk->len; a += last.len)
+            last = decode8086(cpu_.memory, a);
+        switch (last.op) {
+        case OpType::JMP: case OpType::RET: case OpType::RETF: case OpType::IRET:
+            break;
+        default:
+            work.push_back((uint16_t)(ip + blk->len));
+            break;
+        }
+    }
+    return blocks;
+}
+
+std::string JitEngine::statsJson() const {
+    std::string json;
+    if (eager_) {
+        json += ",\"eager\":{\"discovered\":" + std::to_string(eager_static_ + eager_untranslated_)
+              + ",\"untranslated\":" + std::to_string(eager_untranslated_)
+              + ",\"dynamic\":" + std::to_string(eager_dynamic_)
+              + ",\"translate_us\":" + std::to_string(eager_us_) + "}";
+    }
+    if (stats_) {
+        // Invalidated blocks keep their bytes until the next eviction. Code
+        // is laid out in translation order, so a block owns everything up
+        // to the entry of the next one.
+        std::vector<std::pair<size_t, bool>> owned;  // (code_off, live)
+        for (auto& b : blocks_) {
+            if (b->is_threaded || b->is_rep) continue;
+            auto c = cached_.find(b->ip);
+            bool live = block_map_[b->ip] == b.get() ||
+                        (c != cached_.end() && c->second.first == b.get());
+            owned.emplace_back(b->code_off, live);
+        }
+        std::sort(owned.begin(), owned.end());
+        size_t dead = 0;
+        for (size_t i = 0; i < owned.size(); i++) {
+            size_t end = i + 1 < owned.size() ? owned[i + 1].first : code_.cursor();
+            if (!owned[i].second) dead += end - owned[i].first;
+        }
+        size_t blocks = code_.cursor() - helpers_end_;
+        char frag[16];
+        snprintf(frag, sizeof(frag), "%.3f", blocks ? (double)dead / (double)blocks : 0.0);
+        json += ",\"code_cache\":{\"capacity\":" + std::to_string(code_.capacity())
+              + ",\"used\":" + std::to_string(code_.cursor())
+              + ",\"peak\":" + std::to_string(std::max(cache_peak_, code_.cursor()))
+              + ",\"evictions\":" + std::to_string(cache_evictions_)
+              + ",\"evicted_blocks\":" + std::to_string(cache_evicted_blocks_)
+              + ",\"dead_bytes\":" + std::to_string(dead)
+              + ",\"fragmentation\":" + frag + "}";
+        json += ",\"peephole\":{\"bytes_saved\":" + std::to_string(peep_saved_bytes_)
+              + ",\"elided\":" + std::to_string(peep_elided_) + "}";
+        json += ",\"segment_folding\":{\"operands\":" + std::to_string(seg_folded_)
+              + ",\"retranslated\":" + std::to_string(seg_retranslated_) + "}";
+        json += std::string(",\"flat_model\":{\"active\":") + (flat_ ? "true" : "false")
+              + ",\"dropped\":" + std::to_string(flat_dropped_) + "}";
+    }
+    return json;
+}
+
+// Chained jumps only ever point into the cache, and every block goes at
+// once, so there is nothing left to unlink: the pending-link table, the
+// code page maps and the block map are cleared with the code.
+void JitEngine::evictAll() {
+    cache_peak_ = std::max(cache_peak_, code_.cursor());
+    cache_evictions_++;
+    for (auto& b : blocks_) {
+        if (!b->is_threaded && block_map_[b->ip] == b.get()) cache_evicted_blocks_++;
+    }
+    flushBlocks();
+}
+
+void JitEngine::leaveFlat() {
+    for (auto& b : blocks_) {
+        if (block_map_[b->ip] == b.get()) flat_dropped_++;
+    }
+    flat_dropped_ += cached_.size();
+    flat_ = false;
+    flushBlocks();
+}
+
+void JitEngine::flushBlocks() {
+    std::fill(block_map_.begin(), block_map_.end(), nullptr);
+    blocks_.clear();
+    cached_.clear();
+    unlinked_.clear();
+    for (auto& page : page_blocks_) page.clear();
+    memset(cpu_.code_pages, 0, sizeof(cpu_.code_pages));
+    memset(cpu_.code_bits, 0, sizeof(cpu_.code_bits));
+    code_.reset();
+    emitFlagsHelpers();
+    helpers_end_ = code_.cursor();
+}
+
+// =====================================================================
+// Block chaining
+// =====================================================================
+
+void JitEngine::emitExit(uint16_t target) {
+    if (loop_.active) {
+        size_t n = loop_.ips.size(), i = loop_.index;
+        int t = loopIndex(loop_.ips, target);
+        if (t == 0) {
+            // Back edge: the head charges the next iteration
+            emitUncount((uint32_t)(n - i - 1));
+            code_.emit8(0xE9);
+            code_.emit32((uint32_t)(int32_t)((int64_t)loop_.head_off - (int64_t)(code_.cursor() + 4)));
+            return;
+        }
+        if (t > (int)i) {
+            // Forward jump inside the loop, patched once the target is emitted
+            emitUncount((uint32_t)(t - i - 1));
+            code_.emit8(0xE9);
+            loop_.fixups.emplace_back(code_.cursor(), (size_t)t);
+            code_.emit32(0);
+            return;
+        }
+        // Side exit: the rest of the loop body wasn't executed
+        emitUncount((uint32_t)(n - i - 1));
+    }
+    // Directive addresses are only ever entered from the dispatcher
+    if (link_exits_ && !hasDirective(target)) {
+        // jmp rel32 — rel 0 falls through to the exit below until linked
+        code_.emit8(0xE9);
+        block_exits_.push_back({code_.cursor(), target});
+        code_.emit32(0);
+    }
+    emitSetIP(target);
+    emitEpilogue();
+}
+
+void JitEngine::emitUncount(uint32_t n) {
+    if (n == 0) return;
+    code_.emit8(REX_W); code_.emit8(0x81);
+    emitModRMDisp(code_, 0, OFF_INSTR_BUDGET);
+    code_.emit32(n);
+}
+
+size_t JitEngine::emitBudgetCheck(uint16_t ip) {
+    // mov eax, count (patched)
+    code_.emit8(0xB8);
+    size_t countPos = code_.cursor();
+    code_.emit32(0);
+    // sub [rcx + OFF_INSTR_BUDGET], rax
+    code_.emit8(REX_W); code_.emit8(0x29);
+    emitModRMDisp(code_, RAX, OFF_INSTR_BUDGET);
+    // jae → run the block
+    code_.emit8(0x73);
+    size_t patch = code_.cursor();
+    code_.emit8(0);
+    // Over budget: put it back and return to the dispatcher, which
+    // single-steps to the limit
+    // add [rcx + OFF_INSTR_BUDGET], rax
+    code_.emit8(REX_W); code_.emit8(0x01);
+    emitModRMDisp(code_, RAX, OFF_INSTR_BUDGET);
+    emitSetIP(ip);
+    emitEpilogue();
+    code_.patch8(patch, (uint8_t)(code_.cursor() - patch - 1));
+    return countPos;
+}
+
+void JitEngine::patchExit(JitBlock* from, size_t idx, JitBlock* to) {
+    ChainSlot& slot = from->exits[idx];
+    int64_t rel = to ? (int64_t)to->chain_off - (int64_t)(slot.rel_off + 4) : 0;
+    code_.patch32(slot.rel_off, (uint32_t)(int32_t)rel);
+    slot.linked = to;
+}
+
+void JitEngine::linkBlock(JitBlock* blk) {
+    // Outgoing: successors that are already translated
+    for (size_t i = 0; i < blk->exits.size(); i++) {
+        JitBlock* to = block_map_[blk->exits[i].target];
+        if (to && !to->is_rep && !to->is_threaded) {
+            patchExit(blk, i, to);
+            to->incoming.emplace_back(blk, i);
+        } else {
+            unlinked_.emplace(blk->exits[i].target, std::make_pair(blk, i));
+        }
+    }
+    // Incoming: earlier exits that were waiting for this block
+    auto range = unlinked_.equal_range(blk->ip);
+    for (auto it = range.first; it != range.second; ++it) {
+        patchExit(it->second.first, it->second.second, blk);
+        blk->incoming.push_back(it->second);
+    }
+    unlinked_.erase(range.first, range.second);
+}
+
+void JitEngine::invalidateBlock(JitBlock* blk) {
+    // Jumps into this block go back to exiting through the dispatcher
+    for (auto& in : blk->incoming) {
+        patchExit(in.first, in.second, nullptr);
+        unlinked_.emplace(blk->ip, in);
+    }
+    blk->incoming.clear();
+    // Its own exits stop being links or waiting for one
+    for (size_t i = 0; i < blk->exits.size(); i++) {
+        ChainSlot& slot = blk->exits[i];
+        auto self = std::make_pair(blk, i);
+        if (slot.linked) {
+            auto& in = slot.linked->incoming;
+            in.erase(std::remove(in.begin(), in.end(), self), in.end());
+            patchExit(blk, i, nullptr);
+        } else {
+            auto range = unlinked_.equal_range(slot.target);
+            for (auto it = range.first; it != range.second; ++it) {
+                if (it->second == self) { unlinked_.erase(it); break; }
+            }
+        }
+    }
+    blk->exits.clear();
+    if (block_map_[blk->ip] == blk) block_map_[blk->ip] = nullptr;
+    unmarkCodePages(blk);
+}
+
+// =====================================================================
+// Self-modifying code
+// =====================================================================
+
+// A block's bytes plus the one before its entry, so that a word store
+// straddling into the block is caught by the address of its first byte
+static void codePageSpan(const JitBlock* blk, unsigned& first, unsigned& count) {
+    first = (uint16_t)(blk->ip - 1) >> 8;
+    unsigned last = (uint16_t)(blk->ip + blk->len - 1) >> 8;
+    count = ((last - first) & 0xFF) + 1;
+}
+
+static void setCodeBits(CPU8086& cpu, const JitBlock* blk, bool on) {
+    for (unsigned i = 0; i <= blk->len; i++) {
+        uint16_t a = (uint16_t)(blk->ip - 1 + i);
+        if (on) cpu.code_bits[a >> 3] |= (uint8_t)(1 << (a & 7));
+        else    cpu.code_bits[a >> 3] &= (uint8_t)~(1 << (a & 7));
+    }
+}
+
+void JitEngine::markCodePages(JitBlock* blk) {
+    unsigned first, count;
+    codePageSpan(blk, first, count);
+    for (unsigned i = 0; i < count; i++) {
+        unsigned p = (first + i) & 0xFF;
+        page_blocks_[p].push_back(blk);
+        cpu_.code_pages[p] = 1;
+        cpu_.code_pages[0x1000 + p] = 1;  // the same bytes through the wrap
+    }
+    setCodeBits(cpu_, blk, true);
+}
+
+void JitEngine::unmarkCodePages(JitBlock* blk) {
+    unsigned first, count;
+    codePageSpan(blk, first, count);
+    setCodeBits(cpu_, blk, false);
+    for (unsigned i = 0; i < count; i++) {
+        unsigned p = (first + i) & 0xFF;
+        auto& list = page_blocks_[p];
+        list.erase(std::remove(list.begin(), list.end(), blk), list.end());
+        if (list.empty()) cpu_.code_pages[p] = cpu_.code_pages[0x1000 + p] = 0;
+        // Overlapping blocks keep their bytes marked
+        for (JitBlock* other : list) setCodeBits(cpu_, other, true);
+    }
+}
+
+bool JitEngine::invalidateRange(uint32_t phys, uint32_t len, JitBlock* cur) {
+    // Blocks are fetched through a 16-bit IP, so code only lives below 64K
+    if (len == 0 || phys >= 0x10000) return false;
+    uint32_t end = std::min<uint32_t>(phys + len, 0x10000);
+    bool hit = false;
+    for (uint32_t p = phys >> 8; p <= (end - 1) >> 8; p++) {
+        if (!cpu_.code_pages[p]) continue;
+        // Copy: invalidation edits the page lists
+        std::vector<JitBlock*> list = page_blocks_[p];
+        for (JitBlock* blk : list) {
+            // Overlap of [phys, end) and [ip, ip+len) modulo 64K
+            if ((uint16_t)(phys - blk->ip) < blk->len ||
+                (uint16_t)(blk->ip - phys) < end - phys) {
+                invalidateBlock(blk);
+                if (blk == cur) hit = true;
+            }
+        }
+    }
+    return hit;
+}
+
+void JitEngine::onCodeWrite(JitEngine* eng, uint32_t phys, uint32_t len, JitBlock* cur) {
+    if (eng->invalidateRange(phys, len, cur)) eng->cpu_.smc_exit = 1;
+}
+
+void JitEngine::emitCodeWriteCheck(int width) {
+    PeepState peep = peepSave();
+    // Page index → EDX; is there code on the page?
+    emitInsn(x64::mov(x64::D32, RDX, RAX));
+    emitInsn(x64::shift(x64::SHR, x64::D32, RDX, 8));
+    emitInsn(x64::aluImm(x64::CMP, x64::B8, x64::mem(RCX, RDX, OFF_CODE_PAGES), 0));
+    // je → no code on this page
+    code_.emit8(0x74);
+    size_t patch = code_.cursor();
+    code_.emit8(0);
+    // An address in the wrap is its alias below 64K from here on
+    emitInsn(x64::aluImm(x64::AND, x64::D32, RAX, 0x000FFFFF));
+    // jnc → data sharing a page with code
+    emitInsn(x64::bt(x64::mem(RCX, OFF_CODE_BITS), RAX));
+    code_.emit8(0x73);
+    size_t patchBit = code_.cursor();
+    code_.emit8(0);
+
+    // Slow path: keep RAX (address), RCX (CPU), R10 (stored value) and the
+    // caller-saved guest registers live across the call; 8 pushes keep the
+    // stack 16-byte aligned
+    static constexpr int kLive[] = { RAX, RCX, R10, RSI, RDI, R8, R9, R11 };
+    for (int r : kLive) emitInsn(x64::push(r));
+    // System V: onCodeWrite(rdi=this, esi=phys, edx=width, rcx=cur_block_)
+    emitMovAddress(RDI, ADDR_ENGINE);
+    emitInsn(x64::mov(x64::D32, RSI, RAX));
+    emitInsn(x64::movImm32(RDX, (uint32_t)width));
+    emitMovAddress(RCX, ADDR_BLOCK);
+    emitMovAddress(RAX, ADDR_CODE_WRITE);
+    emitInsn(x64::call(RAX));
+    for (size_t k = std::size(kLive); k-- > 0; ) emitInsn(x64::pop(kLive[k]));
+
+    code_.patch8(patch, (uint8_t)(code_.cursor() - patch - 1));
+    code_.patch8(patchBit, (uint8_t)(code_.cursor() - patchBit - 1));
+    peepRestore(peep, (1u << RAX) | (1u << RDX));
+    code_write_checked_ = true;
+}
+
+size_t JitEngine::emitCodeWriteExit(uint16_t nextIP) {
+    PeepState peep = peepSave();
+    emitInsn(x64::aluImm(x64::CMP, x64::B8, x64::mem(RCX, OFF_SMC_EXIT), 0));
+    // je → block still valid
+    code_.emit8(0x74);
+    size_t patch = code_.cursor();
+    code_.emit8(0);
+    emitInsn(x64::movImm(x64::B8, x64::mem(RCX, OFF_SMC_EXIT), 0));
+    // add qword [rcx + OFF_INSTR_BUDGET], <instructions not executed> (patched)
+    code_.emit8(REX_W); code_.emit8(0x81);
+    emitModRMDisp(code_, 0, OFF_INSTR_BUDGET);
+    size_t countPos = code_.cursor();
+    code_.emit32(0);
+    emitSetIP(nextIP);
+    emitEpilogue();
+    code_.patch8(patch, (uint8_t)(code_.cursor() - patch - 1));
+    peepRestore(peep, 0);
+    return countPos;
+}
+
+// =====================================================================
+// Bulk REP string operations
+// =====================================================================
+
+// Element-at-a-time fallback for a run that wraps past the top of the 1MB
+// space or copies over itself closer than one element apart
+static void repStringSlow(CPU8086& cpu, OpType op, uint32_t srcBase, uint32_t dstBase,
+                          uint16_t si, uint16_t di, int step, uint32_t count) {
+    uint32_t w = (step == 2 || step == -2) ? 2 : 1;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t s = (srcBase + si) & 0xFFFFF, d = (dstBase + di) & 0xFFFFF;
+        uint8_t lo, hi;
+        if (op == OpType::STOSB || op == OpType::STOSW) {
+            lo = cpu.regs[R_AX] & 0xFF; hi = cpu.regs[R_AX] >> 8;
+        } else {
+            lo = cpu.memory[s]; hi = cpu.memory[(s + 1) & 0xFFFFF];
+        }
+        if (op == OpType::LODSB || op == OpType::LODSW) {
+            cpu.regs[R_AX] = w == 2 ? (uint16_t)(lo | hi << 8)
+                                    : (uint16_t)((cpu.regs[R_AX] & 0xFF00) | lo);
+        } else {
+            cpu.memory[d] = lo;
+            if (w == 2) cpu.memory[(d + 1) & 0xFFFFF] = hi;
+        }
+        si = (uint16_t)(si + step);
+        di = (uint16_t)(di + step);
+    }
+}
+
+void JitEngine::runRepString(const DecodedInstr& instr) {
+    OpType op = instr.op;
+    bool isWord = (op == OpType::MOVSW || op == OpType::STOSW || op == OpType::LODSW);
+    bool reads = (op != OpType::STOSB && op != OpType::STOSW);
+    bool writes = (op != OpType::LODSB && op != OpType::LODSW);
+    bool down = (cpu_.flags & F_DF) != 0;
+    uint32_t w = isWord ? 2 : 1;
+    int step = down ? -(int)w : (int)w;
+    int src_seg = (instr.seg_override != 0xFF) ? instr.seg_override : (int)S_DS;
+    uint32_t srcBase = (uint32_t)cpu_.sregs[src_seg] << 4;
+    uint32_t dstBase = (uint32_t)cpu_.sregs[S_ES] << 4;
+    uint8_t* mem = cpu_.memory;
+
+    uint32_t n = cpu_.regs[R_CX];
+    cpu_.instr_count += n;
+    cpu_.regs[R_CX] = 0;
+    while (n > 0) {
+        uint16_t si = cpu_.regs[R_SI], di = cpu_.regs[R_DI];
+        // Split where SI or DI wraps around its segment: within a run both
+        // walk contiguous memory
+        auto room = [&](uint16_t off) {
+            return down ? off / w + 1 : (0xFFFFu - off) / w + 1;
+        };
+        uint32_t k = n;
+        if (reads) k = std::min(k, room(si));
+        if (writes) k = std::min(k, room(di));
+        uint32_t bytes = k * w;
+        // Lowest byte of each range
+        uint32_t span = down ? bytes - w : 0;
+        uint32_t src = srcBase + si - span, dst = dstBase + di - span;
+
+        if (src + bytes > 0x100000 || dst + bytes > 0x100000) {
+            repStringSlow(cpu_, op, srcBase, dstBase, si, di, step, k);
+            if (writes) {
+                invalidateRange(dst & 0xFFFFF, std::min(bytes, 0x100000 - (dst & 0xFFFFF)), nullptr);
+                invalidateRange(0, (dst + bytes) & 0xFFFFF, nullptr);
+            }
+        } else if (!writes) {
+            // LODS: only the last element survives
+            uint32_t last = down ? src : src + bytes - w;
+            cpu_.regs[R_AX] = isWord ? (uint16_t)(mem[last] | mem[last + 1] << 8)
+                                     : (uint16_t)((cpu_.regs[R_AX] & 0xFF00) | mem[last]);
+        } else if (!reads) {
+            uint16_t ax = cpu_.regs[R_AX];
+            if (!isWord || (ax & 0xFF) == (ax >> 8)) {
+                memset(mem + dst, ax & 0xFF, bytes);
+            } else {
+                for (uint32_t i = 0; i < bytes; i += 2) {
+                    mem[dst + i] = ax & 0xFF;
+                    mem[dst + i + 1] = ax >> 8;
+                }
+            }
+            invalidateRange(dst, bytes, nullptr);
+        } else {
+            // MOVS. An element-at-a-time copy only differs from memmove when
+            // the destination trails the source in the direction of travel
+            // by less than the run: then it re-reads bytes it already wrote.
+            uint32_t gap = down ? src - dst : dst - src;
+            bool trails = down ? dst < src : dst > src;
+            if (!trails || gap >= bytes) {
+                memmove(mem + dst, mem + src, bytes);
+            } else if (gap < w) {
+                // A word copy one byte behind its source
+                repStringSlow(cpu_, op, srcBase, dstBase, si, di, step, k);
+            } else if (w == 1 || gap % 2 == 0) {
+                // The result repeats the first gap bytes of the source (the
+                // dst = src+1 fill idiom is gap 1): seed one period, then
+                // double it
+                if (!down) {
+                    memcpy(mem + dst, mem + src, gap);
+                    for (uint32_t done = gap; done < bytes; ) {
+                        uint32_t len = std::min(done, bytes - done);
+                        memcpy(mem + dst + done, mem + dst, len);
+                        done += len;
+                    }
+                } else {
+                    uint32_t end = dst + bytes;
+                    memcpy(mem + end - gap, mem + src + bytes - gap, gap);
+                    for (uint32_t done = gap; done < bytes; ) {
+                        uint32_t len = std::min(done, bytes - done);
+                        memcpy(mem + end - done - len, mem + end - len, len);
+                        done += len;
+                    }
+                }
+            } else {
+                // Words at an odd distance: copy in chunks that cannot see
+                // their own writes
+                uint32_t chunk = gap & ~1u;
+                for (uint32_t done = 0; done < bytes; done += chunk) {
+                    uint32_t len = std::min(chunk, bytes - done);
+                    if (!down) memcpy(mem + dst + done, mem + src + done, len);
+                    else memcpy(mem + dst + bytes - done - len, mem + src + bytes - done - len, len);
+                }
+            }
+            invalidateRange(dst, bytes, nullptr);
+        }
+
+        if (reads) cpu_.regs[R_SI] = (uint16_t)(si + step * (int)k);
+        if (writes) cpu_.regs[R_DI] = (uint16_t)(di + step * (int)k);
+        n -= k;
+    }
+}
+
+// REPE/REPNE CMPS/SCAS search: n elements of w bytes at a, compared
+// against the elements at b, or against key when b is null. An element
+// "stops" the search when its equality matches stop_eq (REPNE stops on the
+// first match, REPE on the first mismatch).
+struct StrScan {
+    const uint8_t* a;
+    const uint8_t* b;
+    uint16_t key;
+    uint32_t n;
+    uint32_t w;
+    bool stop_eq;
+};
+static constexpr uint32_t SCAN_NONE = UINT32_MAX;
+
+static bool scanStops(const StrScan& s, uint32_t i) {
+    uint16_t x = s.w == 2 ? (uint16_t)(s.a[2 * i] | s.a[2 * i + 1] << 8) : s.a[i];
+    uint16_t y = !s.b ? s.key
+               : s.w == 2 ? (uint16_t)(s.b[2 * i] | s.b[2 * i + 1] << 8) : s.b[i];
+    return (x == y) == s.stop_eq;
+}
+
+// Scalar: index of the first / last stopping element, or SCAN_NONE
+static uint32_t scanFirstScalar(const StrScan& s) {
+    for (uint32_t i = 0; i < s.n; i++)
+        if (scanStops(s, i)) return i;
+    return SCAN_NONE;
+}
+
+static uint32_t scanLastScalar(const StrScan& s) {
+    for (uint32_t i = s.n; i-- > 0; )
+        if (scanStops(s, i)) return i;
+    return SCAN_NONE;
+}
+
+// SSE2 (always present on x86-64): 16 bytes per compare. Word compares set
+// both mask bits of an element, so the bit index divides down to it.
+static uint32_t scanFirstSSE2(const StrScan& s) {
+    uint32_t bytes = s.n * s.w, i = 0;
+    __m128i key = s.w == 2 ? _mm_set1_epi16((short)s.key) : _mm_set1_epi8((char)s.key);
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(s.a + i));
+        __m128i vb = s.b ? _mm_loadu_si128((const __m128i*)(s.b + i)) : key;
+        __m128i eq = s.w == 2 ? _mm_cmpeq_epi16(va, vb) : _mm_cmpeq_epi8(va, vb);
+        uint32_t m = (uint32_t)_mm_movemask_epi8(eq);
+        if (!s.stop_eq) m ^= 0xFFFF;
+        if (m) return (i + __builtin_ctz(m)) / s.w;
+    }
+    StrScan tail = s;
+    tail.a += i; if (tail.b) tail.b += i;
+    tail.n -= i / s.w;
+    uint32_t r = scanFirstScalar(tail);
+    return r == SCAN_NONE ? r : r + i / s.w;
+}
+
+static uint32_t scanLastSSE2(const StrScan& s) {
+    uint32_t end = s.n * s.w;
+    __m128i key = s.w == 2 ? _mm_set1_epi16((short)s.key) : _mm_set1_epi8((char)s.key);
+    for (; end >= 16; end -= 16) {
+        uint32_t i = end - 16;
+        __m128i va = _mm_loadu_si128((const __m128i*)(s.a + i));
+        __m128i vb = s.b ? _mm_loadu_si128((const __m128i*)(s.b + i)) : key;
+        __m128i eq = s.w == 2 ? _mm_cmpeq_epi16(va, vb) : _mm_cmpeq_epi8(va, vb);
+        uint32_t m = (uint32_t)_mm_movemask_epi8(eq);
+        if (!s.stop_eq) m ^= 0xFFFF;
+        if (m) return (i + 31 - __builtin_clz(m)) / s.w;
+    }
+    StrScan head = s;
+    head.n = end / s.w;
+    return scanLastScalar(head);
+}
+
+// AVX2: 32 bytes per compare
+__attribute__((target("avx2")))
+static uint32_t scanFirstAVX2(const StrScan& s) {
+    uint32_t bytes = s.n * s.w, i = 0;
+    __m256i key = s.w == 2 ? _mm256_set1_epi16((short)s.key) : _mm256_set1_epi8((char)s.key);
+    for (; i + 32 <= bytes; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(s.a + i));
+        __m256i vb = s.b ? _mm256_loadu_si256((const __m256i*)(s.b + i)) : key;
+        __m256i eq = s.w == 2 ? _mm256_cmpeq_epi16(va, vb) : _mm256_cmpeq_epi8(va, vb);
+        uint32_t m = (uint32_t)_mm256_movemask_epi8(eq);
+        if (!s.stop_eq) m = ~m;
+        if (m) return (i + __builtin_ctz(m)) / s.w;
+    }
+    StrScan tail = s;
+    tail.a += i; if (tail.b) tail.b += i;
+    tail.n -= i / s.w;
+    uint32_t r = scanFirstSSE2(tail);
+    return r == SCAN_NONE ? r : r + i / s.w;
+}
+
+__attribute__((target("avx2")))
+static uint32_t scanLastAVX2(const StrScan& s) {
+    uint32_t end = s.n * s.w;
+    __m256i key = s.w == 2 ? _mm256_set1_epi16((short)s.key) : _mm256_set1_epi8((char)s.key);
+    for (; end >= 32; end -= 32) {
+        uint32_t i = end - 32;
+        __m256i va = _mm256_loadu_si256((const __m256i*)(s.a + i));
+        __m256i vb = s.b ? _mm256_loadu_si256((const __m256i*)(s.b + i)) : key;
+        __m256i eq = s.w == 2 ? _mm256_cmpeq_epi16(va, vb) : _mm256_cmpeq_epi8(va, vb);
+        uint32_t m = (uint32_t)_mm256_movemask_epi8(eq);
+        if (!s.stop_eq) m = ~m;
+        if (m) return (i + 31 - __builtin_clz(m)) / s.w;
+    }
+    StrScan head = s;
+    head.n = end / s.w;
+    return scanLastSSE2(head);
+}
+
+struct StrScanImpl {
+    uint32_t (*first)(const StrScan&);
+    uint32_t (*last)(const StrScan&);
+};
+
+// Picked once from CPUID
+static const StrScanImpl& strScanImpl() {
+    static const StrScanImpl impl = [] {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return StrScanImpl{scanFirstAVX2, scanLastAVX2};
+        if (__builtin_cpu_supports("sse2")) return StrScanImpl{scanFirstSSE2, scanLastSSE2};
+        return StrScanImpl{scanFirstScalar, scanLastScalar};
+    }();
+    return impl;
+}
+
+void JitEngine::runRepCompare(const DecodedInstr& instr) {
+    OpType op = instr.op;
+    bool isWord = (op == OpType::CMPSW || op == OpType::SCASW);
+    bool cmps = (op == OpType::CMPSB || op == OpType::CMPSW);
+    bool down = (cpu_.flags & F_DF) != 0;
+    uint32_t w = isWord ? 2 : 1;
+    int step = down ? -(int)w : (int)w;
+    int src_seg = (instr.seg_override != 0xFF) ? instr.seg_override : (int)S_DS;
+    uint32_t srcBase = (uint32_t)cpu_.sregs[src_seg] << 4;
+    uint32_t dstBase = (uint32_t)cpu_.sregs[S_ES] << 4;
+    const uint8_t* mem = cpu_.memory;
+    const StrScanImpl& impl = strScanImpl();
+    auto load = [&](uint32_t phys) {
+        phys &= 0xFFFFF;
+        return isWord ? (uint16_t)(mem[phys] | mem[(phys + 1) & 0xFFFFF] << 8) : mem[phys];
+    };
+
+    uint32_t n = cpu_.regs[R_CX];
+    if (n == 0) return;
+    uint16_t lastSi = 0, lastDi = 0;
+    bool hit = false;
+    while (n > 0 && !hit) {
+        uint16_t si = cpu_.regs[R_SI], di = cpu_.regs[R_DI];
+        auto room = [&](uint16_t off) {
+            return down ? off / w + 1 : (0xFFFFu - off) / w + 1;
+        };
+        uint32_t k = std::min(n, room(di));
+        if (cmps) k = std::min(k, room(si));
+        uint32_t bytes = k * w;
+        uint32_t span = down ? bytes - w : 0;
+        uint32_t src = srcBase + si - span, dst = dstBase + di - span;
+
+        StrScan scan{cmps ? mem + src : mem + dst, cmps ? mem + dst : nullptr,
+                     cpu_.regs[R_AX], k, w, !instr.rep_z};
+        if (!isWord) scan.key &= 0xFF;
+        uint32_t done;
+        if (src + bytes > 0x100000 || dst + bytes > 0x100000) {
+            // Wraps past the top of the 1MB space: one element at a time
+            for (done = 0; done < k && !hit; done++) {
+                uint16_t x = cmps ? load(srcBase + (uint16_t)(si + step * (int)done)) : scan.key;
+                uint16_t y = load(dstBase + (uint16_t)(di + step * (int)done));
+                hit = (x == y) == scan.stop_eq;
+            }
+        } else {
+            uint32_t i = down ? impl.last(scan) : impl.first(scan);
+            hit = (i != SCAN_NONE);
+            done = !hit ? k : down ? k - i : i + 1;
+        }
+        lastSi = (uint16_t)(si + step * (int)(done - 1));
+        lastDi = (uint16_t)(di + step * (int)(done - 1));
+        cpu_.regs[R_SI] = cmps ? (uint16_t)(si + step * (int)done) : si;
+        cpu_.regs[R_DI] = (uint16_t)(di + step * (int)done);
+        cpu_.regs[R_CX] = (uint16_t)(cpu_.regs[R_CX] - done);
+        cpu_.instr_count += done;
+        n -= done;
+    }
+
+    // Flags are those of the last compare
+    cpu_.lazy_op = LAZY_SUB | (isWord ? (uint32_t)LAZY_WORD : 0);
+    cpu_.lazy_dst = cmps ? load(srcBase + lastSi) : (isWord ? cpu_.regs[R_AX] : cpu_.regs[R_AX] & 0xFF);
+    cpu_.lazy_src = load(dstBase + lastDi);
+    syncFlags();
+}
+
+// =====================================================================
+// DOS/BIOS services
+// =====================================================================
+
+bool JitEngine::serviceInt(int num) {
+    uint8_t ah = (cpu_.regs[R_AX] >> 8) & 0xFF;
+
+    // DOS_FAIL / DOS_PARTIAL interception
+    bool intercepted = false;
+    if (dos_fault_.int_num == num && (int)ah == dos_fault_.ah_func) {
+        if (dos_fault_.partial_count >= 0) {
+            // DOS_PARTIAL: return partial count, CF clear
+            cpu_.regs[R_AX] = (uint16_t)dos_fault_.partial_count;
+            cpu_.flags &= ~0x0001;
+        } else {
+            // DOS_FAIL: set error
+            cpu_.flags |= 0x0001;
+            cpu_.regs[R_AX] = dos_fault_.fail_code;
+        }
+        dos_fault_.int_num = -1; // clear one-shot
+        intercepted = true;
+    }
+    // DOS/BIOS interrupt
+    bool handled = intercepted || handleDOSInt(cpu_, num, dos_output_, dos_state_, video_, has_events_ ? &kbd_ : nullptr, &mouse_);
+    ah = (cpu_.regs[R_AX] >> 8) & 0xFF;
+    if (!handled) {
+        if (num == 0x16 && ah == 0x00) {
+            // Blocking read with no keys
+            service_stop_ = ServiceStop::KEY_WAIT;
+            return false;
+        }
+        if (tracing_) {
+            fprintf(stderr, "Unhandled INT %02Xh at IP=%04X\n", num, cpu_.ip);
+        }
+    }
+
+    // Idle detection: track keyboard polls returning "no key"
+    // Covers INT 16h AH=01h (BIOS poll) and INT 21h AH=06h DL=FFh (DOS poll)
+    bool is_idle_poll = false;
+    if (num == 0x16) {
+        if (ah == 0x01 && (cpu_.flags & F_ZF))
+            is_idle_poll = true;
+        else if (ah == 0x00)
+            idle_polls_ = 0;  // blocking read consumed a key
+    } else if (num == 0x21) {
+        if (ah == 0x06 && (cpu_.flags & F_ZF))
+            is_idle_poll = true;
+        else if (ah == 0x01 || ah == 0x08)
+            idle_polls_ = 0;  // blocking read
+    }
+    if (is_idle_poll && ++idle_polls_ >= IDLE_THRESHOLD) {
+        service_stop_ = ServiceStop::IDLE;
+        return false;
+    }
+    return true;
+}
+
+void JitEngine::onServiceInt(JitEngine* eng, uint32_t num, JitBlock* cur) {
+    CPU8086& cpu = eng->cpu_;
+    bool leave = !eng->serviceInt((int)num) || cpu.halted;
+    // File reads and video writes may have landed on translated code
+    if (cpu.dirty_hi > cpu.dirty_lo) {
+        if (eng->invalidateRange(cpu.dirty_lo, cpu.dirty_hi - cpu.dirty_lo, cur)) leave = true;
+        cpu.dirty_lo = UINT32_MAX;
+        cpu.dirty_hi = 0;
+    }
+    // DOS calls can load ES
+    if (eng->flat_ && !flatSegments(cpu)) leave = true;
+    if (leave) cpu.smc_exit = 1;
 }
 
 // =====================================================================
@@ -526,6 +2140,13 @@ void JitEngine::emitRestoreFlags() {
 
 int JitEngine::run(const uint8_t* comData, size_t comSize, RunMode mode,
                    const std::string& dbg_path, uint64_t max_cycles) {
+    int rc = execute(comData, comSize, mode, dbg_path, max_cycles);
+    if (!cache_dir_.empty()) saveCache();
+    return rc;
+}
+
+int JitEngine::execute(const uint8_t* comData, size_t comSize, RunMode mode,
+                       const std::string& dbg_path, uint64_t max_cycles) {
     if (!dbg_path.empty()) {
         loadDebugInfo(dbg_path);
     }
@@ -562,6 +2183,30 @@ int JitEngine::run(const uint8_t* comData, size_t comSize, RunMode mode,
     dos_output_.clear();
     tracing_ = false;
     idle_polls_ = 0;
+    service_stop_ = ServiceStop::NONE;
+    cache_peak_ = 0;
+    cache_evictions_ = 0;
+    cache_evicted_blocks_ = 0;
+    peep_saved_bytes_ = 0;
+    peep_elided_ = 0;
+    seg_folded_ = 0;
+    seg_retranslated_ = 0;
+    std::fill(seg_misses_.begin(), seg_misses_.end(), 0);
+    flat_ = true;
+    flat_dropped_ = 0;
+    flushBlocks();
+
+    // TRACE mode handles directives at their addresses, where blocks end
+    // and chained jumps fall back to this loop; RUN mode ignores them
+    if (mode != RunMode::TRACE) memset(directive_bits_, 0, sizeof(directive_bits_));
+    if (!cache_dir_.empty() || !precompiled_.empty()) loadCache(comData, comSize);
+    if (eager_) {
+        auto start = std::chrono::steady_clock::now();
+        eager_static_ = translateReachable(0x100 + (uint32_t)comSize);
+        eager_dynamic_ = 0;
+        eager_us_ = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    }
 
     while (!cpu_.halted) {
         if (cpu_.instr_count > max_cycles) {
@@ -598,9 +2243,36 @@ int JitEngine::run(const uint8_t* comData, size_t comSize, RunMode mode,
             return 1;
         }
 
-        DecodedInstr instr = decode8086(cpu_.memory, cpu_.ip);
+        // A segment register was loaded with something other than 0: the
+        // flat-model translations no longer hold
+        if (flat_ && !flatSegments(cpu_)) leaveFlat();
+
+        // New blocks start out interpreted; one entered jit_threshold_ times
+        // is translated in its place (and exits waiting for it get linked)
+        JitBlock* blk = block_map_[cpu_.ip];
+        if (blk && blk->is_threaded && blk->hits >= jit_threshold_) {
+            invalidateBlock(blk);
+            blk = compileBlock(cpu_.ip, MAX_BLOCK_INSTRS);
+        } else if (!blk) {
+            if (eager_ && !static_ips_[cpu_.ip]) {
+                static_ips_[cpu_.ip] = true;  // count each address once
+                eager_dynamic_++;
+            }
+            // A block from the --jit-cache file is already translated
+            if (!cached_.empty()) blk = adoptCached(cpu_.ip);
+            if (!blk && jit_threshold_ > 0) blk = buildThreaded(cpu_.ip);
+            if (!blk) blk = compileBlock(cpu_.ip, MAX_BLOCK_INSTRS);
+        }
+        // Translated for other values of a segment register its [disp16]
+        // operands were folded with (the entry guard sent it back here)
+        if (blk && blk->seg_fold && !segmentsMatch(cpu_, blk)) {
+            invalidateBlock(blk);
+            seg_misses_[cpu_.ip]++;
+            seg_retranslated_++;
+            blk = compileBlock(cpu_.ip, MAX_BLOCK_INSTRS);
+        }
 
-        if (instr.op == OpType::INVALID) {
+        if (!blk && decode8086(cpu_.memory, cpu_.ip).op == OpType::INVALID) {
             if (tracing_) {
                 fprintf(stderr, "Invalid opcode %02Xh at IP=%04X\n",
                         cpu_.memory[cpu_.ip], cpu_.ip);
@@ -619,8 +2291,8 @@ int JitEngine::run(const uint8_t* comData, size_t comSize, RunMode mode,
             return 1;
         }
 
-        // Directive state machine (only in TRACE mode)
-        if (mode == RunMode::TRACE) {
+        // Directive state machine (only in TRACE mode, only where one fires)
+        if (mode == RunMode::TRACE && hasDirective(cpu_.ip)) {
             uint16_t ip = cpu_.ip;
             if (trace_stop_addrs_.count(ip)) tracing_ = false;
             if (trace_start_addrs_.count(ip)) tracing_ = true;
@@ -969,246 +2641,138 @@ int JitEngine::run(const uint8_t* comData, size_t comSize, RunMode mode,
         }
 
         if (tracing_) {
-            dumpInstr(instr);
+            dumpInstr(decode8086(cpu_.memory, cpu_.ip));
+        }
+
+        if (!blk) {
+            DecodedInstr instr = decode8086(cpu_.memory, cpu_.ip);
+            if (tracing_) {
+                fprintf(stderr, "Failed to emit x64 for %s at IP=%04X\n",
+                        opTypeName(instr.op), cpu_.ip);
+            }
+            std::cout << "{\"executed\":\"FAILED\",\"error\":\"emit failed for "
+                      << opTypeName(instr.op) << "\"}" << std::endl;
+            return 1;
         }
 
-        // Handle REP prefix in the dispatch loop
-        if (instr.has_rep) {
-            uint16_t nextIP = cpu_.ip + instr.len;
-            while (cpu_.regs[R_CX] != 0) {
-                cpu_.regs[R_CX]--;
-                code_.reset();
-                if (!emitInstruction(instr)) {
+        // REP string instructions run in bulk in the dispatcher
+        if (blk->is_rep) {
+            DecodedInstr instr = blk->rep_instr;
+            switch (instr.op) {
+            case OpType::MOVSB: case OpType::MOVSW: case OpType::STOSB:
+            case OpType::STOSW: case OpType::LODSB: case OpType::LODSW:
+                runRepString(instr);
+                break;
+            case OpType::CMPSB: case OpType::CMPSW: case OpType::SCASB: case OpType::SCASW:
+                runRepCompare(instr);
+                break;
+            default: {
+                // Any other instruction with a REP prefix repeats as itself
+                // Emitting may flush the cache — blk is not used past this point
+                size_t off = emitScratch(instr, cpu_.ip);
+                if (off == SIZE_MAX) {
                     std::cout << "{\"executed\":\"FAILED\",\"error\":\"emit failed\"}" << std::endl;
                     return 1;
                 }
-                auto fn = code_.getFunc<void(*)(CPU8086*)>();
-                fn(&cpu_);
-                cpu_.instr_count++;
-
-
-
-                if (instr.op == OpType::CMPSB || instr.op == OpType::CMPSW ||
-                    instr.op == OpType::SCASB || instr.op == OpType::SCASW) {
-                    bool zf = (cpu_.flags & F_ZF) != 0;
-                    if (instr.rep_z && !zf) break;
-                    if (!instr.rep_z && zf) break;
+                auto fn = code_.getFunc<void(*)(CPU8086*)>(off);
+                while (cpu_.regs[R_CX] != 0) {
+                    cpu_.regs[R_CX]--;
+                    fn(&cpu_);
+                    syncFlags();
+                    cpu_.instr_count++;
                 }
+                code_.rewind(off);
+                break;
             }
-            cpu_.ip = nextIP;
+            }
+            cpu_.ip += instr.len;
         } else {
-            code_.reset();
-            if (!emitInstruction(instr)) {
-                if (tracing_) {
-                    fprintf(stderr, "Failed to emit x64 for %s at IP=%04X\n",
-                            opTypeName(instr.op), cpu_.ip);
+            if (tracing_ || blk->instr_count > max_cycles + 1 - cpu_.instr_count) {
+                // Between TRACE_START and TRACE_STOP every instruction is
+                // dumped; near the budget, single-stepping hits the limit
+                // at exactly the same instruction
+                DecodedInstr instr = decode8086(cpu_.memory, cpu_.ip);
+                size_t off = emitScratch(instr, cpu_.ip);
+                if (off == SIZE_MAX) {
+                    std::cout << "{\"executed\":\"FAILED\",\"error\":\"emit failed for "
+                              << opTypeName(instr.op) << "\"}" << std::endl;
+                    return 1;
                 }
-                std::cout << "{\"executed\":\"FAILED\",\"error\":\"emit failed for "
-                          << opTypeName(instr.op) << "\"}" << std::endl;
-                return 1;
+                code_.getFunc<void(*)(CPU8086*)>(off)(&cpu_);
+                syncFlags();
+                code_.rewind(off);
+                cpu_.instr_count++;
+            } else if (blk->is_threaded) {
+                runThreaded(blk);
+                syncFlags();
+            } else {
+                // Generated code counts down what is left of max_cycles + 1
+                // (a block only starts if all its instructions fit) and
+                // chains on until it runs out
+                cpu_.instr_budget = max_cycles + 1 - cpu_.instr_count;
+                code_.getFunc<void(*)(CPU8086*)>(blk->code_off)(&cpu_);
+                cpu_.instr_count = max_cycles + 1 - cpu_.instr_budget;
+                // C++ from here on (INT handlers, directives, dumps) reads cpu.flags
+                syncFlags();
             }
 
-            auto fn = code_.getFunc<void(*)(CPU8086*)>();
-            fn(&cpu_);
-            cpu_.instr_count++;
-
-
-
             if (cpu_.pending_int != -1) {
                 int marker = cpu_.pending_int;
                 cpu_.pending_int = -1;
 
-                if (marker >= 0) {
-                    // DOS_FAIL / DOS_PARTIAL interception
-                    bool intercepted = false;
-                    if (dos_fault_.int_num == marker) {
-                        uint8_t ah = (cpu_.regs[R_AX] >> 8) & 0xFF;
-                        if ((int)ah == dos_fault_.ah_func) {
-                            if (dos_fault_.partial_count >= 0) {
-                                // DOS_PARTIAL: return partial count, CF clear
-                                cpu_.regs[R_AX] = (uint16_t)dos_fault_.partial_count;
-                                cpu_.flags &= ~0x0001;
-                            } else {
-                                // DOS_FAIL: set error
-                                cpu_.flags |= 0x0001;
-                                cpu_.regs[R_AX] = dos_fault_.fail_code;
-                            }
-                            dos_fault_.int_num = -1; // clear one-shot
-                            intercepted = true;
-                        }
-                    }
-                    // DOS/BIOS interrupt
-                    if (!intercepted && !handleDOSInt(cpu_, marker, dos_output_, dos_state_, video_, has_events_ ? &kbd_ : nullptr, &mouse_)) {
-                        if (marker == 0x16) {
-                            uint8_t ah = (cpu_.regs[R_AX] >> 8) & 0xFF;
-                            if (ah == 0x00) {
-                                // Blocking read with no keys — terminate
-                                std::string fail = "{\"executed\":\"FAILED\",\"error\":\"INT 16h AH=00: blocking read with no keys available\"";
-                                if (has_events_) fail += std::string(",\"detail\":\"read #") + std::to_string(kbd_.readCount()) + "\"";
-                                if (video_.active) fail += ",\"screen\":" + renderScreenJson();
-                                fail += "}";
-                                std::cout << fail << std::endl;
-                                return 1;
-                            }
-                        }
-                        if (tracing_) {
-                            fprintf(stderr, "Unhandled INT %02Xh at IP=%04X\n", marker, cpu_.ip);
-                        }
-                    }
+                if (marker >= 0) serviceInt(marker);
+            }
 
-                    // Idle detection: track keyboard polls returning "no key"
-                    // Covers INT 16h AH=01h (BIOS poll) and INT 21h AH=06h DL=FFh (DOS poll)
-                    bool is_idle_poll = false;
-                    if (marker == 0x16) {
-                        uint8_t ah16 = (cpu_.regs[R_AX] >> 8) & 0xFF;
-                        if (ah16 == 0x01 && (cpu_.flags & F_ZF))
-                            is_idle_poll = true;
-                        else if (ah16 == 0x00)
-                            idle_polls_ = 0;  // blocking read consumed a key
-                    } else if (marker == 0x21) {
-                        uint8_t ah21 = (cpu_.regs[R_AX] >> 8) & 0xFF;
-                        if (ah21 == 0x06 && (cpu_.flags & F_ZF))
-                            is_idle_poll = true;
-                        else if (ah21 == 0x01 || ah21 == 0x08)
-                            idle_polls_ = 0;  // blocking read
-                    }
-                    if (is_idle_poll) {
-                        idle_polls_++;
-                        if (idle_polls_ >= IDLE_THRESHOLD) {
-                            std::string json = "{\"executed\":\"IDLE\",\"instructions\":"
-                                + std::to_string(cpu_.instr_count)
-                                + ",\"idle_polls\":" + std::to_string(idle_polls_);
-                            if (!vram_dumps_.empty()) {
-                                json += ",\"vram_dumps\":[";
-                                for (size_t vi = 0; vi < vram_dumps_.size(); vi++) {
-                                    if (vi > 0) json += ",";
-                                    json += vram_dumps_[vi];
-                                }
-                                json += "]";
-                            }
-                            if (!reg_dumps_.empty()) {
-                                json += ",\"reg_dumps\":[";
-                                for (size_t ri = 0; ri < reg_dumps_.size(); ri++) {
-                                    if (ri > 0) json += ",";
-                                    json += reg_dumps_[ri];
-                                }
-                                json += "]";
-                            }
-                            if (!log_dumps_.empty()) {
-                                json += ",\"log\":[";
-                                for (size_t li = 0; li < log_dumps_.size(); li++) {
-                                    if (li > 0) json += ",";
-                                    json += log_dumps_[li];
-                                }
-                                json += "]";
-                            }
-                            if (video_.active) json += ",\"screen\":" + renderScreenJson();
-                            json += "}";
-                            std::cout << json << std::endl;
-                            return 0;  // success — program reached stable idle state
-                        }
-                    }
-                } else {
-                    // BCD operations handled in C++
-                    uint8_t al = cpu_.regs[R_AX] & 0xFF;
-                    uint8_t ah = (cpu_.regs[R_AX] >> 8) & 0xFF;
-                    uint16_t flags = cpu_.flags;
-                    bool cf = (flags & F_CF) != 0;
-                    bool af = (flags & F_AF) != 0;
-
-                    switch (marker) {
-                    case -2: { // DAA
-                        uint8_t old_al = al;
-                        bool old_cf = cf;
-                        cf = false;
-                        if ((al & 0x0F) > 9 || af) {
-                            uint16_t t = al + 6;
-                            al = t & 0xFF;
-                            cf = old_cf || (t > 0xFF);
-                            af = true;
-                        } else { af = false; }
-                        if (old_al > 0x99 || old_cf) {
-                            al += 0x60;
-                            cf = true;
-                        }
-                        cpu_.regs[R_AX] = (cpu_.regs[R_AX] & 0xFF00) | al;
-                        flags = (flags & ~(F_CF|F_AF|F_ZF|F_SF|F_PF)) |
-                                (cf ? F_CF : 0) | (af ? F_AF : 0) |
-                                (al == 0 ? F_ZF : 0) | ((al & 0x80) ? F_SF : 0) |
-                                (__builtin_popcount(al & 0xFF) % 2 == 0 ? F_PF : 0);
-                        cpu_.flags = flags;
-                        break;
-                    }
-                    case -3: { // DAS
-                        uint8_t old_al = al;
-                        bool old_cf = cf;
-                        cf = false;
-                        if ((al & 0x0F) > 9 || af) {
-                            uint16_t t = al - 6;
-                            al = t & 0xFF;
-                            cf = old_cf || (t > 0xFF);
-                            af = true;
-                        } else { af = false; }
-                        if (old_al > 0x99 || old_cf) {
-                            al -= 0x60;
-                            cf = true;
-                        }
-                        cpu_.regs[R_AX] = (cpu_.regs[R_AX] & 0xFF00) | al;
-                        flags = (flags & ~(F_CF|F_AF|F_ZF|F_SF|F_PF)) |
-                                (cf ? F_CF : 0) | (af ? F_AF : 0) |
-                                (al == 0 ? F_ZF : 0) | ((al & 0x80) ? F_SF : 0) |
-                                (__builtin_popcount(al & 0xFF) % 2 == 0 ? F_PF : 0);
-                        cpu_.flags = flags;
-                        break;
-                    }
-                    case -4: { // AAA
-                        if ((al & 0x0F) > 9 || af) {
-                            al = (al + 6) & 0x0F;
-                            ah++;
-                            af = true; cf = true;
-                        } else {
-                            al &= 0x0F;
-                            af = false; cf = false;
-                        }
-                        cpu_.regs[R_AX] = (ah << 8) | al;
-                        cpu_.flags = (flags & ~(F_CF|F_AF)) | (cf?F_CF:0) | (af?F_AF:0);
-                        break;
-                    }
-                    case -5: { // AAS
-                        if ((al & 0x0F) > 9 || af) {
-                            al = (al - 6) & 0x0F;
-                            ah--;
-                            af = true; cf = true;
-                        } else {
-                            al &= 0x0F;
-                            af = false; cf = false;
-                        }
-                        cpu_.regs[R_AX] = (ah << 8) | al;
-                        cpu_.flags = (flags & ~(F_CF|F_AF)) | (cf?F_CF:0) | (af?F_AF:0);
-                        break;
-                    }
-                    case -6: { // AAM (base 10)
-                        ah = al / 10;
-                        al = al % 10;
-                        cpu_.regs[R_AX] = (ah << 8) | al;
-                        flags = (flags & ~(F_ZF|F_SF|F_PF)) |
-                                (al == 0 ? F_ZF : 0) | ((al & 0x80) ? F_SF : 0) |
-                                (__builtin_popcount(al & 0xFF) % 2 == 0 ? F_PF : 0);
-                        cpu_.flags = flags;
-                        break;
+            // A service call (from the dispatcher or inside the block) ended the run
+            if (service_stop_ == ServiceStop::KEY_WAIT) {
+                // Blocking read with no keys — terminate
+                std::string fail = "{\"executed\":\"FAILED\",\"error\":\"INT 16h AH=00: blocking read with no keys available\"";
+                if (has_events_) fail += std::string(",\"detail\":\"read #") + std::to_string(kbd_.readCount()) + "\"";
+                if (video_.active) fail += ",\"screen\":" + renderScreenJson();
+                fail += "}";
+                std::cout << fail << std::endl;
+                return 1;
+            }
+            if (service_stop_ == ServiceStop::IDLE) {
+                std::string json = "{\"executed\":\"IDLE\",\"instructions\":"
+                    + std::to_string(cpu_.instr_count)
+                    + ",\"idle_polls\":" + std::to_string(idle_polls_);
+                if (!vram_dumps_.empty()) {
+                    json += ",\"vram_dumps\":[";
+                    for (size_t vi = 0; vi < vram_dumps_.size(); vi++) {
+                        if (vi > 0) json += ",";
+                        json += vram_dumps_[vi];
                     }
-                    case -7: { // AAD (base 10)
-                        al = ah * 10 + al;
-                        ah = 0;
-                        cpu_.regs[R_AX] = (ah << 8) | al;
-                        flags = (flags & ~(F_ZF|F_SF|F_PF)) |
-                                (al == 0 ? F_ZF : 0) | ((al & 0x80) ? F_SF : 0) |
-                                (__builtin_popcount(al & 0xFF) % 2 == 0 ? F_PF : 0);
-                        cpu_.flags = flags;
-                        break;
+                    json += "]";
+                }
+                if (!reg_dumps_.empty()) {
+                    json += ",\"reg_dumps\":[";
+                    for (size_t ri = 0; ri < reg_dumps_.size(); ri++) {
+                        if (ri > 0) json += ",";
+                        json += reg_dumps_[ri];
                     }
+                    json += "]";
+                }
+                if (!log_dumps_.empty()) {
+                    json += ",\"log\":[";
+                    for (size_t li = 0; li < log_dumps_.size(); li++) {
+                        if (li > 0) json += ",";
+                        json += log_dumps_[li];
                     }
+                    json += "]";
                 }
+                if (video_.active) json += ",\"screen\":" + renderScreenJson();
+                json += statsJson();
+                json += "}";
+                std::cout << json << std::endl;
+                return 0;  // success — program reached stable idle state
+            }
+
+            // DOS/BIOS handlers may have written over translated code
+            if (cpu_.dirty_hi > cpu_.dirty_lo) {
+                invalidateRange(cpu_.dirty_lo, cpu_.dirty_hi - cpu_.dirty_lo, nullptr);
+                cpu_.dirty_lo = UINT32_MAX;
+                cpu_.dirty_hi = 0;
             }
         }
 
@@ -1250,7 +2814,7 @@ int JitEngine::run(const uint8_t* comData, size_t comSize, RunMode mode,
     if (video_.active) {
         std::cout << ",\"screen\":" << renderScreenJson();
     }
-    std::cout << "}" << std::endl;
+    std::cout << statsJson() << "}" << std::endl;
 
     return 0;
 }
@@ -1548,6 +3112,7 @@ void JitEngine::loadDebugInfo(const std::string& dbg_path) {
                     }
                 }
                 if (pos < content.size() && content[pos] == '}') pos++;
+                if (!dtype.empty()) directive_bits_[daddr >> 6] |= 1ull << (daddr & 63);
 
                 if (dtype == "trace_start") {
                     trace_start_addrs_.insert(daddr);
@@ -1739,16 +3304,27 @@ static int aluOpcode(OpType op) {
     }
 }
 
+// LazyOp recorded by a two-operand ALU instruction
+static uint32_t lazyOp(OpType op) {
+    switch (op) {
+        case OpType::ADD: return LAZY_ADD;
+        case OpType::OR:  return LAZY_OR;
+        case OpType::ADC: return LAZY_ADC;
+        case OpType::SBB: return LAZY_SBB;
+        case OpType::AND: return LAZY_AND;
+        case OpType::XOR: return LAZY_XOR;
+        default:          return LAZY_SUB; // SUB, CMP
+    }
+}
+
 // =====================================================================
 // Main instruction emitter
 // =====================================================================
 
-bool JitEngine::emitInstruction(const DecodedInstr& instr) {
-    uint16_t nextIP = cpu_.ip + instr.len;
+bool JitEngine::emitInstruction(const DecodedInstr& instr, uint16_t ip) {
+    uint16_t nextIP = ip + instr.len;
     seg_override_ = instr.seg_override;
 
-    emitPrologue();
-
     switch (instr.op) {
     // =================================================================
     // MOV
@@ -1757,7 +3333,6 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         // Load src into RAX, store to dst
         emitLoadOperand(RAX, instr.src, instr.is_word);
         emitStoreOperand(instr.dst, RAX, instr.is_word);
-        emitSetIP(nextIP);
         break;
     }
 
@@ -1767,8 +3342,9 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
     case OpType::ADD: case OpType::ADC: case OpType::SUB: case OpType::SBB:
     case OpType::AND: case OpType::OR:  case OpType::XOR: case OpType::CMP: {
         bool needsCF = (instr.op == OpType::ADC || instr.op == OpType::SBB);
+        if (instr.op == OpType::CMP && flag_plan_ == FLAGS_DEAD) break;
         if (needsCF) {
-            emitRestoreFlags();
+            emitSaveCarryIn();
         }
 
         // Load src first if it's MEM (EA computation clobbers RAX)
@@ -1780,6 +3356,17 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
             emitLoadOperand(RDX, instr.src, instr.is_word);
         }
 
+        if (flag_plan_ == FLAGS_KEEP) {
+            emitSetLazy(lazyOp(instr.op), instr.is_word, true);
+            if (instr.op == OpType::CMP) break; // flags only
+        }
+
+        if (needsCF) {
+            // bt dword [rcx+OFF_LAZY_CIN], 0 → CF = carry in
+            code_.emit8(0x0F); code_.emit8(0xBA);
+            emitModRMDisp(code_, 4, OFF_LAZY_CIN);
+            code_.emit8(0);
+        }
         int aluIdx = aluOpcode(instr.op);
         if (instr.is_word) {
             code_.emit8(0x66);
@@ -1789,22 +3376,22 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
             code_.emit8(0x00 + aluIdx * 8);
             code_.emit8(0xC0 | (RDX << 3) | RAX);
         }
-
-        // Save ALU result in RBP before captureFlags (which clobbers RAX)
-        code_.emit8(0x89); code_.emit8(0xC5); // MOV EBP, EAX
-
-        emitCaptureFlags();
-
-        if (instr.op != OpType::CMP) {
-            // Restore result from RBP → store to destination
-            code_.emit8(0x89); code_.emit8(0xE8); // MOV EAX, EBP
+        if (flag_plan_ == FLAGS_CARRY) emitCarryOut();
+        if (instr.op != OpType::CMP)
             emitStoreOperand(instr.dst, RAX, instr.is_word);
-        }
-        emitSetIP(nextIP);
         break;
     }
 
     case OpType::TEST: {
+        if (flag_plan_ == FLAGS_DEAD) break;
+        if (flag_plan_ == FLAGS_CARRY) {
+            // TEST always clears CF: mov dword [rcx+OFF_LAZY_CIN], 0
+            code_.emit8(0xC7);
+            emitModRMDisp(code_, 0, OFF_LAZY_CIN);
+            code_.emit32(0);
+            lazy_state_ = LAZY_IN_CIN;
+            break;
+        }
         if (instr.src.kind == OpdKind::MEM) {
             emitLoadOperand(RDX, instr.src, instr.is_word);
             emitLoadOperand(RAX, instr.dst, instr.is_word);
@@ -1813,17 +3400,8 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
             emitLoadOperand(RDX, instr.src, instr.is_word);
         }
 
-        if (instr.is_word) {
-            code_.emit8(0x66);
-            code_.emit8(0x85); // TEST r/m16, r16
-            code_.emit8(0xC0 | (RDX << 3) | RAX);
-        } else {
-            code_.emit8(0x84); // TEST r/m8, r8
-            code_.emit8(0xC0 | (RDX << 3) | RAX);
-        }
-
-        emitCaptureFlags();
-        emitSetIP(nextIP);
+        // TEST is an AND that only sets flags
+        emitSetLazy(LAZY_AND, instr.is_word, true);
         break;
     }
 
@@ -1831,34 +3409,32 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
     // INC/DEC — must preserve CF
     // =================================================================
     case OpType::INC: {
+        bool keep = (flag_plan_ == FLAGS_KEEP);
+        if (keep) emitSyncCarry();
         emitLoadOperand(RAX, instr.dst, instr.is_word);
+        if (keep) emitSetLazy(LAZY_INC, instr.is_word, false);
         if (instr.is_word) {
             code_.emit8(0x66);
             code_.emit8(0xFF); code_.emit8(0xC0); // INC AX
         } else {
             code_.emit8(0xFE); code_.emit8(0xC0); // INC AL
         }
-        code_.emit8(0x89); code_.emit8(0xC5); // save result to EBP
-        emitCaptureFlagsPreserveCF();
-        code_.emit8(0x89); code_.emit8(0xE8); // restore result from EBP
         emitStoreOperand(instr.dst, RAX, instr.is_word);
-        emitSetIP(nextIP);
         break;
     }
 
     case OpType::DEC: {
+        bool keep = (flag_plan_ == FLAGS_KEEP);
+        if (keep) emitSyncCarry();
         emitLoadOperand(RAX, instr.dst, instr.is_word);
+        if (keep) emitSetLazy(LAZY_DEC, instr.is_word, false);
         if (instr.is_word) {
             code_.emit8(0x66);
             code_.emit8(0xFF); code_.emit8(0xC8); // DEC AX
         } else {
             code_.emit8(0xFE); code_.emit8(0xC8); // DEC AL
         }
-        code_.emit8(0x89); code_.emit8(0xC5); // save result
-        emitCaptureFlagsPreserveCF();
-        code_.emit8(0x89); code_.emit8(0xE8); // restore result
         emitStoreOperand(instr.dst, RAX, instr.is_word);
-        emitSetIP(nextIP);
         break;
     }
 
@@ -1867,17 +3443,15 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
     // =================================================================
     case OpType::NEG: {
         emitLoadOperand(RAX, instr.dst, instr.is_word);
+        if (flag_plan_ == FLAGS_KEEP) emitSetLazy(LAZY_NEG, instr.is_word, false);
         if (instr.is_word) {
             code_.emit8(0x66);
             code_.emit8(0xF7); code_.emit8(0xD8); // NEG AX
         } else {
             code_.emit8(0xF6); code_.emit8(0xD8); // NEG AL
         }
-        code_.emit8(0x89); code_.emit8(0xC5); // save result
-        emitCaptureFlags();
-        code_.emit8(0x89); code_.emit8(0xE8); // restore result
+        if (flag_plan_ == FLAGS_CARRY) emitCarryOut();
         emitStoreOperand(instr.dst, RAX, instr.is_word);
-        emitSetIP(nextIP);
         break;
     }
 
@@ -1891,7 +3465,6 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         }
         // NOT doesn't affect flags
         emitStoreOperand(instr.dst, RAX, instr.is_word);
-        emitSetIP(nextIP);
         break;
     }
 
@@ -1904,7 +3477,6 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         // Store swapped
         emitStoreOperand(instr.dst, RDX, instr.is_word);
         emitStoreOperand(instr.src, RAX, instr.is_word);
-        emitSetIP(nextIP);
         break;
     }
 
@@ -1917,7 +3489,6 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         emitComputeEA(instr.src);
         seg_override_ = saved_seg;
         emitStoreReg16(instr.dst.reg, RAX);
-        emitSetIP(nextIP);
         break;
     }
 
@@ -1929,18 +3500,14 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         emitLoadOperand(RBX, instr.dst, true);
         // Decrement SP by 2
         emitLoadReg16(RDX, R_SP);
-        code_.emit8(0x66); code_.emit8(0x83); code_.emit8(0xEA); code_.emit8(0x02);
-        code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xD2);
+        emitInsn(x64::aluImm(x64::SUB, x64::W16, RDX, 0x02));
+        emitInsn(x64::movzx16(RDX, RDX));
         emitStoreReg16(R_SP, RDX);
         // Compute SS:SP physical address → EAX
         emitSegAddr(S_SS, R_SP);
         // Store: mov word [rcx + rax + OFF_MEMORY], bx
-        code_.emit8(0x66);
-        code_.emit8(0x89);
-        code_.emit8(0x9C); // ModR/M: mod=10, reg=RBX(3), rm=SIB(4)
-        code_.emit8(0x01); // SIB: RAX + RCX
-        code_.emit32(OFF_MEMORY);
-        emitSetIP(nextIP);
+        emitInsn(x64::mov(x64::W16, kGuestMem, RBX));
+        emitCodeWriteCheck(2);
         break;
     }
 
@@ -1951,18 +3518,14 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         // Compute SS:SP physical address → EAX
         emitSegAddr(S_SS, R_SP);
         // Load word from [SS:SP]: movzx ebx, word [rcx + rax + OFF_MEMORY]
-        code_.emit8(0x0F); code_.emit8(0xB7);
-        code_.emit8(0x9C); // ModR/M: mod=10, reg=RBX(3), rm=SIB(4)
-        code_.emit8(0x01); // SIB: RAX + RCX
-        code_.emit32(OFF_MEMORY);
+        emitInsn(x64::movzx16(RBX, kGuestMem));
         // Increment SP by 2
         emitLoadReg16(RDX, R_SP);
-        code_.emit8(0x66); code_.emit8(0x83); code_.emit8(0xC2); code_.emit8(0x02);
-        code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xD2);
+        emitInsn(x64::aluImm(x64::ADD, x64::W16, RDX, 0x02));
+        emitInsn(x64::movzx16(RDX, RDX));
         emitStoreReg16(R_SP, RDX);
         // Store popped value (in RBX)
         emitStoreOperand(instr.dst, RBX, true);
-        emitSetIP(nextIP);
         break;
     }
 
@@ -1970,35 +3533,31 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
     // PUSHA
     // =================================================================
     case OpType::PUSHA: {
-        // Save original SP in R12
-        emitLoadReg16(R12, R_SP);
-        // Pre-compute SS*16 → RBP for efficiency
-        code_.emit8(0x0F); code_.emit8(0xB7);
-        emitModRMDisp(code_, RBP, sregOff(S_SS));  // movzx ebp, word [rcx + sregOff(S_SS)]
-        code_.emit8(0xC1); code_.emit8(0xE5); code_.emit8(0x04); // shl ebp, 4
+        // Save original SP in R10 (emitCodeWriteCheck keeps it)
+        emitLoadReg16(R10, R_SP);
+        // SS*16 → RBP: mov ebp, [rcx + segBaseOff(S_SS)]
+        emitInsn(x64::mov(x64::D32, RBP, x64::mem(RCX, segBaseOff(S_SS))));
 
         // Push AX, CX, DX, BX, SP(original), BP, SI, DI
         for (int r = 0; r < 8; r++) {
             if (r == R_SP) {
-                // Push original SP (in R12) → save in RBX
-                code_.emit8(REX_R); // REX.R for R12 source
-                code_.emit8(0x89); code_.emit8(0xC0 | ((R12 & 7) << 3) | RBX); // mov ebx, r12d
+                // Push original SP (in R10) → save in RBX
+                emitInsn(x64::mov(x64::D32, RBX, R10));
             } else {
                 emitLoadReg16(RBX, r);
             }
             // Decrement SP
             emitLoadReg16(RDX, R_SP);
-            code_.emit8(0x66); code_.emit8(0x83); code_.emit8(0xEA); code_.emit8(0x02);
-            code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xD2);
+            emitInsn(x64::aluImm(x64::SUB, x64::W16, RDX, 0x02));
+            emitInsn(x64::movzx16(RDX, RDX));
             emitStoreReg16(R_SP, RDX);
             // Compute physical address: EAX = EBP(SS*16) + EDX(new SP)
-            code_.emit8(0x8D); code_.emit8(0x04); code_.emit8(0x2A); // LEA EAX, [RDX+RBP]
-            code_.emit8(0x25); code_.emit32(0x000FFFFF); // AND EAX, 0xFFFFF
+            emitInsn(x64::lea(x64::D32, RAX, x64::mem(RDX, RBP, 0))); // LEA EAX, [RDX+RBP]
+            emitWrapAddress();
             // Store: mov word [rcx + rax + OFF_MEMORY], bx
-            code_.emit8(0x66); code_.emit8(0x89);
-            code_.emit8(0x9C); code_.emit8(0x01); code_.emit32(OFF_MEMORY);
+            emitInsn(x64::mov(x64::W16, kGuestMem, RBX));
+            emitCodeWriteCheck(2);
         }
-        emitSetIP(nextIP);
         break;
     }
 
@@ -2006,30 +3565,26 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
     // POPA
     // =================================================================
     case OpType::POPA: {
-        // Pre-compute SS*16 → RBP for efficiency
-        code_.emit8(0x0F); code_.emit8(0xB7);
-        emitModRMDisp(code_, RBP, sregOff(S_SS));
-        code_.emit8(0xC1); code_.emit8(0xE5); code_.emit8(0x04); // shl ebp, 4
+        // SS*16 → RBP: mov ebp, [rcx + segBaseOff(S_SS)]
+        emitInsn(x64::mov(x64::D32, RBP, x64::mem(RCX, segBaseOff(S_SS))));
 
         // Pop DI, SI, BP, skip SP, BX, DX, CX, AX
         for (int r = 7; r >= 0; r--) {
             // Compute SS:SP physical address
             emitLoadReg16(RDX, R_SP);
-            code_.emit8(0x8D); code_.emit8(0x04); code_.emit8(0x2A); // LEA EAX, [RDX+RBP]
-            code_.emit8(0x25); code_.emit32(0x000FFFFF);
+            emitInsn(x64::lea(x64::D32, RAX, x64::mem(RDX, RBP, 0))); // LEA EAX, [RDX+RBP]
+            emitWrapAddress();
             // Load from stack: movzx ebx, word [rcx + rax + OFF_MEMORY]
-            code_.emit8(0x0F); code_.emit8(0xB7);
-            code_.emit8(0x9C); code_.emit8(0x01); code_.emit32(OFF_MEMORY);
+            emitInsn(x64::movzx16(RBX, kGuestMem));
             // Increment SP
-            code_.emit8(0x66); code_.emit8(0x83); code_.emit8(0xC2); code_.emit8(0x02);
-            code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xD2);
+            emitInsn(x64::aluImm(x64::ADD, x64::W16, RDX, 0x02));
+            emitInsn(x64::movzx16(RDX, RDX));
             emitStoreReg16(R_SP, RDX);
 
             if (r != R_SP) {
                 emitStoreReg16(r, RBX);
             }
         }
-        emitSetIP(nextIP);
         break;
     }
 
@@ -2037,20 +3592,20 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
     // PUSHF / POPF
     // =================================================================
     case OpType::PUSHF: {
+        emitMaterializeFlags();
         // Load flags into RBX
         code_.emit8(0x0F); code_.emit8(0xB7);
         emitModRMDisp(code_, RBX, OFF_FLAGS);
         // Decrement SP
         emitLoadReg16(RDX, R_SP);
-        code_.emit8(0x66); code_.emit8(0x83); code_.emit8(0xEA); code_.emit8(0x02);
-        code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xD2);
+        emitInsn(x64::aluImm(x64::SUB, x64::W16, RDX, 0x02));
+        emitInsn(x64::movzx16(RDX, RDX));
         emitStoreReg16(R_SP, RDX);
         // Compute SS:SP physical address → EAX
         emitSegAddr(S_SS, R_SP);
         // Store flags: mov word [rcx + rax + OFF_MEMORY], bx
-        code_.emit8(0x66); code_.emit8(0x89);
-        code_.emit8(0x9C); code_.emit8(0x01); code_.emit32(OFF_MEMORY);
-        emitSetIP(nextIP);
+        emitInsn(x64::mov(x64::W16, kGuestMem, RBX));
+        emitCodeWriteCheck(2);
         break;
     }
 
@@ -2058,17 +3613,16 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         // Compute SS:SP physical address → EAX
         emitSegAddr(S_SS, R_SP);
         // Load from stack: movzx ebx, word [rcx + rax + OFF_MEMORY]
-        code_.emit8(0x0F); code_.emit8(0xB7);
-        code_.emit8(0x9C); code_.emit8(0x01); code_.emit32(OFF_MEMORY);
+        emitInsn(x64::movzx16(RBX, kGuestMem));
         // Increment SP
         emitLoadReg16(RDX, R_SP);
-        code_.emit8(0x66); code_.emit8(0x83); code_.emit8(0xC2); code_.emit8(0x02);
-        code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xD2);
+        emitInsn(x64::aluImm(x64::ADD, x64::W16, RDX, 0x02));
+        emitInsn(x64::movzx16(RDX, RDX));
         emitStoreReg16(R_SP, RDX);
         // Store to flags (from RBX)
         code_.emit8(0x66); code_.emit8(0x89);
         emitModRMDisp(code_, RBX, OFF_FLAGS);
-        emitSetIP(nextIP);
+        emitFlagsReplaced();
         break;
     }
 
@@ -2077,8 +3631,8 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
     // =================================================================
     case OpType::JMP: {
         if (instr.dst.kind == OpdKind::REL8 || instr.dst.kind == OpdKind::REL16) {
-            uint16_t target = nextIP + instr.dst.rel;
-            emitSetIP(target);
+            emitExit(nextIP + instr.dst.rel);
+            return true;
         } else if (instr.dst.kind == OpdKind::REG16) {
             // JMP reg16 (indirect)
             emitLoadReg16(RAX, instr.dst.reg);
@@ -2088,20 +3642,16 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         } else if (instr.dst.kind == OpdKind::MEM) {
             // JMP [mem] (indirect through memory)
             emitComputeEA(instr.dst);
-            // movzx eax, word [rcx + rax + OFF_MEMORY]
-            code_.emit8(0x0F); code_.emit8(0xB7);
-            code_.emit8(0x84); code_.emit8(0x01);
-            code_.emit32(OFF_MEMORY);
+            emitInsn(x64::movzx16(RAX, kGuestMem));
             code_.emit8(0x66); code_.emit8(0x89);
             emitModRMDisp(code_, RAX, OFF_IP);
         } else if (instr.dst.kind == OpdKind::FAR_PTR) {
             emitSetIP(instr.dst.off);
-            // Also set CS
-            code_.emit8(0x66); code_.emit8(0xC7);
-            emitModRMDisp(code_, 0, sregOff(S_CS));
-            code_.emit16(instr.dst.seg);
+            // Also set CS and its base
+            emitInsn(x64::movImm(x64::W16, x64::mem(RCX, sregOff(S_CS)), instr.dst.seg));
+            emitInsn(x64::movImm(x64::D32, x64::mem(RCX, segBaseOff(S_CS)),
+                                 (uint32_t)instr.dst.seg << 4));
         } else {
-            emitEpilogue();
             return false;
         }
         emitEpilogue();
@@ -2117,8 +3667,8 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
     case OpType::JL: case OpType::JNL: case OpType::JLE: case OpType::JNLE: {
         uint16_t takenIP = nextIP + instr.dst.rel;
 
-        // Restore 8086 flags to native RFLAGS
-        emitRestoreFlags();
+        // Current 8086 flags → native RFLAGS
+        emitLoadHostFlags();
 
         // Emit native Jcc to a label
         // The condition code maps directly: JO=0, JNO=1, JB=2, JNB=3, ...
@@ -2137,16 +3687,14 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         code_.emit8(0); // placeholder for rel8
 
         // Not taken path:
-        emitSetIP(nextIP);
-        emitEpilogue();
+        emitExit(nextIP);
 
         // Patch jump target
         size_t afterNotTaken = code_.cursor();
         code_.patch8(patchPos, (uint8_t)(afterNotTaken - patchPos - 1));
 
         // Taken path:
-        emitSetIP(takenIP);
-        emitEpilogue();
+        emitExit(takenIP);
         return true;
     }
 
@@ -2158,45 +3706,36 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
             uint16_t target = nextIP + instr.dst.rel;
             // Decrement SP
             emitLoadReg16(RDX, R_SP);
-            code_.emit8(0x66); code_.emit8(0x83); code_.emit8(0xEA); code_.emit8(0x02);
-            code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xD2);
+            emitInsn(x64::aluImm(x64::SUB, x64::W16, RDX, 0x02));
+            emitInsn(x64::movzx16(RDX, RDX));
             emitStoreReg16(R_SP, RDX);
             // Compute SS:SP → EAX, push return address
             emitSegAddr(S_SS, R_SP);
-            // mov word [rcx + rax + OFF_MEMORY], nextIP
-            code_.emit8(0x66); code_.emit8(0xC7);
-            code_.emit8(0x84); code_.emit8(0x01); code_.emit32(OFF_MEMORY);
-            code_.emit16(nextIP);
-            emitSetIP(target);
+            emitInsn(x64::movImm(x64::W16, kGuestMem, nextIP));
+            emitCodeWriteCheck(2);
+            emitExit(target);
+            return true;
         } else if (instr.dst.kind == OpdKind::REG16 || instr.dst.kind == OpdKind::MEM) {
-            // Indirect call: compute target first into R12
+            // Indirect call: compute target first into R10 (emitCodeWriteCheck
+            // keeps it)
             if (instr.dst.kind == OpdKind::REG16) {
-                emitLoadReg16(R12, instr.dst.reg);
+                emitLoadReg16(R10, instr.dst.reg);
             } else {
                 emitComputeEA(instr.dst);
-                // Load target: movzx r12d, word [rcx+rax+OFF_MEMORY]
-                code_.emit8(REX_R); // REX.R for R12
-                code_.emit8(0x0F); code_.emit8(0xB7);
-                code_.emit8(0x84 | ((R12 & 7) << 3)); code_.emit8(0x01);
-                code_.emit32(OFF_MEMORY);
+                emitInsn(x64::movzx16(R10, kGuestMem));
             }
             // Decrement SP
             emitLoadReg16(RDX, R_SP);
-            code_.emit8(0x66); code_.emit8(0x83); code_.emit8(0xEA); code_.emit8(0x02);
-            code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xD2);
+            emitInsn(x64::aluImm(x64::SUB, x64::W16, RDX, 0x02));
+            emitInsn(x64::movzx16(RDX, RDX));
             emitStoreReg16(R_SP, RDX);
             // Compute SS:SP → EAX, store return address
             emitSegAddr(S_SS, R_SP);
-            code_.emit8(0x66); code_.emit8(0xC7);
-            code_.emit8(0x84); code_.emit8(0x01); code_.emit32(OFF_MEMORY);
-            code_.emit16(nextIP);
-            // Set IP to target (in R12)
-            code_.emit8(0x66);
-            code_.emit8(REX_R); // REX.R for R12
-            code_.emit8(0x89);
-            emitModRMDisp(code_, R12 & 7, OFF_IP);
+            emitInsn(x64::movImm(x64::W16, kGuestMem, nextIP));
+            emitCodeWriteCheck(2);
+            // Set IP to target (in R10)
+            emitInsn(x64::mov(x64::W16, x64::mem(RCX, OFF_IP), R10));
         } else {
-            emitEpilogue();
             return false;
         }
         emitEpilogue();
@@ -2209,21 +3748,19 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
     case OpType::RET: {
         // Compute SS:SP → EAX, pop return address
         emitSegAddr(S_SS, R_SP);
-        // movzx ebx, word [rcx + rax + OFF_MEMORY]
-        code_.emit8(0x0F); code_.emit8(0xB7);
-        code_.emit8(0x9C); code_.emit8(0x01); code_.emit32(OFF_MEMORY);
+        emitInsn(x64::movzx16(RBX, kGuestMem));
         // Set IP from RBX
         code_.emit8(0x66); code_.emit8(0x89);
         emitModRMDisp(code_, RBX, OFF_IP);
         // Increment SP by 2
         emitLoadReg16(RDX, R_SP);
-        code_.emit8(0x66); code_.emit8(0x83); code_.emit8(0xC2); code_.emit8(0x02);
-        code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xD2);
+        emitInsn(x64::aluImm(x64::ADD, x64::W16, RDX, 0x02));
+        emitInsn(x64::movzx16(RDX, RDX));
         // If RET imm16, add extra to SP
         if (instr.dst.kind == OpdKind::IMM16) {
             code_.emit8(0x66); code_.emit8(0x81); code_.emit8(0xC2);
             code_.emit16((uint16_t)instr.dst.imm);
-            code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xD2);
+            emitInsn(x64::movzx16(RDX, RDX));
         }
         emitStoreReg16(R_SP, RDX);
         emitEpilogue();
@@ -2234,12 +3771,33 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
     // INT
     // =================================================================
     case OpType::INT: {
-        // Store interrupt number to pending_int
-        // mov dword [rcx + OFF_PENDING], imm32
-        code_.emit8(0xC7);
-        emitModRMDisp(code_, 0, OFF_PENDING);
-        code_.emit32((uint32_t)instr.dst.imm);
+        if (!cur_block_ || !isServiceInt(instr)) {
+            // Store interrupt number to pending_int
+            // mov dword [rcx + OFF_PENDING], imm32
+            code_.emit8(0xC7);
+            emitModRMDisp(code_, 0, OFF_PENDING);
+            code_.emit32((uint32_t)instr.dst.imm);
+            break;
+        }
+        // Call the service from here: the handler sees cpu.flags, cpu.regs
+        // and cpu.ip as the dispatcher would, and flags smc_exit when the
+        // block can't go on (end of run, or its code was overwritten)
+        emitMaterializeFlags();
         emitSetIP(nextIP);
+        emitSpillRegs();
+        emitInsn(x64::push(RCX));
+        emitInsn(x64::aluImm(x64::SUB, x64::Q64, RSP, 8));
+        // System V: onServiceInt(rdi=this, esi=num, rdx=cur_block_)
+        emitMovAddress(RDI, ADDR_ENGINE);
+        emitInsn(x64::movImm32(RSI, (uint8_t)instr.dst.imm));
+        emitMovAddress(RDX, ADDR_BLOCK);
+        emitMovAddress(RAX, ADDR_SERVICE_INT);
+        emitInsn(x64::call(RAX));
+        emitInsn(x64::aluImm(x64::ADD, x64::Q64, RSP, 8));
+        emitInsn(x64::pop(RCX));
+        emitFillRegs();
+        emitFlagsReplaced();
+        code_write_checked_ = true;  // compileBlock emits the smc_exit check
         break;
     }
 
@@ -2251,7 +3809,7 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         // Decrement CX
         emitLoadReg16(RAX, R_CX);
         code_.emit8(0x66); code_.emit8(0xFF); code_.emit8(0xC8); // DEC AX
-        code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xC0); // MOVZX EAX, AX
+        emitInsn(x64::movzx16(RAX, RAX)); // MOVZX EAX, AX
         emitStoreReg16(R_CX, RAX);
         // Test if CX != 0
         code_.emit8(0x66); code_.emit8(0x85); code_.emit8(0xC0); // TEST AX, AX
@@ -2259,20 +3817,19 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         size_t patch = code_.cursor();
         code_.emit8(0);
         // Not taken
-        emitSetIP(nextIP);
-        emitEpilogue();
+        emitExit(nextIP);
         // Taken
         code_.patch8(patch, (uint8_t)(code_.cursor() - patch - 1));
-        emitSetIP(takenIP);
-        emitEpilogue();
+        emitExit(takenIP);
         return true;
     }
 
     case OpType::LOOPE: {
         uint16_t takenIP = nextIP + instr.dst.rel;
+        emitMaterializeFlags();
         emitLoadReg16(RAX, R_CX);
         code_.emit8(0x66); code_.emit8(0xFF); code_.emit8(0xC8);
-        code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xC0);
+        emitInsn(x64::movzx16(RAX, RAX));
         emitStoreReg16(R_CX, RAX);
         // CX != 0 AND ZF == 1
         code_.emit8(0x66); code_.emit8(0x85); code_.emit8(0xC0);
@@ -2288,20 +3845,19 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         code_.emit8(0);
         // Not taken (CX==0 or ZF==0)
         code_.patch8(patchCxZ, (uint8_t)(code_.cursor() - patchCxZ - 1));
-        emitSetIP(nextIP);
-        emitEpilogue();
+        emitExit(nextIP);
         // Taken
         code_.patch8(patchZf, (uint8_t)(code_.cursor() - patchZf - 1));
-        emitSetIP(takenIP);
-        emitEpilogue();
+        emitExit(takenIP);
         return true;
     }
 
     case OpType::LOOPNE: {
         uint16_t takenIP = nextIP + instr.dst.rel;
+        emitMaterializeFlags();
         emitLoadReg16(RAX, R_CX);
         code_.emit8(0x66); code_.emit8(0xFF); code_.emit8(0xC8);
-        code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xC0);
+        emitInsn(x64::movzx16(RAX, RAX));
         emitStoreReg16(R_CX, RAX);
         code_.emit8(0x66); code_.emit8(0x85); code_.emit8(0xC0);
         code_.emit8(0x74); // JZ → not taken (CX==0)
@@ -2316,12 +3872,10 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         code_.emit8(0);
         // Not taken
         code_.patch8(patchCxZ, (uint8_t)(code_.cursor() - patchCxZ - 1));
-        emitSetIP(nextIP);
-        emitEpilogue();
+        emitExit(nextIP);
         // Taken
         code_.patch8(patchZf, (uint8_t)(code_.cursor() - patchZf - 1));
-        emitSetIP(takenIP);
-        emitEpilogue();
+        emitExit(takenIP);
         return true;
     }
 
@@ -2333,12 +3887,10 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         size_t patch = code_.cursor();
         code_.emit8(0);
         // Not taken (CX != 0)
-        emitSetIP(nextIP);
-        emitEpilogue();
+        emitExit(nextIP);
         // Taken (CX == 0)
         code_.patch8(patch, (uint8_t)(code_.cursor() - patch - 1));
-        emitSetIP(takenIP);
-        emitEpilogue();
+        emitExit(takenIP);
         return true;
     }
 
@@ -2347,12 +3899,25 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
     // =================================================================
     case OpType::SHL: case OpType::SHR: case OpType::SAR:
     case OpType::ROL: case OpType::ROR: case OpType::RCL: case OpType::RCR: {
-        // For RCL/RCR, restore CF first
-        if (instr.op == OpType::RCL || instr.op == OpType::RCR) {
-            emitRestoreFlags();
-        }
+        bool rotate = (instr.op == OpType::ROL || instr.op == OpType::ROR ||
+                       instr.op == OpType::RCL || instr.op == OpType::RCR);
+        bool byCL = (instr.src.kind != OpdKind::IMM8);
+        bool carryIn = (instr.op == OpType::RCL || instr.op == OpType::RCR);
+        bool dead = (flag_plan_ == FLAGS_DEAD);
+        // A zero count (the host masks counts to 5 bits too) changes nothing
+        if (!byCL && (instr.src.imm & 0x1F) == 0) break;
+
+        // Rotates keep SF/ZF/AF/PF, and a zero CL count keeps everything,
+        // so those need the current flags to merge into
+        if (carryIn || ((rotate || byCL) && !dead)) emitMaterializeFlags();
 
         emitLoadOperand(RAX, instr.dst, instr.is_word);
+        if (carryIn) {
+            // bt dword [rcx+OFF_FLAGS], 0 → CF (after the EA computation)
+            code_.emit8(0x0F); code_.emit8(0xBA);
+            emitModRMDisp(code_, 4, OFF_FLAGS);
+            code_.emit8(0);
+        }
 
         // Determine the shift /reg field for x64 encoding
         uint8_t shReg;
@@ -2367,6 +3932,7 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
             default: shReg = 4; break;
         }
 
+        size_t skipPatch = 0;
         if (instr.src.kind == OpdKind::IMM8 && instr.src.imm == 1) {
             // Shift by 1
             if (instr.is_word) {
@@ -2395,19 +3961,8 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
             code_.emit8(REX_W | 0x01); // REX.WB
             code_.emit8(0x89); code_.emit8(0xC0 | (RCX << 3) | (R10 & 7)); // mov r10, rcx
 
-            // Load CL from CPU struct (CL = reg 1 8-bit)
-            // movzx ecx, byte [r10 + regOff8(1)]
-            code_.emit8(0x41); // REX.B for R10 base
-            code_.emit8(0x0F); code_.emit8(0xB6);
-            // ModR/M: mod=01, reg=RCX(1), rm=R10&7(2)
-            int clOff = regOff8(1);
-            if (clOff >= -128 && clOff <= 127) {
-                code_.emit8(0x40 | (RCX << 3) | (R10 & 7));
-                code_.emit8((uint8_t)clOff);
-            } else {
-                code_.emit8(0x80 | (RCX << 3) | (R10 & 7));
-                code_.emit32((uint32_t)clOff);
-            }
+            // movzx ecx, r9b (guest CL)
+            emitLoadReg8(RCX, 1);
 
             // Shift
             if (instr.is_word) {
@@ -2418,17 +3973,48 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
                 code_.emit8(0xD2);
                 code_.emit8(0xC0 | (shReg << 3) | RAX);
             }
+            if (!dead) {
+                emitHostFlags(RBX);
+                code_.emit8(0xF6); code_.emit8(0xC1); code_.emit8(0x1F); // TEST CL, 0x1F
+            }
 
             // Restore RCX from R10
             code_.emit8(REX_W | 0x04);
             code_.emit8(0x89); code_.emit8(0xC0 | ((R10 & 7) << 3) | RCX); // mov rcx, r10
+
+            if (!dead) {
+                code_.emit8(0x74); // JZ → count was 0, flags unchanged
+                skipPatch = code_.cursor();
+                code_.emit8(0);
+            }
         }
+        if (dead) {
+            emitStoreOperand(instr.dst, RAX, instr.is_word);
+            break;
+        }
+        if (!byCL) emitHostFlags(RBX);
+
+        // Merge the host flags in RBX into cpu.flags (result stays in EAX):
+        // rotates only set CF and OF, shifts set all arithmetic flags
+        uint32_t mask = rotate ? (F_CF | F_OF) : (F_CF | F_PF | F_AF | F_ZF | F_SF | F_OF);
+        code_.emit8(0x81); code_.emit8(0xE3); code_.emit32(mask); // AND EBX, mask
+        code_.emit8(0x0F); code_.emit8(0xB7);
+        emitModRMDisp(code_, RDX, OFF_FLAGS);
+        if (rotate) {
+            code_.emit8(0x81); code_.emit8(0xE2); code_.emit32(~mask); // AND EDX, ~mask
+        } else {
+            // As emitCaptureFlags: keep DF, IF reads back set
+            code_.emit8(0x81); code_.emit8(0xE2); code_.emit32(F_DF);
+            code_.emit8(0x81); code_.emit8(0xCA); code_.emit32(F_IF);
+        }
+        code_.emit8(0x09); code_.emit8(0xDA); // OR EDX, EBX
+        code_.emit8(0x66); code_.emit8(0x89);
+        emitModRMDisp(code_, RDX, OFF_FLAGS);
+        emitFlagsReplaced();
+        if (skipPatch)
+            code_.patch8(skipPatch, (uint8_t)(code_.cursor() - skipPatch - 1));
 
-        code_.emit8(0x89); code_.emit8(0xC5); // save result in EBP
-        emitCaptureFlags();
-        code_.emit8(0x89); code_.emit8(0xE8); // restore result
         emitStoreOperand(instr.dst, RAX, instr.is_word);
-        emitSetIP(nextIP);
         break;
     }
 
@@ -2485,8 +4071,10 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
             emitStoreReg16(R_AX, RAX);
         }
         // Set flags: CF=OF=1 if high part nonzero
-        emitCaptureFlags();
-        emitSetIP(nextIP);
+        if (flag_plan_ != FLAGS_DEAD) {
+            emitCaptureFlags();
+            lazy_state_ = LAZY_NONE;
+        }
         break;
     }
 
@@ -2548,7 +4136,6 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
             code_.emit8(0x09); code_.emit8(0xD0); // OR EAX, EDX
             emitStoreReg16(R_AX, RAX);
         }
-        emitSetIP(nextIP);
         break;
     }
 
@@ -2559,16 +4146,11 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         bool isWord = (instr.op == OpType::MOVSW);
         int step = isWord ? 2 : 1;
         // Compute DS:SI (or override:SI) physical address → EAX
-        int src_seg = (seg_override_ != 0xFF) ? seg_override_ : S_DS;
+        int src_seg = (seg_override_ != 0xFF) ? seg_override_ : (int)S_DS;
         emitLoadReg16(RAX, R_SI);
         emitApplySegment(src_seg);
         // Load byte/word from [rcx + rax + OFF_MEMORY]
-        if (isWord) {
-            code_.emit8(0x0F); code_.emit8(0xB7);
-        } else {
-            code_.emit8(0x0F); code_.emit8(0xB6);
-        }
-        code_.emit8(0x84); code_.emit8(0x01); code_.emit32(OFF_MEMORY);
+        emitInsn(isWord ? x64::movzx16(RAX, kGuestMem) : x64::movzx8(RAX, kGuestMem));
         // Save loaded value in RBX
         code_.emit8(0x89); code_.emit8(0xC3); // MOV EBX, EAX
 
@@ -2576,13 +4158,8 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         emitLoadReg16(RAX, R_DI);
         emitApplySegment(S_ES);
         // Store RBX to [rcx + rax + OFF_MEMORY]
-        if (isWord) {
-            code_.emit8(0x66); code_.emit8(0x89);
-            code_.emit8(0x9C); code_.emit8(0x01); code_.emit32(OFF_MEMORY);
-        } else {
-            code_.emit8(0x88);
-            code_.emit8(0x9C); code_.emit8(0x01); code_.emit32(OFF_MEMORY);
-        }
+        emitInsn(x64::mov(isWord ? x64::W16 : x64::B8, kGuestMem, RBX));
+        emitCodeWriteCheck(step);
 
         // Update SI based on DF
         code_.emit8(0x0F); code_.emit8(0xB7);
@@ -2593,7 +4170,7 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         code_.emit8(0x83); code_.emit8(0xC0); code_.emit8(step); // ADD EAX, step
         code_.emit8(0xEB); code_.emit8(0x03); // JMP past sub
         code_.emit8(0x83); code_.emit8(0xE8); code_.emit8(step); // SUB EAX, step
-        code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xC0); // MOVZX EAX, AX
+        emitInsn(x64::movzx16(RAX, RAX)); // MOVZX EAX, AX
         emitStoreReg16(R_SI, RAX);
 
         // Update DI based on DF
@@ -2605,9 +4182,8 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         code_.emit8(0x83); code_.emit8(0xC0); code_.emit8(step);
         code_.emit8(0xEB); code_.emit8(0x03);
         code_.emit8(0x83); code_.emit8(0xE8); code_.emit8(step);
-        code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xC0);
+        emitInsn(x64::movzx16(RAX, RAX));
         emitStoreReg16(R_DI, RAX);
-        emitSetIP(nextIP);
         break;
     }
 
@@ -2623,12 +4199,8 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         emitLoadReg16(RAX, R_DI);
         emitApplySegment(S_ES);
         // Store RBX to [rcx + rax + OFF_MEMORY]
-        if (isWord) {
-            code_.emit8(0x66); code_.emit8(0x89);
-        } else {
-            code_.emit8(0x88);
-        }
-        code_.emit8(0x9C); code_.emit8(0x01); code_.emit32(OFF_MEMORY);
+        emitInsn(x64::mov(isWord ? x64::W16 : x64::B8, kGuestMem, RBX));
+        emitCodeWriteCheck(isWord ? 2 : 1);
         // Update DI
         {
             int step = isWord ? 2 : 1;
@@ -2643,25 +4215,19 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
             code_.emit8(0xEB); code_.emit8(0x03); // JMP past sub
             // subtract:
             code_.emit8(0x83); code_.emit8(0xE8); code_.emit8(step);
-            code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xC0);
+            emitInsn(x64::movzx16(RAX, RAX));
             emitStoreReg16(R_DI, RAX);
         }
-        emitSetIP(nextIP);
         break;
     }
 
     case OpType::LODSB: case OpType::LODSW: {
         bool isWord = (instr.op == OpType::LODSW);
         // Compute DS:SI (or override:SI) physical address → EAX
-        int src_seg = (seg_override_ != 0xFF) ? seg_override_ : S_DS;
+        int src_seg = (seg_override_ != 0xFF) ? seg_override_ : (int)S_DS;
         emitLoadReg16(RAX, R_SI);
         emitApplySegment(src_seg);
-        if (isWord) {
-            code_.emit8(0x0F); code_.emit8(0xB7);
-        } else {
-            code_.emit8(0x0F); code_.emit8(0xB6);
-        }
-        code_.emit8(0x84); code_.emit8(0x01); code_.emit32(OFF_MEMORY);
+        emitInsn(isWord ? x64::movzx16(RAX, kGuestMem) : x64::movzx8(RAX, kGuestMem));
         if (isWord) {
             emitStoreReg16(R_AX, RAX);
         } else {
@@ -2678,45 +4244,28 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
             code_.emit8(0x83); code_.emit8(0xC0); code_.emit8(step);
             code_.emit8(0xEB); code_.emit8(0x03);
             code_.emit8(0x83); code_.emit8(0xE8); code_.emit8(step);
-            code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xC0);
+            emitInsn(x64::movzx16(RAX, RAX));
             emitStoreReg16(R_SI, RAX);
         }
-        emitSetIP(nextIP);
         break;
     }
 
     case OpType::CMPSB: case OpType::CMPSW: {
         bool isWord = (instr.op == OpType::CMPSW);
         // Load DS:[SI] (or override:SI) into RAX
-        int src_seg = (seg_override_ != 0xFF) ? seg_override_ : S_DS;
+        int src_seg = (seg_override_ != 0xFF) ? seg_override_ : (int)S_DS;
         emitLoadReg16(RAX, R_SI);
         emitApplySegment(src_seg);
-        if (isWord) {
-            code_.emit8(0x0F); code_.emit8(0xB7);
-        } else {
-            code_.emit8(0x0F); code_.emit8(0xB6);
-        }
-        code_.emit8(0x84); code_.emit8(0x01); code_.emit32(OFF_MEMORY);
+        emitInsn(isWord ? x64::movzx16(RAX, kGuestMem) : x64::movzx8(RAX, kGuestMem));
         // Save to RBX
         code_.emit8(0x89); code_.emit8(0xC3); // MOV EBX, EAX
 
         // Load ES:[DI] into RAX
         emitLoadReg16(RAX, R_DI);
         emitApplySegment(S_ES);
-        if (isWord) {
-            code_.emit8(0x0F); code_.emit8(0xB7);
-        } else {
-            code_.emit8(0x0F); code_.emit8(0xB6);
-        }
-        code_.emit8(0x84); code_.emit8(0x01); code_.emit32(OFF_MEMORY);
-        // Now compare: [SI] - [DI] = RBX - RAX
-        // We want to set flags as if doing SUB [SI], [DI]
-        if (isWord) {
-            code_.emit8(0x66); code_.emit8(0x29); code_.emit8(0xC3); // SUB BX, AX
-        } else {
-            code_.emit8(0x28); code_.emit8(0xC3); // SUB BL, AL
-        }
-        emitCaptureFlags();
+        emitInsn(isWord ? x64::movzx16(RAX, kGuestMem) : x64::movzx8(RAX, kGuestMem));
+        // Flags as if doing SUB [SI], [DI]: dst RBX → EAX, src RAX → EDX
+        emitStringCompareFlags(isWord);
 
         // Update SI and DI
         {
@@ -2730,7 +4279,7 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
             code_.emit8(0x83); code_.emit8(0xC0); code_.emit8(step);
             code_.emit8(0xEB); code_.emit8(0x03);
             code_.emit8(0x83); code_.emit8(0xE8); code_.emit8(step);
-            code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xC0);
+            emitInsn(x64::movzx16(RAX, RAX));
             emitStoreReg16(R_SI, RAX);
 
             emitLoadReg16(RAX, R_DI);
@@ -2742,10 +4291,9 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
             code_.emit8(0x83); code_.emit8(0xC0); code_.emit8(step);
             code_.emit8(0xEB); code_.emit8(0x03);
             code_.emit8(0x83); code_.emit8(0xE8); code_.emit8(step);
-            code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xC0);
+            emitInsn(x64::movzx16(RAX, RAX));
             emitStoreReg16(R_DI, RAX);
         }
-        emitSetIP(nextIP);
         break;
     }
 
@@ -2759,19 +4307,9 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         }
         emitLoadReg16(RAX, R_DI);
         emitApplySegment(S_ES);
-        if (isWord) {
-            code_.emit8(0x0F); code_.emit8(0xB7);
-        } else {
-            code_.emit8(0x0F); code_.emit8(0xB6);
-        }
-        code_.emit8(0x84); code_.emit8(0x01); code_.emit32(OFF_MEMORY);
-        // SUB BX/BL, AX/AL → sets flags
-        if (isWord) {
-            code_.emit8(0x66); code_.emit8(0x29); code_.emit8(0xC3);
-        } else {
-            code_.emit8(0x28); code_.emit8(0xC3);
-        }
-        emitCaptureFlags();
+        emitInsn(isWord ? x64::movzx16(RAX, kGuestMem) : x64::movzx8(RAX, kGuestMem));
+        // Flags as if doing SUB AX/AL, ES:[DI]
+        emitStringCompareFlags(isWord);
 
         // Update DI
         {
@@ -2784,10 +4322,9 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
             code_.emit8(0x83); code_.emit8(0xC0); code_.emit8(step);
             code_.emit8(0xEB); code_.emit8(0x03);
             code_.emit8(0x83); code_.emit8(0xE8); code_.emit8(step);
-            code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xC0);
+            emitInsn(x64::movzx16(RAX, RAX));
             emitStoreReg16(R_DI, RAX);
         }
-        emitSetIP(nextIP);
         break;
     }
 
@@ -2795,32 +4332,32 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
     // Flag operations
     // =================================================================
     case OpType::CLC: {
+        emitMaterializeFlags();
         code_.emit8(0x0F); code_.emit8(0xB7);
         emitModRMDisp(code_, RAX, OFF_FLAGS);
         code_.emit8(0x25); code_.emit32(~(uint32_t)F_CF); // AND EAX, ~CF
         code_.emit8(0x66); code_.emit8(0x89);
         emitModRMDisp(code_, RAX, OFF_FLAGS);
-        emitSetIP(nextIP);
         break;
     }
 
     case OpType::STC: {
+        emitMaterializeFlags();
         code_.emit8(0x0F); code_.emit8(0xB7);
         emitModRMDisp(code_, RAX, OFF_FLAGS);
         code_.emit8(0x0D); code_.emit32(F_CF); // OR EAX, CF
         code_.emit8(0x66); code_.emit8(0x89);
         emitModRMDisp(code_, RAX, OFF_FLAGS);
-        emitSetIP(nextIP);
         break;
     }
 
     case OpType::CMC: {
+        emitMaterializeFlags();
         code_.emit8(0x0F); code_.emit8(0xB7);
         emitModRMDisp(code_, RAX, OFF_FLAGS);
         code_.emit8(0x35); code_.emit32(F_CF); // XOR EAX, CF
         code_.emit8(0x66); code_.emit8(0x89);
         emitModRMDisp(code_, RAX, OFF_FLAGS);
-        emitSetIP(nextIP);
         break;
     }
 
@@ -2830,7 +4367,6 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         code_.emit8(0x25); code_.emit32(~(uint32_t)F_DF);
         code_.emit8(0x66); code_.emit8(0x89);
         emitModRMDisp(code_, RAX, OFF_FLAGS);
-        emitSetIP(nextIP);
         break;
     }
 
@@ -2840,27 +4376,26 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         code_.emit8(0x0D); code_.emit32(F_DF);
         code_.emit8(0x66); code_.emit8(0x89);
         emitModRMDisp(code_, RAX, OFF_FLAGS);
-        emitSetIP(nextIP);
         break;
     }
 
     case OpType::CLI: {
+        emitMaterializeFlags();
         code_.emit8(0x0F); code_.emit8(0xB7);
         emitModRMDisp(code_, RAX, OFF_FLAGS);
         code_.emit8(0x25); code_.emit32(~(uint32_t)F_IF);
         code_.emit8(0x66); code_.emit8(0x89);
         emitModRMDisp(code_, RAX, OFF_FLAGS);
-        emitSetIP(nextIP);
         break;
     }
 
     case OpType::STI: {
+        emitMaterializeFlags();
         code_.emit8(0x0F); code_.emit8(0xB7);
         emitModRMDisp(code_, RAX, OFF_FLAGS);
         code_.emit8(0x0D); code_.emit32(F_IF);
         code_.emit8(0x66); code_.emit8(0x89);
         emitModRMDisp(code_, RAX, OFF_FLAGS);
-        emitSetIP(nextIP);
         break;
     }
 
@@ -2868,16 +4403,17 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
     // LAHF / SAHF
     // =================================================================
     case OpType::LAHF: {
+        emitMaterializeFlags();
         // AH = low byte of flags (SF:ZF:0:AF:0:PF:1:CF)
         code_.emit8(0x0F); code_.emit8(0xB7);
         emitModRMDisp(code_, RAX, OFF_FLAGS);
         // Store AL (flags low byte) to AH position
         emitStoreReg8(4, RAX); // AH = reg8 index 4
-        emitSetIP(nextIP);
         break;
     }
 
     case OpType::SAHF: {
+        emitMaterializeFlags();
         // flags low byte = AH
         emitLoadReg8(RAX, 4); // AH
         // Merge into flags: preserve high byte of flags, replace low byte
@@ -2887,7 +4423,6 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         code_.emit8(0x09); code_.emit8(0xC2); // OR EDX, EAX
         code_.emit8(0x66); code_.emit8(0x89);
         emitModRMDisp(code_, RDX, OFF_FLAGS);
-        emitSetIP(nextIP);
         break;
     }
 
@@ -2900,7 +4435,6 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         // movsx eax, al
         code_.emit8(0x0F); code_.emit8(0xBE); code_.emit8(0xC0);
         emitStoreReg16(R_AX, RAX);
-        emitSetIP(nextIP);
         break;
     }
 
@@ -2913,7 +4447,6 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         code_.emit8(0x89); code_.emit8(0xC2); // MOV EDX, EAX
         code_.emit8(0xC1); code_.emit8(0xFA); code_.emit8(0x1F); // SAR EDX, 31
         emitStoreReg16(R_DX, RDX);
-        emitSetIP(nextIP);
         break;
     }
 
@@ -2925,15 +4458,13 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         emitLoadReg16(RDX, R_BX);
         emitLoadReg8(RAX, 0); // AL
         code_.emit8(0x01); code_.emit8(0xD0); // ADD EAX, EDX
-        code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xC0); // MOVZX EAX, AX (16-bit offset)
+        emitInsn(x64::movzx16(RAX, RAX)); // MOVZX EAX, AX (16-bit offset)
         // Apply segment
-        int xlat_seg = (seg_override_ != 0xFF) ? seg_override_ : S_DS;
+        int xlat_seg = (seg_override_ != 0xFF) ? seg_override_ : (int)S_DS;
         emitApplySegment(xlat_seg);
         // Load byte [rcx + rax + OFF_MEMORY]
-        code_.emit8(0x0F); code_.emit8(0xB6);
-        code_.emit8(0x84); code_.emit8(0x01); code_.emit32(OFF_MEMORY);
+        emitInsn(x64::movzx8(RAX, kGuestMem));
         emitStoreReg8(0, RAX); // AL
-        emitSetIP(nextIP);
         break;
     }
 
@@ -2941,7 +4472,6 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
     // NOP, HLT, WAIT
     // =================================================================
     case OpType::NOP: {
-        emitSetIP(nextIP);
         break;
     }
 
@@ -2951,12 +4481,10 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         code_.emit8(0xC6);
         emitModRMDisp(code_, 0, OFF_HALTED);
         code_.emit8(0x01);
-        emitSetIP(nextIP);
         break;
     }
 
     case OpType::WAIT: {
-        emitSetIP(nextIP);
         break;
     }
 
@@ -2972,12 +4500,10 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
             code_.emit8(0xB8); code_.emit32(0);
             emitStoreReg8(0, RAX);
         }
-        emitSetIP(nextIP);
         break;
     }
 
     case OpType::OUT: {
-        emitSetIP(nextIP);
         break;
     }
 
@@ -2988,57 +4514,164 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         // Load reg16 from [mem], segment from [mem+2]
         emitComputeEA(instr.src);
         // Load offset (word at EA)
-        // movzx ebx, word [rcx + rax + OFF_MEMORY]
-        code_.emit8(0x0F); code_.emit8(0xB7);
-        code_.emit8(0x9C); code_.emit8(0x01); code_.emit32(OFF_MEMORY);
+        emitInsn(x64::movzx16(RBX, kGuestMem));
         // Load segment (word at EA+2)
         code_.emit8(0x83); code_.emit8(0xC0); code_.emit8(0x02); // ADD EAX, 2
-        code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xC0); // MOVZX EAX, AX
-        code_.emit8(0x0F); code_.emit8(0xB7);
-        code_.emit8(0x84); code_.emit8(0x01); code_.emit32(OFF_MEMORY);
+        emitInsn(x64::movzx16(RAX, RAX)); // MOVZX EAX, AX
+        emitInsn(x64::movzx16(RAX, kGuestMem));
         // Store: RAX=segment, RBX=offset
         emitStoreReg16(instr.dst.reg, RBX);
-        int sreg = (instr.op == OpType::LDS) ? S_DS : S_ES;
-        code_.emit8(0x66); code_.emit8(0x89);
-        emitModRMDisp(code_, RAX, sregOff(sreg));
-        emitSetIP(nextIP);
+        emitStoreSreg(instr.op == OpType::LDS ? S_DS : S_ES, RAX);
+        emitFlatCheck();
         break;
     }
 
     // =================================================================
     // BCD: DAA, DAS, AAA, AAS, AAM, AAD
-    // These are complex — implement in C++ via pending mechanism
-    // But actually easier to just do it directly in the JIT:
-    // We'll handle them by calling back to C++ or emitting the logic
-    // For now, use a simpler approach: handle in dispatcher
+    // All keep some flags as they were, so the current flags are
+    // materialized first and the adjusted ones merged into cpu.flags
     // =================================================================
-    case OpType::DAA: case OpType::DAS: case OpType::AAA: case OpType::AAS:
     case OpType::AAM: case OpType::AAD: {
-        // For BCD ops, set pending_int to a special value that the dispatcher recognizes
-        // Actually, let's just handle these in C++ after the JIT call
-        // We'll store a special marker
-        code_.emit8(0xC7);
-        emitModRMDisp(code_, 0, OFF_PENDING);
-        // Use negative numbers: -2=DAA, -3=DAS, -4=AAA, -5=AAS, -6=AAM, -7=AAD
-        int32_t marker;
-        switch (instr.op) {
-            case OpType::DAA: marker = -2; break;
-            case OpType::DAS: marker = -3; break;
-            case OpType::AAA: marker = -4; break;
-            case OpType::AAS: marker = -5; break;
-            case OpType::AAM: marker = -6; break;
-            case OpType::AAD: marker = -7; break;
-            default: marker = -100; break;
-        }
-        code_.emit32((uint32_t)marker);
-        // For AAM/AAD, store the immediate in R10 temp? No, we handle in dispatcher
-        // Store immediate base for AAM/AAD (normally 0x0A)
-        if (instr.op == OpType::AAM || instr.op == OpType::AAD) {
-            // Store imm in memory at a known scratch location? Or just let C++ read it
-            // The immediate is in instr.dst.imm, but C++ dispatcher won't have it...
-            // Better: store it in a CPU scratch field. Or: just hardcode base 10.
+        uint8_t base = (uint8_t)instr.dst.imm;
+        emitMaterializeFlags();
+        if (instr.op == OpType::AAM) {
+            if (base == 0) {
+                // Divide error: raise INT 0, AX and flags unchanged
+                code_.emit8(0xC7);
+                emitModRMDisp(code_, 0, OFF_PENDING);
+                code_.emit32(0);
+                break;
+            }
+            // AH = AL / base, AL = AL % base
+            emitLoadReg8(RAX, 0);
+            code_.emit8(0xBB); code_.emit32(base);              // MOV EBX, base
+            code_.emit8(0x31); code_.emit8(0xD2);               // XOR EDX, EDX
+            code_.emit8(0xF7); code_.emit8(0xF3);               // DIV EBX
+            code_.emit8(0xC1); code_.emit8(0xE0); code_.emit8(0x08); // SHL EAX, 8
+            code_.emit8(0x09); code_.emit8(0xD0);               // OR EAX, EDX
+            code_.emit8(0x84); code_.emit8(0xC0);               // TEST AL, AL
+        } else {
+            // AL = AH * base + AL, AH = 0
+            emitLoadReg16(RAX, R_AX);
+            code_.emit8(0x0F); code_.emit8(0xB6); code_.emit8(0xD4); // MOVZX EDX, AH
+            code_.emit8(0x69); code_.emit8(0xD2); code_.emit32(base); // IMUL EDX, EDX, base
+            code_.emit8(0x00); code_.emit8(0xD0);               // ADD AL, DL
+            code_.emit8(0x0F); code_.emit8(0xB6); code_.emit8(0xC0); // MOVZX EAX, AL
         }
-        emitSetIP(nextIP);
+        // ZF/SF/PF from the new AL
+        uint32_t mask = F_ZF | F_SF | F_PF;
+        emitHostFlags(RBX);
+        code_.emit8(0x81); code_.emit8(0xE3); code_.emit32(mask); // AND EBX, mask
+        code_.emit8(0x0F); code_.emit8(0xB7);
+        emitModRMDisp(code_, RDX, OFF_FLAGS);
+        code_.emit8(0x81); code_.emit8(0xE2); code_.emit32(~mask); // AND EDX, ~mask
+        code_.emit8(0x09); code_.emit8(0xDA);                   // OR EDX, EBX
+        code_.emit8(0x66); code_.emit8(0x89);
+        emitModRMDisp(code_, RDX, OFF_FLAGS);
+        emitFlagsReplaced();
+        emitStoreReg16(R_AX, RAX);
+        break;
+    }
+
+    case OpType::AAA: case OpType::AAS: {
+        // Adjust if AL's low nibble > 9 or AF: AL = (AL ± 6) & 0Fh, AH ± 1,
+        // CF = AF = 1; otherwise AL &= 0Fh, CF = AF = 0
+        bool add = (instr.op == OpType::AAA);
+        emitMaterializeFlags();
+        emitLoadReg16(RAX, R_AX);
+        code_.emit8(0x0F); code_.emit8(0xB7);
+        emitModRMDisp(code_, RDX, OFF_FLAGS);
+        code_.emit8(0x81); code_.emit8(0xE2); code_.emit32(~(uint32_t)(F_CF | F_AF)); // AND EDX, ~(CF|AF)
+        code_.emit8(0x89); code_.emit8(0xC3);                   // MOV EBX, EAX
+        code_.emit8(0x83); code_.emit8(0xE3); code_.emit8(0x0F); // AND EBX, 0Fh
+        code_.emit8(0x83); code_.emit8(0xFB); code_.emit8(0x09); // CMP EBX, 9
+        code_.emit8(0x77);                                      // JA → adjust
+        size_t toAdjust = code_.cursor();
+        code_.emit8(0);
+        code_.emit8(0xF6);                                      // TEST byte [flags], AF
+        emitModRMDisp(code_, 0, OFF_FLAGS);
+        code_.emit8((uint8_t)F_AF);
+        code_.emit8(0x75);                                      // JNZ → adjust
+        size_t toAdjust2 = code_.cursor();
+        code_.emit8(0);
+        code_.emit8(0x25); code_.emit32(0xFF0F);                // AND EAX, FF0Fh
+        code_.emit8(0xEB);                                      // JMP → done
+        size_t toDone = code_.cursor();
+        code_.emit8(0);
+        code_.patch8(toAdjust, (uint8_t)(code_.cursor() - toAdjust - 1));
+        code_.patch8(toAdjust2, (uint8_t)(code_.cursor() - toAdjust2 - 1));
+        code_.emit8(0x8D); code_.emit8(0x58); code_.emit8(add ? 0x06 : 0xFA); // LEA EBX, [RAX±6]
+        code_.emit8(0x83); code_.emit8(0xE3); code_.emit8(0x0F); // AND EBX, 0Fh
+        code_.emit8(0x05); code_.emit32(add ? 0x100 : (uint32_t)-0x100); // ADD EAX, ±100h
+        code_.emit8(0x25); code_.emit32(0xFF00);                // AND EAX, FF00h
+        code_.emit8(0x09); code_.emit8(0xD8);                   // OR EAX, EBX
+        code_.emit8(0x83); code_.emit8(0xCA); code_.emit8(F_CF | F_AF); // OR EDX, CF|AF
+        code_.patch8(toDone, (uint8_t)(code_.cursor() - toDone - 1));
+        code_.emit8(0x66); code_.emit8(0x89);
+        emitModRMDisp(code_, RDX, OFF_FLAGS);
+        emitFlagsReplaced();
+        emitStoreReg16(R_AX, RAX);
+        break;
+    }
+
+    case OpType::DAA: case OpType::DAS: {
+        // Low nibble > 9 or AF: AL ± 6, AF = 1, CF |= carry out of that.
+        // Old AL > 99h or old CF: AL ± 60h, CF = 1. OF is kept.
+        bool add = (instr.op == OpType::DAA);
+        emitMaterializeFlags();
+        emitLoadReg8(RAX, 0);
+        code_.emit8(0x41); code_.emit8(0x89); code_.emit8(0xC2); // MOV R10D, EAX (old AL)
+        code_.emit8(0x31); code_.emit8(0xDB);                   // XOR EBX, EBX (new CF/AF)
+        code_.emit8(0x89); code_.emit8(0xC2);                   // MOV EDX, EAX
+        code_.emit8(0x83); code_.emit8(0xE2); code_.emit8(0x0F); // AND EDX, 0Fh
+        code_.emit8(0x83); code_.emit8(0xFA); code_.emit8(0x09); // CMP EDX, 9
+        code_.emit8(0x77);                                      // JA → low adjust
+        size_t toLow = code_.cursor();
+        code_.emit8(0);
+        code_.emit8(0xF6);                                      // TEST byte [flags], AF
+        emitModRMDisp(code_, 0, OFF_FLAGS);
+        code_.emit8((uint8_t)F_AF);
+        code_.emit8(0x74);                                      // JZ → high check
+        size_t toHigh = code_.cursor();
+        code_.emit8(0);
+        code_.patch8(toLow, (uint8_t)(code_.cursor() - toLow - 1));
+        code_.emit8(0x83); code_.emit8(add ? 0xC0 : 0xE8); code_.emit8(0x06); // ADD/SUB EAX, 6
+        code_.emit8(0x83); code_.emit8(0xCB); code_.emit8(F_AF); // OR EBX, AF
+        code_.emit8(0x3D); code_.emit32(0xFF);                  // CMP EAX, FFh
+        code_.emit8(0x76); code_.emit8(0x03);                   // JBE → no carry
+        code_.emit8(0x83); code_.emit8(0xCB); code_.emit8(F_CF); // OR EBX, CF
+        code_.emit8(0x25); code_.emit32(0xFF);                  // AND EAX, FFh
+        code_.patch8(toHigh, (uint8_t)(code_.cursor() - toHigh - 1));
+        code_.emit8(0x41); code_.emit8(0x81); code_.emit8(0xFA); code_.emit32(0x99); // CMP R10D, 99h
+        code_.emit8(0x77);                                      // JA → high adjust
+        size_t toHigh2 = code_.cursor();
+        code_.emit8(0);
+        code_.emit8(0xF6);                                      // TEST byte [flags], CF
+        emitModRMDisp(code_, 0, OFF_FLAGS);
+        code_.emit8((uint8_t)F_CF);
+        code_.emit8(0x74);                                      // JZ → done
+        size_t toDone = code_.cursor();
+        code_.emit8(0);
+        code_.patch8(toHigh2, (uint8_t)(code_.cursor() - toHigh2 - 1));
+        code_.emit8(0x83); code_.emit8(add ? 0xC0 : 0xE8); code_.emit8(0x60); // ADD/SUB EAX, 60h
+        code_.emit8(0x25); code_.emit32(0xFF);                  // AND EAX, FFh
+        code_.emit8(0x83); code_.emit8(0xCB); code_.emit8(F_CF); // OR EBX, CF
+        code_.patch8(toDone, (uint8_t)(code_.cursor() - toDone - 1));
+        // ZF/SF/PF from the new AL
+        uint32_t mask = F_CF | F_AF | F_ZF | F_SF | F_PF;
+        code_.emit8(0x84); code_.emit8(0xC0);                   // TEST AL, AL
+        // (RBP may hold a loop's segment base, so only scratch registers here)
+        emitHostFlags(R10);
+        emitInsn(x64::aluImm(x64::AND, x64::D32, R10, F_ZF | F_SF | F_PF));
+        code_.emit8(0x0F); code_.emit8(0xB7);
+        emitModRMDisp(code_, RDX, OFF_FLAGS);
+        code_.emit8(0x81); code_.emit8(0xE2); code_.emit32(~mask); // AND EDX, ~mask
+        code_.emit8(0x09); code_.emit8(0xDA);                   // OR EDX, EBX
+        emitInsn(x64::alu(x64::OR, x64::D32, RDX, R10));
+        code_.emit8(0x66); code_.emit8(0x89);
+        emitModRMDisp(code_, RDX, OFF_FLAGS);
+        emitFlagsReplaced();
+        emitStoreReg8(0, RAX);
         break;
     }
 
@@ -3046,43 +4679,39 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
     // IRET
     // =================================================================
     case OpType::IRET: {
-        // Pre-compute SS*16 → RBP
-        code_.emit8(0x0F); code_.emit8(0xB7);
-        emitModRMDisp(code_, RBP, sregOff(S_SS));
-        code_.emit8(0xC1); code_.emit8(0xE5); code_.emit8(0x04); // shl ebp, 4
+        // SS*16 → RBP: mov ebp, [rcx + segBaseOff(S_SS)]
+        emitInsn(x64::mov(x64::D32, RBP, x64::mem(RCX, segBaseOff(S_SS))));
 
         // Pop IP
         emitLoadReg16(RDX, R_SP);
-        code_.emit8(0x8D); code_.emit8(0x04); code_.emit8(0x2A); // LEA EAX, [RDX+RBP]
-        code_.emit8(0x25); code_.emit32(0x000FFFFF);
-        code_.emit8(0x0F); code_.emit8(0xB7);
-        code_.emit8(0x84); code_.emit8(0x01); code_.emit32(OFF_MEMORY);
+        emitInsn(x64::lea(x64::D32, RAX, x64::mem(RDX, RBP, 0))); // LEA EAX, [RDX+RBP]
+        emitWrapAddress();
+        emitInsn(x64::movzx16(RAX, kGuestMem));
         code_.emit8(0x66); code_.emit8(0x89);
         emitModRMDisp(code_, RAX, OFF_IP);
-        code_.emit8(0x66); code_.emit8(0x83); code_.emit8(0xC2); code_.emit8(0x02);
+        emitInsn(x64::aluImm(x64::ADD, x64::W16, RDX, 0x02));
         // Pop CS
-        code_.emit8(0x8D); code_.emit8(0x04); code_.emit8(0x2A);
-        code_.emit8(0x25); code_.emit32(0x000FFFFF);
-        code_.emit8(0x0F); code_.emit8(0xB7);
-        code_.emit8(0x84); code_.emit8(0x01); code_.emit32(OFF_MEMORY);
-        code_.emit8(0x66); code_.emit8(0x89);
-        emitModRMDisp(code_, RAX, sregOff(S_CS));
-        code_.emit8(0x66); code_.emit8(0x83); code_.emit8(0xC2); code_.emit8(0x02);
+        emitInsn(x64::lea(x64::D32, RAX, x64::mem(RDX, RBP, 0)));
+        emitWrapAddress();
+        emitInsn(x64::movzx16(RAX, kGuestMem));
+        emitStoreSreg(S_CS, RAX);
+        emitInsn(x64::aluImm(x64::ADD, x64::W16, RDX, 0x02));
         // Pop FLAGS
-        code_.emit8(0x8D); code_.emit8(0x04); code_.emit8(0x2A);
-        code_.emit8(0x25); code_.emit32(0x000FFFFF);
-        code_.emit8(0x0F); code_.emit8(0xB7);
-        code_.emit8(0x84); code_.emit8(0x01); code_.emit32(OFF_MEMORY);
+        emitInsn(x64::lea(x64::D32, RAX, x64::mem(RDX, RBP, 0)));
+        emitWrapAddress();
+        emitInsn(x64::movzx16(RAX, kGuestMem));
         code_.emit8(0x66); code_.emit8(0x89);
         emitModRMDisp(code_, RAX, OFF_FLAGS);
-        code_.emit8(0x66); code_.emit8(0x83); code_.emit8(0xC2); code_.emit8(0x06);
-        code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xD2);
+        emitFlagsReplaced();
+        emitInsn(x64::aluImm(x64::ADD, x64::W16, RDX, 0x06));
+        emitInsn(x64::movzx16(RDX, RDX));
         emitStoreReg16(R_SP, RDX);
         emitEpilogue();
         return true;
     }
 
     case OpType::INTO: {
+        emitMaterializeFlags();
         // INT 4 if OF is set
         code_.emit8(0x0F); code_.emit8(0xB7);
         emitModRMDisp(code_, RAX, OFF_FLAGS);
@@ -3095,39 +4724,33 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
         emitModRMDisp(code_, 0, OFF_PENDING);
         code_.emit32(4);
         code_.patch8(patch, (uint8_t)(code_.cursor() - patch - 1));
-        emitSetIP(nextIP);
         break;
     }
 
     case OpType::RETF: {
-        // Pre-compute SS*16 → RBP
-        code_.emit8(0x0F); code_.emit8(0xB7);
-        emitModRMDisp(code_, RBP, sregOff(S_SS));
-        code_.emit8(0xC1); code_.emit8(0xED); code_.emit8(0x04);
+        // SS*16 → RBP: mov ebp, [rcx + segBaseOff(S_SS)]
+        emitInsn(x64::mov(x64::D32, RBP, x64::mem(RCX, segBaseOff(S_SS))));
 
         // Pop IP
         emitLoadReg16(RDX, R_SP);
-        code_.emit8(0x8D); code_.emit8(0x04); code_.emit8(0x2A);
-        code_.emit8(0x25); code_.emit32(0x000FFFFF);
-        code_.emit8(0x0F); code_.emit8(0xB7);
-        code_.emit8(0x84); code_.emit8(0x01); code_.emit32(OFF_MEMORY);
+        emitInsn(x64::lea(x64::D32, RAX, x64::mem(RDX, RBP, 0)));
+        emitWrapAddress();
+        emitInsn(x64::movzx16(RAX, kGuestMem));
         code_.emit8(0x66); code_.emit8(0x89);
         emitModRMDisp(code_, RAX, OFF_IP);
-        code_.emit8(0x66); code_.emit8(0x83); code_.emit8(0xC2); code_.emit8(0x02);
+        emitInsn(x64::aluImm(x64::ADD, x64::W16, RDX, 0x02));
         // Pop CS
-        code_.emit8(0x8D); code_.emit8(0x04); code_.emit8(0x2A);
-        code_.emit8(0x25); code_.emit32(0x000FFFFF);
-        code_.emit8(0x0F); code_.emit8(0xB7);
-        code_.emit8(0x84); code_.emit8(0x01); code_.emit32(OFF_MEMORY);
-        code_.emit8(0x66); code_.emit8(0x89);
-        emitModRMDisp(code_, RAX, sregOff(S_CS));
-        code_.emit8(0x66); code_.emit8(0x83); code_.emit8(0xC2); code_.emit8(0x02);
-        code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xD2);
+        emitInsn(x64::lea(x64::D32, RAX, x64::mem(RDX, RBP, 0)));
+        emitWrapAddress();
+        emitInsn(x64::movzx16(RAX, kGuestMem));
+        emitStoreSreg(S_CS, RAX);
+        emitInsn(x64::aluImm(x64::ADD, x64::W16, RDX, 0x02));
+        emitInsn(x64::movzx16(RDX, RDX));
         // RET imm16?
         if (instr.dst.kind == OpdKind::IMM16) {
             code_.emit8(0x66); code_.emit8(0x81); code_.emit8(0xC2);
             code_.emit16((uint16_t)instr.dst.imm);
-            code_.emit8(0x0F); code_.emit8(0xB7); code_.emit8(0xD2);
+            emitInsn(x64::movzx16(RDX, RDX));
         }
         emitStoreReg16(R_SP, RDX);
         emitEpilogue();
@@ -3135,10 +4758,8 @@ bool JitEngine::emitInstruction(const DecodedInstr& instr) {
     }
 
     default:
-        emitEpilogue();
         return false;
     }
 
-    emitEpilogue();
     return true;
 }
@@ -19,6 +19,23 @@ enum class RunMode {
     TRACE   // directive-driven debug (no directives = silent like RUN)
 };
 
+// What an instruction does with the flags it produces (from a backward
+// liveness pass over its block)
+enum FlagPlan : uint8_t {
+    FLAGS_KEEP,   // record them (lazily) as usual
+    FLAGS_DEAD,   // overwritten before anything can see them: skip
+    FLAGS_CARRY   // only CF is read, by the ADC/SBB that next touches flags
+};
+
+// Host addresses generated code embeds as imm64 operands. They change from
+// run to run, so blocks record where they are for --jit-cache.
+enum CodeAddr : uint8_t {
+    ADDR_ENGINE,       // the JitEngine
+    ADDR_BLOCK,        // the block containing the code
+    ADDR_CODE_WRITE,   // JitEngine::onCodeWrite
+    ADDR_SERVICE_INT   // JitEngine::onServiceInt
+};
+
 struct SourceLine {
     uint16_t addr;
     std::string file;
@@ -85,6 +102,52 @@ struct DbgDosFail {
     int partial_count;  // -1 = full failure (DOS_FAIL), >=0 = partial (DOS_PARTIAL)
 };
 
+struct JitBlock;
+class JitEngine;
+struct ThreadedOp;
+
+// Interpreter handler for one pre-decoded instruction (interp.cpp).
+// Returns false when control leaves the block, with cpu.ip already set.
+using ThreadedFn = bool (*)(JitEngine& eng, const ThreadedOp& op);
+
+// One instruction of an interpreted block
+struct ThreadedOp {
+    ThreadedFn   fn;
+    DecodedInstr instr;
+    uint16_t     next_ip;  // IP of the following instruction
+};
+
+// A block exit with a static successor IP. It starts with a jmp rel32 that
+// falls through to the IP store + epilogue until the successor has been
+// translated, and is then patched to jump straight into it.
+struct ChainSlot {
+    size_t    rel_off;           // offset of the jmp's rel32 in the code cache
+    uint16_t  target;            // successor IP
+    JitBlock* linked = nullptr;  // block the jmp currently points at
+};
+
+// A basic block: a straight-line run of 8086 instructions, ending at the
+// first branch, INT (other than the in-block DOS/BIOS services) or
+// REP-prefixed instruction. Cold blocks are pre-decoded for the interpreter;
+// the rest are translated to native code.
+struct JitBlock {
+    uint16_t ip;             // entry IP (fetch address)
+    uint16_t len;            // guest bytes covered by the block
+    uint32_t instr_count;    // 8086 instructions in the block
+    size_t   code_off;       // entry offset in the code cache
+    size_t   chain_off;      // entry for chained jumps (past the prologue)
+    bool     is_rep = false; // REP string op — iterated by the dispatcher
+    DecodedInstr rep_instr;  // decoded instruction (REP blocks only)
+    bool     is_threaded = false;  // cold block run by the interpreter
+    uint32_t hits = 0;             // interpreted entries, toward translation
+    std::vector<ThreadedOp> ops;   // its instructions (interpreted blocks only)
+    std::vector<ChainSlot> exits;                        // static successors
+    std::vector<std::pair<JitBlock*, size_t>> incoming;  // (block, exit) linked here
+    std::vector<std::pair<size_t, CodeAddr>> relocs;     // imm64 operands (code offset, kind)
+    uint8_t  seg_fold = 0;          // sregs direct operands were folded for (bit per sreg)
+    uint16_t seg_value[4] = {};     // their values at translation
+};
+
 struct DbgMemSnap {
     uint16_t addr;            // directive address (when to fire)
     std::string name;         // snapshot identifier
@@ -117,9 +180,158 @@ public:
     // Set command-line arguments (written to PSP at offset 0x80)
     void setArgs(const std::string& args);
 
+    // Interpret a block this many times before translating it (0: translate
+    // every block on first entry)
+    void setJitThreshold(uint32_t n);
+    static constexpr uint32_t DEFAULT_JIT_THRESHOLD = 2;
+
+    // Keep translated blocks in a file under dir between runs of the same
+    // COM image (empty: off)
+    void setJitCache(const std::string& dir);
+
+    // Translate the code reachable from a COM image's entry point ahead of
+    // time (--aot). Returns it in --jit-cache format, or empty if the image
+    // doesn't load; blocks is set to the number of blocks translated.
+    std::vector<uint8_t> translateAhead(const uint8_t* comData, size_t comSize, size_t& blocks);
+    // Start from an image made by translateAhead instead of a cache file
+    void setPrecompiled(std::vector<uint8_t> image);
+
+    // Translate the code reachable from the entry point before the first
+    // instruction runs (--jit-eager)
+    void setEager(bool on);
+
+    // Size of the code cache in bytes. When it fills up every block is
+    // evicted and translation starts over.
+    void setCodeCacheSize(size_t bytes);
+    static constexpr size_t DEFAULT_CODE_CACHE_SIZE = 16 * 1024 * 1024;
+    static constexpr size_t MIN_CODE_CACHE_SIZE = 64 * 1024;
+    static constexpr size_t MAX_CODE_CACHE_SIZE = 1024 * 1024 * 1024;
+
+    // Report code cache occupancy and evictions in the final JSON
+    void setStats(bool on);
+
+    // Back guest memory with a transparent huge page, giving up the
+    // double mapping that lets generated code skip the 20-bit address mask
+    void setHugePages(bool on);
+
 private:
-    // Emit x64 code for one decoded instruction
-    bool emitInstruction(const DecodedInstr& instr);
+    int execute(const uint8_t* comData, size_t comSize, RunMode mode,
+                const std::string& dbg_path, uint64_t max_cycles);
+
+    // Emit x64 code for one decoded instruction located at ip.
+    // Branches emit their own exits; other instructions fall through.
+    bool emitInstruction(const DecodedInstr& instr, uint16_t ip);
+
+    // Translation cache
+    // Decode the basic block at ip (at most max_instrs instructions); empty
+    // if the first instruction is invalid
+    std::vector<DecodedInstr> decodeBlock(uint16_t ip, uint32_t max_instrs);
+    // If ip heads a loop (a branch back to ip within MAX_BLOCK_INSTRS,
+    // reached through straight-line code and Jcc/LOOP/JMP rel only),
+    // decode up to the last such branch; empty otherwise
+    std::vector<DecodedInstr> decodeLoop(uint16_t ip);
+    // Translate the basic block at ip (at most max_instrs instructions).
+    // Returns nullptr if the first instruction is invalid or can't be emitted.
+    JitBlock* compileBlock(uint16_t ip, uint32_t max_instrs);
+    // Translate every block statically reachable from cpu.ip within
+    // [100h, image_end); returns how many were translated
+    size_t translateReachable(uint32_t image_end);
+    // The code cache is full: drop every block and start over
+    void evictAll();
+    // --jit-eager / --jit-stats fields for the final JSON
+    std::string statsJson() const;
+    // Emit one instruction as a throwaway function at the cache tail.
+    // Returns the code offset, or SIZE_MAX on emit failure. Caller rewinds.
+    size_t emitScratch(const DecodedInstr& instr, uint16_t ip);
+    // Drop every translated block and reset the code cache
+    void flushBlocks();
+    // A segment register is no longer 0: drop the flat-model translations
+    // and translate with segments from here on
+    void leaveFlat();
+
+    // Interpreter tier (interp.cpp)
+    // Pre-decode the block at ip for the interpreter, up to the first
+    // instruction it doesn't handle. Returns nullptr if that is the first.
+    JitBlock* buildThreaded(uint16_t ip);
+    // Run an interpreted block and count the entry
+    void runThreaded(JitBlock* blk);
+    friend struct Interp;
+
+    // Persistent translation cache (cache_file.cpp)
+    // Map the cache file for this image, if any, and queue its blocks
+    void loadCache(const uint8_t* comData, size_t comSize);
+    void loadCacheImage(const uint8_t* data, size_t size);
+    // Write the translated blocks back if this run added any
+    void saveCache();
+    // Serialize the translated blocks (count in blocks)
+    std::vector<uint8_t> cacheImage(size_t& blocks);
+    uint64_t cacheKey(const uint8_t* comData, size_t comSize) const;
+    // Take over the cached block for ip if its guest bytes still match
+    JitBlock* adoptCached(uint16_t ip);
+    // mov reg, imm64 of an address, recorded in block_relocs_
+    void emitMovAddress(int reg, CodeAddr kind);
+    uint64_t addressOf(CodeAddr kind, JitBlock* blk) const;
+
+    // Block chaining
+    // Leave the block for a static successor through a patchable jump.
+    // In a loop superblock, targets inside the loop become internal jumps.
+    void emitExit(uint16_t target);
+    // Give the loop's most used segment register that it never writes a
+    // host register (RBP) holding its base, in loop_.seg_base
+    void chooseSegmentBases(const std::vector<DecodedInstr>& instrs);
+    // Loop preheader: load the bases chosen above
+    void emitLoadSegmentBases();
+    // Segment registers whose [disp16] operands the block at ip can fold to
+    // a constant address: used that way and never written in the block
+    uint8_t chooseSegmentFolds(const std::vector<DecodedInstr>& instrs, uint16_t ip) const;
+    // Block entry: leave for the dispatcher at ip unless the folded
+    // segment registers still hold the values they were folded for
+    void emitSegmentGuard(uint16_t ip);
+    // Physical address of a [disp16] operand whose segment is folded
+    bool foldedAddress(const OpdDesc& opd, uint32_t& phys) const;
+    // add qword [rcx + OFF_INSTR_BUDGET], n: instructions charged on entry
+    // that a path out of a loop superblock skips
+    void emitUncount(uint32_t n);
+    // Take the block's instructions out of cpu.instr_budget on entry; exit
+    // to the dispatcher instead if fewer are left. Returns the offset of
+    // the count immediate, patched once the block length is known.
+    size_t emitBudgetCheck(uint16_t ip);
+    // Point exit idx of from at to's chain entry (to == nullptr: unlink)
+    void patchExit(JitBlock* from, size_t idx, JitBlock* to);
+    // Link a new block's exits and any exits already waiting for it
+    void linkBlock(JitBlock* blk);
+    // Unlink a block in both directions and drop it from the block map
+    void invalidateBlock(JitBlock* blk);
+
+    // Self-modifying code
+    // After a store to the physical address in EAX: if its page holds
+    // translated code, call onCodeWrite. Uses RDX as scratch.
+    void emitCodeWriteCheck(int width);
+    // After an instruction that stores: leave the block at nextIP if a store
+    // invalidated it. Returns the offset of the instruction-count correction,
+    // patched once the block length is known.
+    size_t emitCodeWriteExit(uint16_t nextIP);
+    // Called from generated code; flags cpu.smc_exit if cur was invalidated
+    static void onCodeWrite(JitEngine* eng, uint32_t phys, uint32_t len, JitBlock* cur);
+    // Invalidate every block overlapping guest bytes [phys, phys+len).
+    // Returns true if cur was one of them.
+    bool invalidateRange(uint32_t phys, uint32_t len, JitBlock* cur);
+    // Add/remove a block on the pages its bytes occupy
+    void markCodePages(JitBlock* blk);
+    void unmarkCodePages(JitBlock* blk);
+
+    // REP MOVS/STOS/LODS: run all CX iterations as bulk memory operations
+    void runRepString(const DecodedInstr& instr);
+    // REPE/REPNE CMPS/SCAS: vectorized search to the first element that ends
+    // the repeat; leaves SI, DI, CX and flags as the last iteration would
+    void runRepCompare(const DecodedInstr& instr);
+
+    // DOS/BIOS service for INT num: DOS_FAIL interception, handler, idle
+    // detection. Returns false if the run must stop (see service_stop_).
+    bool serviceInt(int num);
+    // Called from generated code for in-block INT 10h/16h/21h; flags
+    // cpu.smc_exit if the run stops, the CPU halts or cur was overwritten
+    static void onServiceInt(JitEngine* eng, uint32_t num, JitBlock* cur);
 
     // Register/flag dump to stderr
     void dumpRegs() const;
@@ -128,36 +340,88 @@ private:
     void dumpInstr(const DecodedInstr& instr) const;
 
     // x64 emission helpers
-    void emitPrologue();    // save callee-saved, RCX = CPU ptr
-    void emitEpilogue();    // restore + ret
+    // Emit a typed instruction through the peephole pass, which drops it if
+    // it can't change anything (e.g. movzx of a register already
+    // zero-extended)
+    void emitInsn(const X64Insn& insn);
+    // What the peephole pass knows holds at the cursor; forgotten when
+    // untyped bytes were emitted or a jump may land here since
+    bool peepValid() const;
+    void peepReset();
+    // Start of a guest instruction: pinned registers are zero-extended
+    void peepBoundary();
+    void emitPrologue();    // save callee-saved, RCX = CPU ptr, load guest regs
+    void emitEpilogue();    // write back guest regs, restore + ret
     void emitSetIP(uint16_t newIP);
+    void emitFillRegs();    // load the pinned guest registers from cpu.regs
+    void emitSpillRegs();   // store them back to cpu.regs
 
-    // Load/store 16-bit register from CPU struct into x64 register
+    // Copy between a guest register (pinned in a host register) and an x64 register
     // x64reg: RAX=0, RCX=1, RDX=2, RBX=3, ...
     void emitLoadReg16(int x64reg, int reg86);
     void emitStoreReg16(int reg86, int x64reg);
     void emitLoadReg8(int x64reg, int reg86);
     void emitStoreReg8(int reg86, int x64reg);
 
-    // Effective address computation → result in RAX (physical 20-bit address)
+    // Effective address computation → result in RAX (physical address; up
+    // to 10FFEFh when GuestMemory::wraps(), 20 bits otherwise)
     void emitComputeEA(const OpdDesc& opd);
 
-    // Segment helpers: add seg*16 to EAX, mask to 20 bits (uses RDX scratch)
+    // Segment helpers: add seg*16 to EAX, then emitWrapAddress
     void emitApplySegment(int seg_reg);
-    // Compute seg*16 + reg_value → EAX (uses RDX scratch)
+    // and eax, 0xFFFFF — unless GuestMemory::wraps(), where a sum past 1MB
+    // already lands in the wrap on the byte the 8086 would address
+    void emitWrapAddress();
+    // Compute seg*16 + reg_value → EAX
     void emitSegAddr(int seg_reg, int offset_reg);
+    // Write a segment register and its seg_base (clobbers R10)
+    void emitStoreSreg(int sreg, int x64reg);
+    // After a segment register write in a flat-model block: leave the block
+    // (through cpu.smc_exit) if one is now nonzero
+    void emitFlatCheck();
 
     // Load operand value into specified x64 register
     void emitLoadOperand(int x64reg, const OpdDesc& opd, bool is_word);
     // Store x64 register to operand location
     void emitStoreOperand(const OpdDesc& opd, int x64reg, bool is_word);
 
-    // Capture RFLAGS after ALU op into cpu.flags
+    // Capture RFLAGS into cpu.flags' arithmetic bits and clear lazy_op.
+    // Uses RAX and RDX.
     void emitCaptureFlags();
-    // Capture flags but preserve CF (for INC/DEC)
-    void emitCaptureFlagsPreserveCF();
-    // Push cpu.flags onto native stack and popfq (for Jcc)
+    // Load cpu.flags' arithmetic bits into RFLAGS. Uses RAX.
     void emitRestoreFlags();
+    // RFLAGS' arithmetic bits into AX, cpu.flags layout
+    void emitHostFlagBits();
+    // Copy RFLAGS' arithmetic bits into reg, cpu.flags layout; keeps RAX.
+    // Uses RDX.
+    void emitHostFlags(int reg);
+    // CPUID 80000001h ECX bit 0: LAHF/SAHF work in 64-bit mode
+    static bool hostHasLahfSahf();
+
+    // Lazy condition flags
+    // Record the op about to run on EAX (dst) and EDX (src) as the flag source
+    void emitSetLazy(uint32_t op, bool is_word, bool has_src);
+    // Replay a recorded op so RFLAGS holds its flags. Uses RBX.
+    void emitRegenFlags(uint32_t op);
+    // Bring cpu.flags up to date before an instruction that reads or edits it
+    void emitMaterializeFlags();
+    // Load the current arithmetic flags into RFLAGS (for Jcc)
+    void emitLoadHostFlags();
+    // cpu.flags was just overwritten wholesale (POPF/IRET): drop lazy_op
+    void emitFlagsReplaced();
+    // Copy the guest CF into lazy_cin (for ADC/SBB)
+    void emitSaveCarryIn();
+    // FLAGS_CARRY: hand the host CF straight to the next ADC/SBB
+    void emitCarryOut();
+    // CMPS/SCAS flags for a compare of EBX (dst) with EAX (src)
+    void emitStringCompareFlags(bool is_word);
+    // Bring just CF in cpu.flags up to date (for INC/DEC)
+    void emitSyncCarry();
+    // Shared materializer at the start of the code cache: a stub called from
+    // blocks whose flag source isn't known at translation time, plus a
+    // C-callable entry the dispatcher uses before C++ code looks at flags
+    void emitFlagsHelpers();
+    void syncFlags();
 
     // Debug info
     void loadDebugInfo(const std::string& dbg_path);
@@ -165,9 +429,98 @@ private:
     std::vector<SourceLine> source_map_;
     std::unordered_map<uint16_t, std::string> addr_to_symbol_;
 
-    std::unique_ptr<CPU8086> cpu_storage_;
+    GuestMemory guest_;
     CPU8086&    cpu_;
-    CodeBuffer  code_;
+    CodeBuffer  code_;      // translation cache: blocks are appended, never rewritten
+    std::vector<std::unique_ptr<JitBlock>> blocks_;
+    std::vector<JitBlock*> block_map_;  // 64K entries, indexed by entry IP
+    // Exits whose successor isn't translated yet, keyed by successor IP
+    std::unordered_multimap<uint16_t, std::pair<JitBlock*, size_t>> unlinked_;
+    std::vector<ChainSlot> block_exits_;  // exits of the block being compiled
+    bool link_exits_ = false;             // emitExit records chain slots
+    // Loop superblock being compiled: the loop head is the per-iteration
+    // budget check, after a preheader that loads invariant segment bases
+    struct LoopState {
+        bool active = false;
+        size_t head_off = 0;                 // code offset of the loop head
+        std::vector<uint16_t> ips;           // instruction addresses
+        std::vector<size_t> offs;            // their code offsets
+        std::vector<std::pair<size_t, size_t>> fixups;  // (rel32, instruction) forward jumps
+        size_t index = 0;                    // instruction being emitted
+        int seg_base[4] = {-1, -1, -1, -1};  // host register holding sreg*16, or -1
+    };
+    LoopState loop_;
+    // Segment registers the block being compiled folds (bit per sreg); a
+    // block entered with other values is retranslated, up to
+    // MAX_SEG_RETRANSLATIONS times per entry IP before it stops folding
+    uint8_t seg_fold_ = 0;
+    static constexpr uint8_t MAX_SEG_RETRANSLATIONS = 2;
+    std::vector<uint8_t> seg_misses_;
+    // Flat model: until a segment register is loaded with anything but 0,
+    // as a .COM starts out, blocks are translated with no segment
+    // arithmetic, an effective address being the offset into guest memory
+    // itself. Only the dispatcher turns it off (leaveFlat).
+    bool flat_ = true;
+    std::vector<std::vector<JitBlock*>> page_blocks_;  // 256 pages of 256 bytes
+    JitBlock* cur_block_ = nullptr;       // block being compiled (nullptr: scratch/branch)
+    bool code_write_checked_ = false;     // current instruction stores to memory
+    static constexpr int LAZY_UNKNOWN = -1;  // lazy_state_: lazy_op not known here
+    static constexpr int LAZY_IN_CIN = -2;   // lazy_state_: only CF is live, in lazy_cin
+    int lazy_state_ = LAZY_UNKNOWN;       // lazy_op at this point of the block
+    struct PeepState {
+        size_t   end = SIZE_MAX;          // cursor after the last typed instruction
+        uint64_t epoch = 0;               // code_.epoch() then
+        uint16_t zext = 0;                // host registers zero-extended from 16 bits
+    };
+    PeepState peep_;
+    // Held by the peephole pass across untyped code with known effects
+    PeepState peepSave() const;
+    void peepRestore(const PeepState& saved, uint16_t clobbered);
+    FlagPlan flag_plan_ = FLAGS_KEEP;     // for the instruction being emitted
+    size_t flags_stub_ = 0;               // materializer stub (code cache offset)
+    size_t flags_entry_ = 0;              // C-callable entry around it
+    // Flags move through LAHF/SETO/SAHF, or PUSHFQ/POPFQ on a host without
+    // LAHF/SAHF in 64-bit mode
+    bool lahf_sahf_ = hostHasLahfSahf();
+    size_t helpers_end_ = 0;              // first code cache offset past the helpers
+    static constexpr uint32_t MAX_BLOCK_INSTRS = 64;
+    uint32_t jit_threshold_ = DEFAULT_JIT_THRESHOLD;
+    JitBlock* threaded_block_ = nullptr;  // block the interpreter is running
+    std::vector<std::pair<size_t, CodeAddr>> block_relocs_;  // of the block being compiled
+    // --jit-cache: loaded blocks not yet checked against guest memory, with
+    // the guest bytes they were translated from
+    std::string cache_dir_;
+    std::string cache_path_;
+    uint64_t cache_key_ = 0;
+    std::unordered_map<uint16_t, std::pair<JitBlock*, std::vector<uint8_t>>> cached_;
+    bool cache_dirty_ = false;            // blocks translated since the load
+    std::vector<uint8_t> precompiled_;    // --aot image carried by the executable
+    // Code cache space translateReachable leaves free, so it never has to flush
+    static constexpr size_t STATIC_CACHE_RESERVE = 256 * 1024;
+    // --jit-eager: block entries translateReachable found, those it left
+    // untranslated for lack of cache room, and how many blocks execution
+    // reached that it didn't find
+    bool eager_ = false;
+    std::vector<bool> static_ips_;
+    size_t eager_static_ = 0;
+    size_t eager_untranslated_ = 0;
+    size_t eager_dynamic_ = 0;
+    uint64_t eager_us_ = 0;
+    // --jit-stats: code cache high-water mark and evictions this run
+    bool stats_ = false;
+    size_t cache_peak_ = 0;
+    size_t cache_evictions_ = 0;
+    size_t cache_evicted_blocks_ = 0;
+    // --jit-stats: code the peephole pass left out this run
+    uint64_t peep_saved_bytes_ = 0;
+    uint64_t peep_elided_ = 0;
+    // --jit-stats: operands folded to constant addresses under the entry
+    // guard (flat-model operands need none and are not counted), and blocks
+    // retranslated because a folded segment register changed
+    uint64_t seg_folded_ = 0;
+    uint64_t seg_retranslated_ = 0;
+    // --jit-stats: blocks dropped on leaving the flat model
+    uint64_t flat_dropped_ = 0;
     std::string dos_output_;
     DosState    dos_state_;
     VideoState  video_;
@@ -216,8 +569,15 @@ private:
     static constexpr size_t MAX_SNAPSHOTS = 32;
     static constexpr size_t MAX_SNAP_SIZE = 65536;
     bool tracing_ = false;
+    // One bit per IP with a directive (TRACE mode; cleared in RUN mode).
+    // Blocks end before these addresses and chained jumps don't enter them.
+    uint64_t directive_bits_[65536 / 64] = {};
+    bool hasDirective(uint16_t ip) const { return (directive_bits_[ip >> 6] >> (ip & 63)) & 1; }
 
     // Idle detection: consecutive INT 16h AH=01h polls with ZF=1 (no key)
     uint32_t idle_polls_ = 0;
     static constexpr uint32_t IDLE_THRESHOLD = 1000;
+    // Why a service call ended the run (reported by the dispatcher)
+    enum class ServiceStop : uint8_t { NONE, KEY_WAIT, IDLE };
+    ServiceStop service_stop_ = ServiceStop::NONE;
 };
@@ -0,0 +1,363 @@
+#include "jit.h"
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// =====================================================================
+// Persistent translation cache (--jit-cache DIR)
+// =====================================================================
+//
+// At the end of a run the code cache is written to DIR/<key>.jitc, where
+// the key hashes the COM image, the directive map (which decides where
+// blocks end) and the agent86 build. A later run of the same image maps
+// the file, copies the code back to the same cache offsets and rebuilds
+// the blocks, but leaves them out of block_map_: the dispatcher adopts a
+// block the first time it reaches its IP, and only if the guest bytes it
+// was translated from are unchanged (arguments, loaders and
+// self-modifying code can make them differ).
+//
+// Chained jumps are saved unlinked and re-linked on adoption. The only
+// absolute addresses in generated code are the imm64 operands recorded
+// in JitBlock::relocs; they are zeroed in the file and filled in on load.
+//
+// Layout: CacheHeader, the code cache bytes [0, code_size), then per
+// block a CacheBlock followed by its exits (CacheExit), relocations
+// (CacheReloc) and guest bytes.
+//
+// --aot builds the same image up front, from the code reachable from the
+// entry point, and the executable it writes carries it (setPrecompiled).
+
+namespace {
+
+constexpr char CACHE_MAGIC[8] = {'A', '8', '6', 'J', 'I', 'T', 'C', '1'};
+// Translations are only valid for the build that emitted them
+constexpr char CACHE_BUILD[] = "agent86 " __DATE__ " " __TIME__;
+
+struct CacheHeader {
+    char     magic[8];
+    uint64_t key;
+    uint32_t helpers_size;  // flags helpers at the start of the code cache
+    uint32_t code_size;
+    uint32_t block_count;
+    uint32_t reserved;
+};
+
+struct CacheBlock {
+    uint16_t ip;
+    uint16_t len;
+    uint32_t instr_count;
+    uint32_t code_off;
+    uint32_t chain_off;
+    uint16_t exit_count;
+    uint16_t reloc_count;
+    uint16_t seg_fold;      // JitBlock::seg_fold
+    uint16_t seg_value[4];
+    uint16_t reserved;
+};
+
+struct CacheExit {
+    uint32_t rel_off;
+    uint16_t target;
+    uint16_t reserved;
+};
+
+struct CacheReloc {
+    uint32_t off;
+    uint32_t kind;
+};
+
+uint64_t fnv1a(uint64_t h, const void* data, size_t len) {
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001B3ULL;
+    }
+    return h;
+}
+
+void unmapFile(void* map, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile(map);
+#else
+    munmap(map, size);
+#endif
+}
+
+} // namespace
+
+void JitEngine::setJitCache(const std::string& dir) {
+    cache_dir_ = dir;
+}
+
+uint64_t JitEngine::addressOf(CodeAddr kind, JitBlock* blk) const {
+    switch (kind) {
+    case ADDR_ENGINE:      return (uint64_t)(uintptr_t)this;
+    case ADDR_BLOCK:       return (uint64_t)(uintptr_t)blk;
+    case ADDR_CODE_WRITE:  return (uint64_t)(uintptr_t)&JitEngine::onCodeWrite;
+    case ADDR_SERVICE_INT: return (uint64_t)(uintptr_t)&JitEngine::onServiceInt;
+    }
+    return 0;
+}
+
+void JitEngine::emitMovAddress(int reg, CodeAddr kind) {
+    // Scratch code and branch instructions have no block to pass
+    if (kind == ADDR_BLOCK && !cur_block_) {
+        emitInsn(x64::movImm64(reg, 0));
+        return;
+    }
+    emitInsn(x64::movImm64(reg, addressOf(kind, cur_block_)));
+    block_relocs_.emplace_back(code_.cursor() - 8, kind);
+}
+
+void JitEngine::setPrecompiled(std::vector<uint8_t> image) {
+    precompiled_ = std::move(image);
+}
+
+uint64_t JitEngine::cacheKey(const uint8_t* comData, size_t comSize) const {
+    uint64_t key = fnv1a(0xCBF29CE484222325ULL, CACHE_BUILD, sizeof(CACHE_BUILD));
+    key = fnv1a(key, comData, comSize);
+    // Addresses are only left unmasked when the wrap is mapped
+    bool wraps = guest_.wraps();
+    key = fnv1a(key, &wraps, sizeof(wraps));
+    // Flags only move through LAHF/SAHF where the host has them
+    key = fnv1a(key, &lahf_sahf_, sizeof(lahf_sahf_));
+    return fnv1a(key, directive_bits_, sizeof(directive_bits_));
+}
+
+void JitEngine::loadCache(const uint8_t* comData, size_t comSize) {
+    cache_key_ = cacheKey(comData, comSize);
+    cache_dirty_ = false;
+    if (!precompiled_.empty()) {
+        loadCacheImage(precompiled_.data(), precompiled_.size());
+        return;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.jitc", (unsigned long long)cache_key_);
+    cache_path_ = cache_dir_ + "/" + name;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(cache_path_.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return;
+    LARGE_INTEGER fsize;
+    if (!GetFileSizeEx(file, &fsize) || (size_t)fsize.QuadPart < sizeof(CacheHeader)) {
+        CloseHandle(file);
+        return;
+    }
+    size_t size = (size_t)fsize.QuadPart;
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping) return;
+    void* map = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!map) return;
+#else
+    int fd = open(cache_path_.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return;
+    }
+    size_t size = (size_t)st.st_size;
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return;
+#endif
+
+    loadCacheImage((const uint8_t*)map, size);
+    unmapFile(map, size);
+}
+
+void JitEngine::loadCacheImage(const uint8_t* data, size_t size) {
+    const uint8_t* p = data;
+    const uint8_t* end = p + size;
+    if (size < sizeof(CacheHeader)) return;
+    CacheHeader hdr;
+    memcpy(&hdr, p, sizeof(hdr));
+    p += sizeof(hdr);
+    // The flags helpers are emitted fresh by flushBlocks; saved blocks call
+    // into them by relative offset, so they must be byte-identical
+    if (memcmp(hdr.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || hdr.key != cache_key_ ||
+        hdr.helpers_size != helpers_end_ || code_.cursor() != helpers_end_ ||
+        hdr.code_size < hdr.helpers_size || hdr.code_size > code_.capacity() ||
+        (size_t)(end - p) < hdr.code_size ||
+        memcmp(p, code_.data(), hdr.helpers_size) != 0) {
+        return;
+    }
+    const uint8_t* code = p;
+    p += hdr.code_size;
+
+    std::vector<std::unique_ptr<JitBlock>> loaded;
+    std::vector<std::vector<uint8_t>> bytes;
+    bool ok = true;
+    for (uint32_t b = 0; b < hdr.block_count && ok; b++) {
+        CacheBlock cb;
+        if ((size_t)(end - p) < sizeof(cb)) { ok = false; break; }
+        memcpy(&cb, p, sizeof(cb));
+        p += sizeof(cb);
+        size_t need = cb.exit_count * sizeof(CacheExit) + cb.reloc_count * sizeof(CacheReloc) + cb.len;
+        if ((size_t)(end - p) < need || cb.code_off < hdr.helpers_size ||
+            cb.chain_off >= hdr.code_size || cb.code_off >= hdr.code_size) {
+            ok = false;
+            break;
+        }
+        auto blk = std::make_unique<JitBlock>();
+        blk->ip = cb.ip;
+        blk->len = cb.len;
+        blk->instr_count = cb.instr_count;
+        blk->code_off = cb.code_off;
+        blk->chain_off = cb.chain_off;
+        blk->seg_fold = (uint8_t)cb.seg_fold;
+        memcpy(blk->seg_value, cb.seg_value, sizeof(blk->seg_value));
+        for (uint16_t i = 0; i < cb.exit_count; i++) {
+            CacheExit ce;
+            memcpy(&ce, p, sizeof(ce));
+            p += sizeof(ce);
+            if (ce.rel_off + 4 > hdr.code_size) ok = false;
+            ChainSlot slot;
+            slot.rel_off = ce.rel_off;
+            slot.target = ce.target;
+            blk->exits.push_back(slot);
+        }
+        for (uint16_t i = 0; i < cb.reloc_count; i++) {
+            CacheReloc cr;
+            memcpy(&cr, p, sizeof(cr));
+            p += sizeof(cr);
+            if (cr.off + 8 > hdr.code_size || cr.kind > ADDR_SERVICE_INT) ok = false;
+            blk->relocs.emplace_back(cr.off, (CodeAddr)cr.kind);
+        }
+        bytes.emplace_back(p, p + cb.len);
+        p += cb.len;
+        loaded.push_back(std::move(blk));
+    }
+    if (ok) {
+        memcpy(code_.at(hdr.helpers_size), code + hdr.helpers_size,
+               hdr.code_size - hdr.helpers_size);
+        code_.rewind(hdr.code_size);
+        for (size_t i = 0; i < loaded.size(); i++) {
+            JitBlock* blk = loaded[i].get();
+            for (auto& r : blk->relocs) {
+                uint64_t v = addressOf(r.second, blk);
+                memcpy(code_.at(r.first), &v, 8);
+            }
+            cached_[blk->ip] = std::make_pair(blk, std::move(bytes[i]));
+            blocks_.push_back(std::move(loaded[i]));
+        }
+    }
+}
+
+JitBlock* JitEngine::adoptCached(uint16_t ip) {
+    auto it = cached_.find(ip);
+    if (it == cached_.end()) return nullptr;
+    JitBlock* blk = it->second.first;
+    bool same = (uint32_t)ip + blk->len <= 0x10000 &&
+                memcmp(cpu_.memory + ip, it->second.second.data(), blk->len) == 0;
+    cached_.erase(it);
+    if (!same) return nullptr;  // stays in blocks_, never entered
+    block_map_[ip] = blk;
+    markCodePages(blk);
+    linkBlock(blk);
+    return blk;
+}
+
+std::vector<uint8_t> JitEngine::cacheImage(size_t& blocks) {
+    // Translated blocks still in use, plus cached ones never reached
+    std::vector<std::pair<JitBlock*, const uint8_t*>> keep;
+    for (auto& b : blocks_) {
+        JitBlock* blk = b.get();
+        if (!blk->is_rep && !blk->is_threaded && block_map_[blk->ip] == blk)
+            keep.emplace_back(blk, cpu_.memory + blk->ip);
+    }
+    for (auto& c : cached_) keep.emplace_back(c.second.first, c.second.second.data());
+    blocks = keep.size();
+
+    std::vector<uint8_t> image;
+    auto put = [&image](const void* data, size_t len) {
+        const uint8_t* b = (const uint8_t*)data;
+        image.insert(image.end(), b, b + len);
+    };
+    CacheHeader hdr = {};
+    memcpy(hdr.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    hdr.key = cache_key_;
+    hdr.helpers_size = (uint32_t)helpers_end_;
+    hdr.code_size = (uint32_t)code_.cursor();
+    hdr.block_count = (uint32_t)keep.size();
+    put(&hdr, sizeof(hdr));
+    // Code image with every chained jump unlinked and every address zeroed
+    size_t code = image.size();
+    put(code_.at(0), code_.cursor());
+    for (auto& k : keep) {
+        for (const ChainSlot& slot : k.first->exits) memset(&image[code + slot.rel_off], 0, 4);
+        for (auto& r : k.first->relocs) memset(&image[code + r.first], 0, 8);
+    }
+    for (auto& k : keep) {
+        JitBlock* blk = k.first;
+        CacheBlock cb = {blk->ip, blk->len, blk->instr_count, (uint32_t)blk->code_off,
+                         (uint32_t)blk->chain_off, (uint16_t)blk->exits.size(),
+                         (uint16_t)blk->relocs.size(), blk->seg_fold,
+                         {blk->seg_value[0], blk->seg_value[1], blk->seg_value[2],
+                          blk->seg_value[3]}, 0};
+        put(&cb, sizeof(cb));
+        for (const ChainSlot& slot : blk->exits) {
+            CacheExit ce = {(uint32_t)slot.rel_off, slot.target, 0};
+            put(&ce, sizeof(ce));
+        }
+        for (auto& r : blk->relocs) {
+            CacheReloc cr = {(uint32_t)r.first, (uint32_t)r.second};
+            put(&cr, sizeof(cr));
+        }
+        put(k.second, blk->len);
+    }
+    return image;
+}
+
+void JitEngine::saveCache() {
+    if (!cache_dirty_ || cache_path_.empty()) return;
+    size_t blocks;
+    std::vector<uint8_t> image = cacheImage(blocks);
+
+#ifdef _WIN32
+    std::string tmp = cache_path_ + ".tmp" + std::to_string((unsigned long)GetCurrentProcessId());
+    CreateDirectoryA(cache_dir_.c_str(), nullptr);
+#else
+    std::string tmp = cache_path_ + ".tmp" + std::to_string((long)getpid());
+    mkdir(cache_dir_.c_str(), 0777);
+#endif
+    FILE* f = fopen(tmp.c_str(), "wb");
+    if (!f) return;
+    fwrite(image.data(), 1, image.size(), f);
+    bool ok = ferror(f) == 0;
+    ok = fclose(f) == 0 && ok;
+    // Concurrent runs each write their own file; the last rename wins
+#ifdef _WIN32
+    if (!ok || !MoveFileExA(tmp.c_str(), cache_path_.c_str(), MOVEFILE_REPLACE_EXISTING))
+        remove(tmp.c_str());
+#else
+    if (!ok || rename(tmp.c_str(), cache_path_.c_str()) != 0) remove(tmp.c_str());
+#endif
+}
+
+std::vector<uint8_t> JitEngine::translateAhead(const uint8_t* comData, size_t comSize,
+                                               size_t& blocks) {
+    blocks = 0;
+    if (!cpu_.loadCOM(comData, comSize)) return {};
+    memset(directive_bits_, 0, sizeof(directive_bits_));
+    flushBlocks();
+    cache_key_ = cacheKey(comData, comSize);
+    translateReachable(0x100 + (uint32_t)comSize);
+    return cacheImage(blocks);
+}
@@ -42,6 +42,7 @@ static uint16_t packDOSDate(int year, int month, int day) {
 static void writeDTARecord(CPU8086& cpu, uint32_t dta_phys,
                            const WIN32_FIND_DATAA& fd) {
     uint8_t* mem = cpu.memory;
+    cpu.noteWrite(dta_phys, 43);
 
     // Offset 0x00: 21 reserved bytes (zero)
     memset(&mem[dta_phys], 0, 21);
@@ -235,7 +236,7 @@ bool handleDOSInt(CPU8086& cpu, int intNum, std::string& output,
 
         case 0x35: {
             // AH=35h — Get interrupt vector — stub: ES:BX = 0:0
-            cpu.sregs[S_ES] = 0;
+            cpu.setSreg(S_ES, 0);
             cpu.regs[R_BX] = 0;
             return true;
         }
@@ -261,7 +262,7 @@ bool handleDOSInt(CPU8086& cpu, int intNum, std::string& output,
 
         case 0x2F: {
             // AH=2Fh — Get DTA address → ES:BX
-            cpu.sregs[S_ES] = dos.dta_seg;
+            cpu.setSreg(S_ES, dos.dta_seg);
             cpu.regs[R_BX] = dos.dta_addr;
             return true;
         }
@@ -322,8 +323,10 @@ bool handleDOSInt(CPU8086& cpu, int intNum, std::string& output,
                 char c = dir[i];
                 if (c == '/') c = '\\';
                 cpu.memory[physAddr(ds, (uint16_t)(si + i))] = (uint8_t)c;
+                cpu.noteWrite(physAddr(ds, (uint16_t)(si + i)), 1);
             }
             cpu.memory[physAddr(ds, (uint16_t)(si + dir.size()))] = 0;
+            cpu.noteWrite(physAddr(ds, (uint16_t)(si + dir.size())), 1);
             clearCF(cpu);
             return true;
         }
@@ -388,6 +391,7 @@ bool handleDOSInt(CPU8086& cpu, int intNum, std::string& output,
                     Keystroke key;
                     if (!kbd->blockingRead(key)) break;
                     cpu.memory[physAddr(ds, (uint16_t)(dx + i))] = key.ascii;
+                    cpu.noteWrite(physAddr(ds, (uint16_t)(dx + i)), 1);
                     if (key.ascii == 0x0D) { i++; break; } // CR terminates
                 }
                 cpu.regs[R_AX] = i;
@@ -398,6 +402,7 @@ bool handleDOSInt(CPU8086& cpu, int intNum, std::string& output,
             if (bx >= 5 && bx < 20 && dos.handles[bx]) {
                 uint32_t phys = physAddr(cpu.sregs[S_DS], dx);
                 size_t n = fread(&cpu.memory[phys], 1, cx, dos.handles[bx]);
+                cpu.noteWrite(phys, (uint32_t)n);
                 cpu.regs[R_AX] = (uint16_t)n;
                 clearCF(cpu);
             } else {
@@ -0,0 +1,118 @@
+#include "cpu.h"
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// =====================================================================
+// Guest memory
+// =====================================================================
+//
+// Guest memory is a 2MB-aligned span of its own, apart from the CPU8086
+// that generated code addresses off RCX. The span is a memfd mapped shared,
+// with the MEMORY_WRAP bytes past MEMORY_SIZE mapped a second time onto the
+// pages of memory[0, 64K). Without memfd (or with --huge-pages) it is
+// private anonymous memory and those bytes are just padding; generated code
+// then masks every address to 20 bits.
+//
+// Windows has no equivalent of MAP_FIXED onto a file offset that isn't a
+// multiple of the 64K allocation granularity, and large pages need a
+// privilege: there the span is always plain committed memory.
+
+namespace {
+
+constexpr size_t PAGE = 4096;
+constexpr size_t SPAN = 2 * 1024 * 1024;  // one huge page
+
+static_assert(MEMORY_SIZE + MEMORY_WRAP <= SPAN, "guest memory must fit one huge page");
+static_assert(MEMORY_SIZE % PAGE == 0 && MEMORY_WRAP % PAGE == 0, "the wrap must be whole pages");
+
+} // namespace
+
+#ifdef _WIN32
+
+GuestMemory::GuestMemory() {
+    base_ = (uint8_t*)VirtualAlloc(nullptr, SPAN, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!base_) throw std::runtime_error("VirtualAlloc failed");
+    cpu_ = new CPU8086();
+    cpu_->memory = base_;  // fresh pages are zero
+}
+
+GuestMemory::~GuestMemory() {
+    delete cpu_;
+    if (base_) VirtualFree(base_, 0, MEM_RELEASE);
+}
+
+bool GuestMemory::mapWrapped() {
+    return false;
+}
+
+void GuestMemory::mapPrivate(bool) {
+}
+
+void GuestMemory::setHugePages(bool on) {
+    huge_ = on;
+}
+
+#else
+
+GuestMemory::GuestMemory() {
+    // Reserve twice the span and keep the aligned part
+    void* r = mmap(nullptr, 2 * SPAN, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (r == MAP_FAILED) throw std::runtime_error("mmap failed");
+    uintptr_t lo = (uintptr_t)r;
+    uintptr_t at = (lo + SPAN - 1) & ~(uintptr_t)(SPAN - 1);
+    if (at > lo) munmap(r, at - lo);
+    if (at + SPAN < lo + 2 * SPAN) munmap((void*)(at + SPAN), lo + 2 * SPAN - (at + SPAN));
+    base_ = (uint8_t*)at;
+    if (!mapWrapped()) mapPrivate(false);
+    cpu_ = new CPU8086();
+    cpu_->memory = base_;  // fresh pages are zero
+}
+
+GuestMemory::~GuestMemory() {
+    delete cpu_;
+    if (base_) munmap(base_, SPAN);
+}
+
+bool GuestMemory::mapWrapped() {
+    int fd = memfd_create("agent86-guest", MFD_CLOEXEC);
+    if (fd < 0) return false;
+    bool ok = ftruncate(fd, MEMORY_SIZE) == 0 &&
+              mmap(base_, MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED &&
+              mmap(base_ + MEMORY_SIZE, MEMORY_WRAP, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED;
+    close(fd);
+    wraps_ = ok;
+    return ok;
+}
+
+void GuestMemory::mapPrivate(bool huge) {
+    if (mmap(base_, SPAN, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+             -1, 0) == MAP_FAILED)
+        throw std::runtime_error("mmap failed");
+    if (huge) madvise(base_, SPAN, MADV_HUGEPAGE);
+    wraps_ = false;
+}
+
+void GuestMemory::setHugePages(bool on) {
+    if (on == huge_) return;
+    // The wrap mirrors memory[0, 64K) or is unused
+    std::vector<uint8_t> saved(base_, base_ + MEMORY_SIZE);
+    if (on) {
+        mapPrivate(true);
+    } else if (!mapWrapped()) {
+        mapPrivate(false);
+    }
+    huge_ = on;
+    memcpy(base_, saved.data(), MEMORY_SIZE);
+}
+
+#endif
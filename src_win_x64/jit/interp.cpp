@@ -0,0 +1,497 @@
+#include "jit.h"
+
+// =====================================================================
+// Interpreter tier
+// =====================================================================
+//
+// Cold blocks run here instead of being translated: each instruction is
+// decoded once into a ThreadedOp that carries its handler, and a block is
+// a straight run of handler calls. Blocks that keep being entered are
+// handed to compileBlock once their entry count reaches the threshold.
+//
+// Handlers follow the translator's semantics exactly (same address
+// arithmetic, same lazy_op records for flags), so a program behaves the
+// same whichever tier runs a given block.
+
+struct Interp {
+    // ---- Registers ----
+
+    static uint8_t reg8(const CPU8086& c, int r) {
+        return r < 4 ? (uint8_t)c.regs[r] : (uint8_t)(c.regs[r - 4] >> 8);
+    }
+    static void setReg8(CPU8086& c, int r, uint32_t v) {
+        if (r < 4) c.regs[r] = (uint16_t)((c.regs[r] & 0xFF00) | (v & 0xFF));
+        else       c.regs[r - 4] = (uint16_t)((c.regs[r - 4] & 0x00FF) | ((v & 0xFF) << 8));
+    }
+
+    // ---- Memory ----
+
+    static uint32_t segAddr(const CPU8086& c, int seg, uint16_t off) {
+        return ((uint32_t)c.sregs[seg] * 16 + off) & 0xFFFFF;
+    }
+    // Offset of a memory operand (no segment), as emitComputeEA builds it
+    static uint16_t offsetOf(const CPU8086& c, const OpdDesc& o) {
+        if (o.direct || (o.base < 0 && o.index < 0)) return (uint16_t)o.disp;
+        uint32_t off = o.base >= 0 ? c.regs[o.base] : 0;
+        if (o.index >= 0) off += c.regs[o.index];
+        if (o.has_disp) off += (uint32_t)(int32_t)o.disp;
+        return (uint16_t)off;
+    }
+    static uint32_t ea(const CPU8086& c, const DecodedInstr& in, const OpdDesc& o) {
+        int seg = in.seg_override != 0xFF ? in.seg_override
+                                          : (o.base == R_BP ? (int)S_SS : (int)S_DS);
+        return segAddr(c, seg, offsetOf(c, o));
+    }
+    static uint32_t read(const CPU8086& c, uint32_t phys, bool w) {
+        if (!w) return c.memory[phys];
+        return c.memory[phys] | (c.memory[(phys + 1) & 0xFFFFF] << 8);
+    }
+    // Store, then let the SMC machinery drop any block it lands on; a hit
+    // on the running block sets cpu.smc_exit and ends it after this op
+    static void write(JitEngine& e, uint32_t phys, uint32_t v, bool w) {
+        CPU8086& c = e.cpu_;
+        c.memory[phys] = (uint8_t)v;
+        if (w) c.memory[(phys + 1) & 0xFFFFF] = (uint8_t)(v >> 8);
+        if (c.code_pages[phys >> 8] || (w && c.code_pages[((phys + 1) & 0xFFFFF) >> 8]))
+            JitEngine::onCodeWrite(&e, phys, w ? 2 : 1, e.threaded_block_);
+    }
+
+    // ---- Operands ----
+
+    static uint32_t load(const CPU8086& c, const DecodedInstr& in, const OpdDesc& o, bool w) {
+        switch (o.kind) {
+        case OpdKind::REG16: return c.regs[o.reg];
+        case OpdKind::REG8:  return reg8(c, o.reg);
+        case OpdKind::SREG:  return c.sregs[o.reg];
+        case OpdKind::IMM8: case OpdKind::IMM16:
+            return w ? o.imm : (o.imm & 0xFF);
+        case OpdKind::MEM:   return read(c, ea(c, in, o), w);
+        default:             return 0;
+        }
+    }
+    static void store(JitEngine& e, const DecodedInstr& in, const OpdDesc& o, uint32_t v, bool w) {
+        CPU8086& c = e.cpu_;
+        switch (o.kind) {
+        case OpdKind::REG16: c.regs[o.reg] = (uint16_t)v; break;
+        case OpdKind::REG8:  setReg8(c, o.reg, v); break;
+        case OpdKind::SREG:  c.setSreg(o.reg, (uint16_t)v); break;
+        case OpdKind::MEM:   write(e, ea(c, in, o), v, w); break;
+        default: break;
+        }
+    }
+
+    static void push(JitEngine& e, uint32_t v) {
+        CPU8086& c = e.cpu_;
+        c.regs[R_SP] -= 2;
+        write(e, segAddr(c, S_SS, c.regs[R_SP]), v, true);
+    }
+    static uint16_t pop(CPU8086& c) {
+        uint16_t v = (uint16_t)read(c, segAddr(c, S_SS, c.regs[R_SP]), true);
+        c.regs[R_SP] += 2;
+        return v;
+    }
+
+    // ---- Flags ----
+
+    static void setLazy(CPU8086& c, uint32_t op, bool w, uint32_t dst, uint32_t src) {
+        c.lazy_op = op | (w ? (uint32_t)LAZY_WORD : 0);
+        c.lazy_dst = dst;
+        c.lazy_src = src;
+    }
+    static bool cond(uint16_t f, OpType op) {
+        bool cf = f & F_CF, zf = f & F_ZF, sf = f & F_SF, of = f & F_OF, pf = f & F_PF;
+        switch (op) {
+        case OpType::JO:   return of;
+        case OpType::JNO:  return !of;
+        case OpType::JB:   return cf;
+        case OpType::JNB:  return !cf;
+        case OpType::JZ:   return zf;
+        case OpType::JNZ:  return !zf;
+        case OpType::JBE:  return cf || zf;
+        case OpType::JNBE: return !cf && !zf;
+        case OpType::JSS:  return sf;
+        case OpType::JNS:  return !sf;
+        case OpType::JP:   return pf;
+        case OpType::JNP:  return !pf;
+        case OpType::JL:   return sf != of;
+        case OpType::JNL:  return sf == of;
+        case OpType::JLE:  return zf || sf != of;
+        default:           return !zf && sf == of;  // JNLE
+        }
+    }
+    // SI/DI step of a string op, by DF
+    static uint16_t step(const CPU8086& c, bool w) {
+        uint16_t n = w ? 2 : 1;
+        return (c.flags & F_DF) ? (uint16_t)-n : n;
+    }
+
+    // ---- Handlers ----
+    // Each returns false when control leaves the block (cpu.ip set)
+
+    static bool mov(JitEngine& e, const ThreadedOp& op) {
+        const DecodedInstr& in = op.instr;
+        store(e, in, in.dst, load(e.cpu_, in, in.src, in.is_word), in.is_word);
+        return true;
+    }
+
+    static bool alu(JitEngine& e, const ThreadedOp& op) {
+        CPU8086& c = e.cpu_;
+        const DecodedInstr& in = op.instr;
+        bool w = in.is_word;
+        uint32_t mask = w ? 0xFFFF : 0xFF;
+        uint32_t cin = 0;
+        if (in.op == OpType::ADC || in.op == OpType::SBB) {
+            e.syncFlags();
+            cin = c.flags & F_CF;
+            c.lazy_cin = cin;
+        }
+        uint32_t d = load(c, in, in.dst, w), s = load(c, in, in.src, w);
+        uint32_t r, lop;
+        switch (in.op) {
+        case OpType::ADD: r = d + s;       lop = LAZY_ADD; break;
+        case OpType::ADC: r = d + s + cin; lop = LAZY_ADC; break;
+        case OpType::SBB: r = d - s - cin; lop = LAZY_SBB; break;
+        case OpType::AND: r = d & s;       lop = LAZY_AND; break;
+        case OpType::OR:  r = d | s;       lop = LAZY_OR;  break;
+        case OpType::XOR: r = d ^ s;       lop = LAZY_XOR; break;
+        default:          r = d - s;       lop = LAZY_SUB; break;  // SUB, CMP
+        }
+        setLazy(c, lop, w, d, s);
+        if (in.op != OpType::CMP) store(e, in, in.dst, r & mask, w);
+        return true;
+    }
+
+    static bool test(JitEngine& e, const ThreadedOp& op) {
+        CPU8086& c = e.cpu_;
+        const DecodedInstr& in = op.instr;
+        setLazy(c, LAZY_AND, in.is_word, load(c, in, in.dst, in.is_word),
+                load(c, in, in.src, in.is_word));
+        return true;
+    }
+
+    // INC/DEC keep CF, so it has to be in cpu.flags before lazy_op moves on
+    static bool incDec(JitEngine& e, const ThreadedOp& op) {
+        CPU8086& c = e.cpu_;
+        const DecodedInstr& in = op.instr;
+        e.syncFlags();
+        uint32_t d = load(c, in, in.dst, in.is_word);
+        bool inc = in.op == OpType::INC;
+        setLazy(c, inc ? LAZY_INC : LAZY_DEC, in.is_word, d, c.lazy_src);
+        store(e, in, in.dst, inc ? d + 1 : d - 1, in.is_word);
+        return true;
+    }
+
+    static bool neg(JitEngine& e, const ThreadedOp& op) {
+        CPU8086& c = e.cpu_;
+        const DecodedInstr& in = op.instr;
+        uint32_t d = load(c, in, in.dst, in.is_word);
+        setLazy(c, LAZY_NEG, in.is_word, d, c.lazy_src);
+        store(e, in, in.dst, 0u - d, in.is_word);
+        return true;
+    }
+
+    static bool not_(JitEngine& e, const ThreadedOp& op) {
+        const DecodedInstr& in = op.instr;
+        store(e, in, in.dst, ~load(e.cpu_, in, in.dst, in.is_word), in.is_word);
+        return true;
+    }
+
+    static bool xchg(JitEngine& e, const ThreadedOp& op) {
+        CPU8086& c = e.cpu_;
+        const DecodedInstr& in = op.instr;
+        uint32_t a = load(c, in, in.dst, in.is_word), b = load(c, in, in.src, in.is_word);
+        store(e, in, in.dst, b, in.is_word);
+        store(e, in, in.src, a, in.is_word);
+        return true;
+    }
+
+    static bool lea(JitEngine& e, const ThreadedOp& op) {
+        e.cpu_.regs[op.instr.dst.reg] = offsetOf(e.cpu_, op.instr.src);
+        return true;
+    }
+
+    static bool push_(JitEngine& e, const ThreadedOp& op) {
+        push(e, load(e.cpu_, op.instr, op.instr.dst, true));
+        return true;
+    }
+
+    static bool pop_(JitEngine& e, const ThreadedOp& op) {
+        uint16_t v = pop(e.cpu_);
+        store(e, op.instr, op.instr.dst, v, true);
+        return true;
+    }
+
+    static bool pushf(JitEngine& e, const ThreadedOp&) {
+        e.syncFlags();
+        push(e, e.cpu_.flags);
+        return true;
+    }
+
+    static bool popf(JitEngine& e, const ThreadedOp&) {
+        CPU8086& c = e.cpu_;
+        c.flags = pop(c);
+        c.lazy_op = LAZY_NONE;
+        return true;
+    }
+
+    static bool jmp(JitEngine& e, const ThreadedOp& op) {
+        CPU8086& c = e.cpu_;
+        const DecodedInstr& in = op.instr;
+        switch (in.dst.kind) {
+        case OpdKind::REL8: case OpdKind::REL16:
+            c.ip = (uint16_t)(op.next_ip + in.dst.rel); break;
+        case OpdKind::REG16:
+            c.ip = c.regs[in.dst.reg]; break;
+        default:  // MEM
+            c.ip = (uint16_t)read(c, ea(c, in, in.dst), true); break;
+        }
+        return false;
+    }
+
+    static bool jcc(JitEngine& e, const ThreadedOp& op) {
+        e.syncFlags();
+        if (cond(e.cpu_.flags, op.instr.op))
+            e.cpu_.ip = (uint16_t)(op.next_ip + op.instr.dst.rel);
+        return false;
+    }
+
+    static bool call(JitEngine& e, const ThreadedOp& op) {
+        CPU8086& c = e.cpu_;
+        const DecodedInstr& in = op.instr;
+        uint16_t target;
+        switch (in.dst.kind) {
+        case OpdKind::REL16: target = (uint16_t)(op.next_ip + in.dst.rel); break;
+        case OpdKind::REG16: target = c.regs[in.dst.reg]; break;
+        default:             target = (uint16_t)read(c, ea(c, in, in.dst), true); break;
+        }
+        push(e, op.next_ip);
+        c.ip = target;
+        return false;
+    }
+
+    static bool ret(JitEngine& e, const ThreadedOp& op) {
+        CPU8086& c = e.cpu_;
+        c.ip = pop(c);
+        if (op.instr.dst.kind == OpdKind::IMM16) c.regs[R_SP] += op.instr.dst.imm;
+        return false;
+    }
+
+    static bool loop(JitEngine& e, const ThreadedOp& op) {
+        CPU8086& c = e.cpu_;
+        OpType o = op.instr.op;
+        bool taken;
+        if (o == OpType::JCXZ) {
+            taken = c.regs[R_CX] == 0;
+        } else {
+            if (o != OpType::LOOP) e.syncFlags();
+            taken = --c.regs[R_CX] != 0;
+            if (o == OpType::LOOPE)  taken = taken && (c.flags & F_ZF);
+            if (o == OpType::LOOPNE) taken = taken && !(c.flags & F_ZF);
+        }
+        if (taken) c.ip = (uint16_t)(op.next_ip + op.instr.dst.rel);
+        return false;
+    }
+
+    // INT 10h/16h/21h run in place, as in translated blocks; any other INT
+    // ends the block and goes through the dispatcher
+    static bool int_(JitEngine& e, const ThreadedOp& op) {
+        CPU8086& c = e.cpu_;
+        uint8_t num = (uint8_t)op.instr.dst.imm;
+        if (num != 0x10 && num != 0x16 && num != 0x21) {
+            c.pending_int = num;
+            return false;
+        }
+        e.syncFlags();
+        JitEngine::onServiceInt(&e, num, e.threaded_block_);
+        return true;  // onServiceInt sets smc_exit if the block can't go on
+    }
+
+    static bool hlt(JitEngine& e, const ThreadedOp&) {
+        e.cpu_.halted = true;
+        return false;
+    }
+
+    static bool movs(JitEngine& e, const ThreadedOp& op) {
+        CPU8086& c = e.cpu_;
+        const DecodedInstr& in = op.instr;
+        bool w = in.op == OpType::MOVSW;
+        int seg = in.seg_override != 0xFF ? in.seg_override : (int)S_DS;
+        uint32_t v = read(c, segAddr(c, seg, c.regs[R_SI]), w);
+        write(e, segAddr(c, S_ES, c.regs[R_DI]), v, w);
+        c.regs[R_SI] += step(c, w);
+        c.regs[R_DI] += step(c, w);
+        return true;
+    }
+
+    static bool stos(JitEngine& e, const ThreadedOp& op) {
+        CPU8086& c = e.cpu_;
+        bool w = op.instr.op == OpType::STOSW;
+        write(e, segAddr(c, S_ES, c.regs[R_DI]), w ? c.regs[R_AX] : reg8(c, 0), w);
+        c.regs[R_DI] += step(c, w);
+        return true;
+    }
+
+    static bool lods(JitEngine& e, const ThreadedOp& op) {
+        CPU8086& c = e.cpu_;
+        const DecodedInstr& in = op.instr;
+        bool w = in.op == OpType::LODSW;
+        int seg = in.seg_override != 0xFF ? in.seg_override : (int)S_DS;
+        uint32_t v = read(c, segAddr(c, seg, c.regs[R_SI]), w);
+        if (w) c.regs[R_AX] = (uint16_t)v;
+        else   setReg8(c, 0, v);
+        c.regs[R_SI] += step(c, w);
+        return true;
+    }
+
+    static bool cmps(JitEngine& e, const ThreadedOp& op) {
+        CPU8086& c = e.cpu_;
+        const DecodedInstr& in = op.instr;
+        bool w = in.op == OpType::CMPSW;
+        int seg = in.seg_override != 0xFF ? in.seg_override : (int)S_DS;
+        setLazy(c, LAZY_SUB, w, read(c, segAddr(c, seg, c.regs[R_SI]), w),
+                read(c, segAddr(c, S_ES, c.regs[R_DI]), w));
+        c.regs[R_SI] += step(c, w);
+        c.regs[R_DI] += step(c, w);
+        return true;
+    }
+
+    static bool scas(JitEngine& e, const ThreadedOp& op) {
+        CPU8086& c = e.cpu_;
+        bool w = op.instr.op == OpType::SCASW;
+        setLazy(c, LAZY_SUB, w, w ? c.regs[R_AX] : reg8(c, 0),
+                read(c, segAddr(c, S_ES, c.regs[R_DI]), w));
+        c.regs[R_DI] += step(c, w);
+        return true;
+    }
+
+    static bool flagOp(JitEngine& e, const ThreadedOp& op) {
+        CPU8086& c = e.cpu_;
+        switch (op.instr.op) {
+        case OpType::CLD: c.flags &= ~F_DF; return true;  // DF isn't lazy
+        case OpType::STD: c.flags |= F_DF;  return true;
+        default: break;
+        }
+        e.syncFlags();
+        switch (op.instr.op) {
+        case OpType::CLC:  c.flags &= ~F_CF; break;
+        case OpType::STC:  c.flags |= F_CF;  break;
+        case OpType::CMC:  c.flags ^= F_CF;  break;
+        case OpType::CLI:  c.flags &= ~F_IF; break;
+        case OpType::STI:  c.flags |= F_IF;  break;
+        case OpType::LAHF: setReg8(c, 4, c.flags); break;
+        default:           c.flags = (uint16_t)((c.flags & 0xFF00) | reg8(c, 4)); break;  // SAHF
+        }
+        return true;
+    }
+
+    static bool cbw(JitEngine& e, const ThreadedOp&) {
+        CPU8086& c = e.cpu_;
+        c.regs[R_AX] = (uint16_t)(int16_t)(int8_t)c.regs[R_AX];
+        return true;
+    }
+
+    static bool cwd(JitEngine& e, const ThreadedOp&) {
+        CPU8086& c = e.cpu_;
+        c.regs[R_DX] = (c.regs[R_AX] & 0x8000) ? 0xFFFF : 0;
+        return true;
+    }
+
+    static bool xlat(JitEngine& e, const ThreadedOp& op) {
+        CPU8086& c = e.cpu_;
+        int seg = op.instr.seg_override != 0xFF ? op.instr.seg_override : (int)S_DS;
+        setReg8(c, 0, c.memory[segAddr(c, seg, (uint16_t)(c.regs[R_BX] + reg8(c, 0)))]);
+        return true;
+    }
+
+    static bool nop(JitEngine&, const ThreadedOp&) { return true; }
+
+    // Handler for an instruction, or nullptr if only the translator runs it
+    static ThreadedFn handlerFor(const DecodedInstr& in) {
+        if (in.has_rep) return nullptr;
+        switch (in.op) {
+        case OpType::MOV:  return mov;
+        case OpType::ADD: case OpType::ADC: case OpType::SUB: case OpType::SBB:
+        case OpType::AND: case OpType::OR:  case OpType::XOR: case OpType::CMP:
+            return alu;
+        case OpType::TEST: return test;
+        case OpType::INC: case OpType::DEC: return incDec;
+        case OpType::NEG:  return neg;
+        case OpType::NOT:  return not_;
+        case OpType::XCHG: return xchg;
+        case OpType::LEA:  return lea;
+        case OpType::PUSH: return push_;
+        case OpType::POP:  return pop_;
+        case OpType::PUSHF: return pushf;
+        case OpType::POPF: return popf;
+        case OpType::JMP:
+            return in.dst.kind == OpdKind::FAR_PTR ? nullptr : jmp;
+        case OpType::CALL:
+            return (in.dst.kind == OpdKind::REL16 || in.dst.kind == OpdKind::REG16 ||
+                    in.dst.kind == OpdKind::MEM) ? call : nullptr;
+        case OpType::RET:  return ret;
+        case OpType::LOOP: case OpType::LOOPE: case OpType::LOOPNE: case OpType::JCXZ:
+            return loop;
+        case OpType::INT:  return int_;
+        case OpType::HLT:  return hlt;
+        case OpType::MOVSB: case OpType::MOVSW: return movs;
+        case OpType::STOSB: case OpType::STOSW: return stos;
+        case OpType::LODSB: case OpType::LODSW: return lods;
+        case OpType::CMPSB: case OpType::CMPSW: return cmps;
+        case OpType::SCASB: case OpType::SCASW: return scas;
+        case OpType::CLC: case OpType::STC: case OpType::CMC: case OpType::CLD:
+        case OpType::STD: case OpType::CLI: case OpType::STI:
+        case OpType::LAHF: case OpType::SAHF:
+            return flagOp;
+        case OpType::CBW:  return cbw;
+        case OpType::CWD:  return cwd;
+        case OpType::XLAT: return xlat;
+        case OpType::NOP: case OpType::WAIT: return nop;
+        default:
+            if (in.op >= OpType::JO && in.op <= OpType::JNLE) return jcc;
+            return nullptr;
+        }
+    }
+};
+
+JitBlock* JitEngine::buildThreaded(uint16_t ip) {
+    std::vector<DecodedInstr> instrs = decodeBlock(ip, MAX_BLOCK_INSTRS);
+    if (instrs.empty()) return nullptr;
+
+    // The block ends before the first instruction the interpreter doesn't
+    // handle; that one starts a translated block of its own
+    auto blk = std::make_unique<JitBlock>();
+    uint16_t cur = ip;
+    for (const DecodedInstr& instr : instrs) {
+        ThreadedFn fn = Interp::handlerFor(instr);
+        if (!fn) break;
+        cur += instr.len;
+        blk->ops.push_back({fn, instr, cur});
+    }
+    if (blk->ops.empty()) return nullptr;
+
+    blk->ip = ip;
+    blk->len = (uint16_t)(cur - ip);
+    blk->instr_count = (uint32_t)blk->ops.size();
+    blk->code_off = 0;
+    blk->is_threaded = true;
+
+    JitBlock* raw = blk.get();
+    blocks_.push_back(std::move(blk));
+    block_map_[ip] = raw;
+    markCodePages(raw);  // stores into it invalidate it like translated code
+    return raw;
+}
+
+void JitEngine::runThreaded(JitBlock* blk) {
+    blk->hits++;
+    threaded_block_ = blk;
+    // Handlers may invalidate blk (SMC); its ops stay alive until the next
+    // flush, which only compileBlock does
+    for (const ThreadedOp& op : blk->ops) {
+        cpu_.instr_count++;
+        cpu_.ip = op.next_ip;
+        if (!op.fn(*this, op) || cpu_.smc_exit) break;
+    }
+    cpu_.smc_exit = 0;
+    threaded_block_ = nullptr;
+}
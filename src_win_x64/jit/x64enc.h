@@ -0,0 +1,404 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Typed x64 instruction encoder. Each builder returns the complete encoding
+// of one instruction (prefixes, REX, opcode, ModR/M, SIB, displacement,
+// immediate) so emitters don't hand-assemble those bytes. Displacements use
+// the shortest form that fits; REX is only added when an operand needs it.
+// Builders also record the instruction's register effects, which the JIT's
+// peephole pass uses to drop redundant instructions.
+
+// x64 register encoding constants
+enum X64 : uint8_t {
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3,
+    RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+    R8 = 8, R9 = 9, R10 = 10, R11 = 11,
+    R12 = 12, R13 = 13, R14 = 14, R15 = 15
+};
+
+// REX prefix bits
+static constexpr uint8_t REX_W = 0x48;  // 64-bit operand
+static constexpr uint8_t REX_R = 0x44;  // ext MODRM.reg
+static constexpr uint8_t REX_B = 0x41;  // ext MODRM.rm or SIB.base
+
+// One encoded instruction (x64 caps instructions at 15 bytes)
+struct X64Insn {
+    // What a write leaves in bits 16-63 of the destination register
+    enum Zext : uint8_t {
+        ZX_LOST,  // unknown
+        ZX_SET,   // zero: the value is zero-extended from 16 bits
+        ZX_KEEP,  // unchanged (8/16-bit writes)
+        ZX_COPY   // same as in src
+    };
+
+    uint8_t bytes[15] = {};
+    uint8_t len = 0;
+    int8_t  dst = -1;         // host register written, -1 for none
+    int8_t  src = -1;         // register the result is a copy of, -1 for none
+    Zext    zext = ZX_LOST;
+    uint16_t clobber = 0;     // other registers left unknown (a call's)
+
+    constexpr X64Insn& put(uint8_t b) { bytes[len++] = b; return *this; }
+    constexpr X64Insn& put32(uint32_t d) {
+        for (int i = 0; i < 4; i++) put((uint8_t)(d >> (8 * i)));
+        return *this;
+    }
+    constexpr X64Insn& put64(uint64_t q) {
+        return put32((uint32_t)q).put32((uint32_t)(q >> 32));
+    }
+};
+
+// Memory operand [base + index + disp] (index < 0 for none, scale 1)
+struct X64Mem {
+    int8_t base;
+    int8_t index;
+    int32_t disp;
+};
+
+namespace x64 {
+
+enum Size : uint8_t { B8, W16, D32, Q64 };
+
+// Group-1 ALU operations (the /digit of 80/81/83, and opcode bits 5:3)
+enum Alu : uint8_t { ADD = 0, OR = 1, ADC = 2, SBB = 3, AND = 4, SUB = 5, XOR = 6, CMP = 7 };
+
+// Group-2 shift/rotate operations (the /digit of C1)
+enum Shift : uint8_t { ROL = 0, ROR = 1, RCL = 2, RCR = 3, SHL = 4, SHR = 5, SAR = 7 };
+
+// Condition codes (the low nibble of Jcc/SETcc)
+enum Cond : uint8_t {
+    CC_O, CC_NO, CC_B, CC_AE, CC_E, CC_NE, CC_BE, CC_A,
+    CC_S, CC_NS, CC_P, CC_NP, CC_L, CC_GE, CC_LE, CC_G
+};
+
+constexpr X64Mem mem(int base, int32_t disp) { return { (int8_t)base, -1, disp }; }
+constexpr X64Mem mem(int base, int index, int32_t disp) {
+    return { (int8_t)base, (int8_t)index, disp };
+}
+
+namespace detail {
+
+constexpr bool fits8(int32_t v) { return v >= -128 && v <= 127; }
+
+// Operand-size prefix and REX. For byte registers, encodings 4-7 mean
+// SPL/BPL/SIL/DIL only with a REX present, so one is forced for them.
+constexpr bool lowByteNeedsRex(int r) { return r >= 4 && r < 8; }
+
+constexpr void prefix(X64Insn& i, Size sz, int reg, int rm, int index,
+                      bool byte_reg, bool byte_rm) {
+    if (sz == W16) i.put(0x66);
+    uint8_t rex = 0x40;
+    if (sz == Q64) rex |= 0x08;
+    if (reg >= 8) rex |= 0x04;
+    if (index >= 8) rex |= 0x02;
+    if (rm >= 8) rex |= 0x01;
+    bool force = (byte_reg && lowByteNeedsRex(reg)) || (byte_rm && lowByteNeedsRex(rm));
+    if (rex != 0x40 || force) i.put(rex);
+}
+
+// ModR/M (+SIB, +disp) for a memory operand
+constexpr void modrm(X64Insn& i, int reg, X64Mem m) {
+    int base = m.base & 7;
+    bool sib = m.index >= 0 || base == RSP;
+    // [rbp]/[r13] have no mod=00 form; they take a zero disp8
+    uint8_t mod = (m.disp == 0 && base != RBP) ? 0x00 : fits8(m.disp) ? 0x40 : 0x80;
+    i.put(mod | ((reg & 7) << 3) | (sib ? 4 : base));
+    if (sib) i.put(((m.index >= 0 ? m.index & 7 : 4) << 3) | base);
+    if (mod == 0x40) i.put((uint8_t)(int8_t)m.disp);
+    else if (mod == 0x80) i.put32((uint32_t)m.disp);
+}
+
+constexpr X64Insn memOp(Size sz, uint8_t op0, int op1, int reg, X64Mem m) {
+    X64Insn i;
+    prefix(i, sz, reg, m.base, m.index, sz == B8, false);
+    i.put(op0);
+    if (op1 >= 0) i.put((uint8_t)op1);
+    modrm(i, reg, m);
+    return i;
+}
+
+// A write to register dst
+constexpr X64Insn writes(X64Insn i, int dst, X64Insn::Zext zext, int src = -1) {
+    i.dst = (int8_t)dst;
+    i.zext = zext;
+    i.src = (int8_t)src;
+    return i;
+}
+
+// What a write of the given size leaves above bit 15
+constexpr X64Insn::Zext sized(Size sz) {
+    return sz == B8 || sz == W16 ? X64Insn::ZX_KEEP : X64Insn::ZX_LOST;
+}
+
+constexpr X64Insn regOp(Size sz, uint8_t op0, int op1, int reg, int rm,
+                        bool byte_reg, bool byte_rm) {
+    X64Insn i;
+    prefix(i, sz, reg, rm, -1, byte_reg, byte_rm);
+    i.put(op0);
+    if (op1 >= 0) i.put((uint8_t)op1);
+    i.put(0xC0 | ((reg & 7) << 3) | (rm & 7));
+    return i;
+}
+
+} // namespace detail
+
+// movzx r32, word/byte [m]
+constexpr X64Insn movzx16(int reg, X64Mem m) {
+    return detail::writes(detail::memOp(D32, 0x0F, 0xB7, reg, m), reg, X64Insn::ZX_SET);
+}
+constexpr X64Insn movzx8(int reg, X64Mem m) {
+    return detail::writes(detail::memOp(D32, 0x0F, 0xB6, reg, m), reg, X64Insn::ZX_SET);
+}
+
+// movzx r32, r16 / r8
+constexpr X64Insn movzx16(int reg, int rm) {
+    return detail::writes(detail::regOp(D32, 0x0F, 0xB7, reg, rm, false, false),
+                          reg, X64Insn::ZX_SET, rm);
+}
+constexpr X64Insn movzx8(int reg, int rm) {
+    return detail::writes(detail::regOp(D32, 0x0F, 0xB6, reg, rm, false, true),
+                          reg, X64Insn::ZX_SET);
+}
+
+// mov [m], r (store) / mov r, [m] (load)
+constexpr X64Insn mov(Size sz, X64Mem m, int reg) {
+    return detail::memOp(sz, sz == B8 ? 0x88 : 0x89, -1, reg, m);
+}
+constexpr X64Insn mov(Size sz, int reg, X64Mem m) {
+    return detail::writes(detail::memOp(sz, sz == B8 ? 0x8A : 0x8B, -1, reg, m),
+                          reg, detail::sized(sz));
+}
+
+// mov dst, src
+constexpr X64Insn mov(Size sz, int dst, int src) {
+    if (sz == B8)
+        return detail::writes(detail::regOp(sz, 0x88, -1, src, dst, true, true),
+                              dst, X64Insn::ZX_KEEP);
+    return detail::writes(detail::regOp(sz, 0x8B, -1, dst, src, false, false), dst,
+                          sz == W16 ? X64Insn::ZX_KEEP : X64Insn::ZX_COPY,
+                          sz == W16 ? -1 : src);
+}
+
+// mov r32, imm32 (zero-extends into the full register)
+constexpr X64Insn movImm32(int reg, uint32_t imm) {
+    X64Insn i;
+    if (reg >= 8) i.put(REX_B);
+    i.put(0xB8 | (reg & 7)).put32(imm);
+    return detail::writes(i, reg, imm <= 0xFFFF ? X64Insn::ZX_SET : X64Insn::ZX_LOST);
+}
+
+// mov r64, imm64
+constexpr X64Insn movImm64(int reg, uint64_t imm) {
+    X64Insn i;
+    i.put(REX_W | (reg >= 8 ? 0x01 : 0)).put(0xB8 | (reg & 7)).put64(imm);
+    return detail::writes(i, reg, X64Insn::ZX_LOST);
+}
+
+// mov byte/word/dword [m], imm
+constexpr X64Insn movImm(Size sz, X64Mem m, uint32_t imm) {
+    X64Insn i = detail::memOp(sz, sz == B8 ? 0xC6 : 0xC7, -1, 0, m);
+    if (sz == B8) i.put((uint8_t)imm);
+    else if (sz == W16) i.put((uint8_t)imm).put((uint8_t)(imm >> 8));
+    else i.put32(imm);
+    return i;
+}
+
+// op r, imm — B8 takes an imm8 (short AL form for RAX); wider sizes a
+// sign-extended imm8 when it fits, else the short AX/EAX form or a
+// full-size immediate
+constexpr X64Insn aluImm(Alu op, Size sz, int reg, int32_t imm) {
+    X64Insn i;
+    detail::prefix(i, sz, -1, reg, -1, false, sz == B8);
+    if (sz == B8) {
+        if (reg == RAX) i.put((op << 3) | 0x04);
+        else i.put(0x80).put(0xC0 | (op << 3) | (reg & 7));
+        i.put((uint8_t)imm);
+    } else if (detail::fits8(imm)) {
+        i.put(0x83).put(0xC0 | (op << 3) | (reg & 7)).put((uint8_t)(int8_t)imm);
+    } else {
+        if (reg == RAX) i.put((op << 3) | 0x05);
+        else i.put(0x81).put(0xC0 | (op << 3) | (reg & 7));
+        if (sz == W16) i.put((uint8_t)imm).put((uint8_t)(imm >> 8));
+        else i.put32((uint32_t)imm);
+    }
+    if (op == CMP) return i;
+    bool masked = op == AND && (sz == D32 || sz == Q64) && imm >= 0 && imm <= 0xFFFF;
+    return detail::writes(i, reg, masked ? X64Insn::ZX_SET : detail::sized(sz));
+}
+
+// op [m], imm — the same immediate forms as aluImm, without the AL/AX/EAX
+// short form
+constexpr X64Insn aluImm(Alu op, Size sz, X64Mem m, int32_t imm) {
+    X64Insn i;
+    detail::prefix(i, sz, -1, m.base, m.index, false, false);
+    bool imm8 = sz == B8 || detail::fits8(imm);
+    i.put(sz == B8 ? 0x80 : imm8 ? 0x83 : 0x81);
+    detail::modrm(i, op, m);
+    if (imm8) i.put((uint8_t)imm);
+    else if (sz == W16) i.put((uint8_t)imm).put((uint8_t)(imm >> 8));
+    else i.put32((uint32_t)imm);
+    return i;
+}
+
+// op dst, src
+constexpr X64Insn alu(Alu op, Size sz, int dst, int src) {
+    bool b = sz == B8;
+    X64Insn i = detail::regOp(sz, (op << 3) | (b ? 0x00 : 0x01), -1, src, dst, b, b);
+    if (op == CMP) return i;
+    return detail::writes(i, dst, detail::sized(sz));
+}
+
+// op r, [m]
+constexpr X64Insn alu(Alu op, Size sz, int reg, X64Mem m) {
+    X64Insn i = detail::memOp(sz, (op << 3) | (sz == B8 ? 0x02 : 0x03), -1, reg, m);
+    if (op == CMP) return i;
+    return detail::writes(i, reg, detail::sized(sz));
+}
+
+// shift/rotate r, imm8
+constexpr X64Insn shift(Shift op, Size sz, int reg, uint8_t count) {
+    X64Insn i;
+    detail::prefix(i, sz, -1, reg, -1, false, sz == B8);
+    i.put(sz == B8 ? 0xC0 : 0xC1).put(0xC0 | (op << 3) | (reg & 7)).put(count);
+    return detail::writes(i, reg, op == SHR ? X64Insn::ZX_KEEP : detail::sized(sz));
+}
+
+// setcc r8
+constexpr X64Insn setcc(Cond cc, int reg) {
+    X64Insn i;
+    detail::prefix(i, B8, -1, reg, -1, false, true);
+    i.put(0x0F).put(0x90 | cc).put(0xC0 | (reg & 7));
+    return detail::writes(i, reg, X64Insn::ZX_KEEP);
+}
+
+// lahf (AH = SF:ZF:0:AF:0:PF:1:CF) / sahf (the reverse)
+constexpr X64Insn lahf() {
+    X64Insn i;
+    return detail::writes(i.put(0x9F), RAX, X64Insn::ZX_KEEP);
+}
+constexpr X64Insn sahf() {
+    X64Insn i;
+    return i.put(0x9E);
+}
+
+// pushfq / popfq
+constexpr X64Insn pushfq() {
+    X64Insn i;
+    return i.put(0x9C);
+}
+constexpr X64Insn popfq() {
+    X64Insn i;
+    return i.put(0x9D);
+}
+
+// lea r, [m]
+constexpr X64Insn lea(Size sz, int reg, X64Mem m) {
+    return detail::writes(detail::memOp(sz, 0x8D, -1, reg, m), reg, X64Insn::ZX_LOST);
+}
+
+// bt dword [m], r — CF = the bit at [m] indexed by r
+constexpr X64Insn bt(X64Mem m, int reg) {
+    return detail::memOp(D32, 0x0F, 0xA3, reg, m);
+}
+
+// push r64 / pop r64
+constexpr X64Insn push(int reg) {
+    X64Insn i;
+    if (reg >= 8) i.put(REX_B);
+    return i.put(0x50 | (reg & 7));
+}
+constexpr X64Insn pop(int reg) {
+    X64Insn i;
+    if (reg >= 8) i.put(REX_B);
+    i.put(0x58 | (reg & 7));
+    return detail::writes(i, reg, X64Insn::ZX_LOST);
+}
+
+// call r64. The callee may leave any register changed as far as the
+// peephole pass knows; the ABI's callee-saved ones are the caller's job.
+constexpr X64Insn call(int reg) {
+    X64Insn i;
+    if (reg >= 8) i.put(REX_B);
+    i.put(0xFF).put(0xD0 | (reg & 7));
+    i.clobber = 0xFFFF;
+    return i;
+}
+
+constexpr X64Insn ret() {
+    X64Insn i;
+    return i.put(0xC3);
+}
+
+// Encoding checks
+namespace detail {
+template <size_t N>
+constexpr bool encodes(const X64Insn& i, const uint8_t (&b)[N]) {
+    if (i.len != N) return false;
+    for (size_t k = 0; k < N; k++) if (i.bytes[k] != b[k]) return false;
+    return true;
+}
+constexpr uint8_t kMovzxGuest[] = { 0x41, 0x0F, 0xB7, 0x1C, 0x04 };
+constexpr uint8_t kStoreR10w[] = { 0x66, 0x45, 0x89, 0x14, 0x04 };
+constexpr uint8_t kStoreDlGuest[] = { 0x41, 0x88, 0x14, 0x04 };
+constexpr uint8_t kMovzxR13[] = { 0x45, 0x0F, 0xB7, 0x6D, 0x00 };
+constexpr uint8_t kStoreSil[] = { 0x40, 0x88, 0x30 };
+constexpr uint8_t kAndEax[] = { 0x25, 0xFF, 0xFF, 0x0F, 0x00 };
+constexpr uint8_t kRspDisp[] = { 0x8B, 0x44, 0x24, 0x08 };
+constexpr uint8_t kSubDx[] = { 0x66, 0x83, 0xEA, 0x02 };
+constexpr uint8_t kAddSegBase[] = { 0x03, 0x41, 0x24 };
+constexpr uint8_t kAndAl[] = { 0x24, 0x0F };
+constexpr uint8_t kCmpSil[] = { 0x40, 0x80, 0xFE, 0x01 };
+constexpr uint8_t kAddEsi[] = { 0x83, 0xC6, 0x01 };
+constexpr uint8_t kCmpCodePage[] = { 0x80, 0x7C, 0x11, 0x68, 0x00 };
+constexpr uint8_t kCmpSregs[] = { 0x48, 0x83, 0x79, 0x10, 0x00 };
+constexpr uint8_t kPushR12[] = { 0x41, 0x54 };
+constexpr uint8_t kMovR9Imm64[] = { 0x49, 0xB9, 1, 0, 0, 0, 0, 0, 0, 0x80 };
+constexpr uint8_t kSetoAl[] = { 0x0F, 0x90, 0xC0 };
+constexpr uint8_t kSetoSil[] = { 0x40, 0x0F, 0x90, 0xC6 };
+constexpr uint8_t kSetcR10b[] = { 0x41, 0x0F, 0x92, 0xC2 };
+constexpr uint8_t kRolAx[] = { 0x66, 0xC1, 0xC0, 0x08 };
+} // namespace detail
+// Guest memory is [r12 + rax]: R12 as a SIB base needs REX.B and, unlike
+// R13, no displacement
+static_assert(detail::encodes(movzx16(RBX, mem(R12, RAX, 0)), detail::kMovzxGuest),
+              "movzx ebx, word [r12+rax]");
+static_assert(detail::encodes(mov(W16, mem(R12, RAX, 0), R10), detail::kStoreR10w),
+              "mov word [r12+rax], r10w");
+static_assert(detail::encodes(mov(B8, mem(R12, RAX, 0), RDX), detail::kStoreDlGuest),
+              "mov byte [r12+rax], dl");
+static_assert(detail::encodes(movzx16(R13, mem(R13, 0)), detail::kMovzxR13),
+              "[r13] needs a zero disp8");
+static_assert(detail::encodes(mov(B8, mem(RAX, 0), RSI), detail::kStoreSil),
+              "sil needs a REX");
+static_assert(detail::encodes(aluImm(AND, D32, RAX, 0xFFFFF), detail::kAndEax),
+              "and eax, imm32 short form");
+static_assert(detail::encodes(mov(D32, RAX, mem(RSP, 8)), detail::kRspDisp),
+              "[rsp] needs a SIB");
+static_assert(detail::encodes(aluImm(SUB, W16, RDX, 2), detail::kSubDx),
+              "sub dx, imm8");
+static_assert(detail::encodes(alu(ADD, D32, RAX, mem(RCX, 0x24)), detail::kAddSegBase),
+              "add eax, [rcx+disp8]");
+static_assert(detail::encodes(aluImm(AND, B8, RAX, 0x0F), detail::kAndAl),
+              "and al, imm8 short form");
+static_assert(detail::encodes(aluImm(CMP, B8, RSI, 1), detail::kCmpSil),
+              "cmp sil, imm8 needs a REX");
+static_assert(detail::encodes(aluImm(ADD, D32, RSI, 1), detail::kAddEsi),
+              "add esi, imm8 needs none");
+static_assert(aluImm(AND, B8, RDX, 0x0F).zext == X64Insn::ZX_KEEP,
+              "a byte AND keeps bits 8-31");
+static_assert(detail::encodes(aluImm(CMP, B8, mem(RCX, RDX, 0x68), 0), detail::kCmpCodePage),
+              "cmp byte [rcx+rdx+disp8], imm8");
+static_assert(detail::encodes(aluImm(CMP, Q64, mem(RCX, 0x10), 0), detail::kCmpSregs),
+              "cmp qword [rcx+disp8], imm8");
+static_assert(detail::encodes(push(R12), detail::kPushR12), "push r12");
+static_assert(detail::encodes(movImm64(R9, 0x8000000000000001ULL), detail::kMovR9Imm64),
+              "mov r9, imm64");
+// SETcc on SPL-DIL needs a bare REX, on R8B-R15B REX.B
+static_assert(detail::encodes(setcc(CC_O, RAX), detail::kSetoAl), "seto al");
+static_assert(detail::encodes(setcc(CC_O, RSI), detail::kSetoSil), "seto sil");
+static_assert(detail::encodes(setcc(CC_B, R10), detail::kSetcR10b), "setc r10b");
+static_assert(detail::encodes(shift(ROL, W16, RAX, 8), detail::kRolAx), "rol ax, 8");
+static_assert(lahf().zext == X64Insn::ZX_KEEP && sahf().dst < 0, "lahf writes only AH");
+
+} // namespace x64
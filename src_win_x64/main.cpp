@@ -1,12 +1,23 @@
 #include "asm.h"
 #include "jit/jit.h"
 #include "jit/kbd.h"
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <string>
 #include <vector>
 
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
 static std::string jsonEscape(const std::string& s) {
     std::string out;
     out.reserve(s.size() + 8);
@@ -270,6 +281,105 @@ static std::string loadEventsArg(const std::string& arg,
 
 // ---- Help system: --help [flag] ----
 
+// ---------------------------------------------------------------------------
+// --aot executables
+// ---------------------------------------------------------------------------
+// A copy of this executable with a .COM image and its ahead-of-time
+// translation appended, followed by an AotTrailer. At startup main() looks
+// for the trailer on its own file and, if found, runs the embedded program.
+
+struct AotTrailer {
+    char     magic[8];
+    uint64_t com_size;
+    uint64_t image_size;
+};
+static const char AOT_MAGIC[8] = {'A', '8', '6', 'A', 'O', 'T', '1', '\0'};
+
+static std::string selfPath() {
+#ifdef _WIN32
+    char buf[MAX_PATH];
+    DWORD n = GetModuleFileNameA(nullptr, buf, MAX_PATH);
+    return std::string(buf, n < MAX_PATH ? n : 0);
+#else
+    return "/proc/self/exe";
+#endif
+}
+
+// Size of the executable without any payload, and the payload if present
+static bool readAotPayload(std::vector<uint8_t>& com, std::vector<uint8_t>& image,
+                           uint64_t& exe_size) {
+    std::ifstream ifs(selfPath(), std::ios::binary | std::ios::ate);
+    if (!ifs) return false;
+    uint64_t size = (uint64_t)ifs.tellg();
+    exe_size = size;
+    AotTrailer t;
+    if (size < sizeof(t)) return false;
+    ifs.seekg((std::streamoff)(size - sizeof(t)));
+    ifs.read(reinterpret_cast<char*>(&t), sizeof(t));
+    if (!ifs || memcmp(t.magic, AOT_MAGIC, sizeof(AOT_MAGIC)) != 0) return false;
+    if (t.com_size > size || t.image_size > size - sizeof(t) - t.com_size) return false;
+    exe_size = size - sizeof(t) - t.com_size - t.image_size;
+    com.resize((size_t)t.com_size);
+    image.resize((size_t)t.image_size);
+    ifs.seekg((std::streamoff)exe_size);
+    ifs.read(reinterpret_cast<char*>(com.data()), (std::streamsize)com.size());
+    ifs.read(reinterpret_cast<char*>(image.data()), (std::streamsize)image.size());
+    return (bool)ifs;
+}
+
+static int buildAot(const std::string& com_path, const std::string& out_path) {
+    auto fail = [](const std::string& err) {
+        std::cout << "{\"aot\":\"FAILED\",\"error\":\"" << jsonEscape(err) << "\"}" << std::endl;
+        return 1;
+    };
+    std::ifstream ifs(com_path, std::ios::binary);
+    if (!ifs) return fail("cannot open file");
+    std::vector<uint8_t> comData(
+        (std::istreambuf_iterator<char>(ifs)),
+        std::istreambuf_iterator<char>());
+    ifs.close();
+
+    size_t blocks = 0;
+    std::vector<uint8_t> image;
+    {
+        JitEngine jit;
+        image = jit.translateAhead(comData.data(), comData.size(), blocks);
+    }
+    if (image.empty()) return fail("COM file too large");
+
+    // The runtime is this executable, less any program already embedded in it
+    std::vector<uint8_t> oldCom, oldImage;
+    uint64_t exe_size = 0;
+    readAotPayload(oldCom, oldImage, exe_size);
+    std::ifstream self(selfPath(), std::ios::binary);
+    if (!self) return fail("cannot read agent86 executable");
+    std::vector<uint8_t> exe((size_t)exe_size);
+    self.read(reinterpret_cast<char*>(exe.data()), (std::streamsize)exe.size());
+    if (!self) return fail("cannot read agent86 executable");
+    self.close();
+
+    AotTrailer t;
+    memcpy(t.magic, AOT_MAGIC, sizeof(AOT_MAGIC));
+    t.com_size = comData.size();
+    t.image_size = image.size();
+    {
+        std::ofstream ofs(out_path, std::ios::binary | std::ios::trunc);
+        if (!ofs) return fail("cannot open output file: " + out_path);
+        ofs.write(reinterpret_cast<const char*>(exe.data()), (std::streamsize)exe.size());
+        ofs.write(reinterpret_cast<const char*>(comData.data()), (std::streamsize)comData.size());
+        ofs.write(reinterpret_cast<const char*>(image.data()), (std::streamsize)image.size());
+        ofs.write(reinterpret_cast<const char*>(&t), sizeof(t));
+        if (!ofs) return fail("cannot write output file: " + out_path);
+    }
+#ifndef _WIN32
+    chmod(out_path.c_str(), 0755);
+#endif
+    uint64_t total = exe.size() + comData.size() + image.size() + sizeof(t);
+    std::cout << "{\"aot\":\"OK\",\"output\":\"" << jsonEscape(out_path)
+              << "\",\"size\":" << total << ",\"blocks\":" << blocks << "}" << std::endl;
+    return 0;
+}
+
 static void helpOverview() {
     std::cout << R"HELP(agent86 v0.20.0 -- 8086 assembler + JIT emulator for .COM binaries
 
@@ -280,6 +390,7 @@ USAGE
   agent86 <file.asm> --build_trace [N] Assemble + trace in one step
   agent86 <file.com> --run [N]         Execute pre-compiled .COM binary
   agent86 <file.com> --trace [N]       Trace pre-compiled .COM binary
+  agent86 <file.com> --aot <out>       Translate ahead of time into an executable
   agent86 --help [flag]                Show help (overview or per-flag detail)
 
   stdout is always JSON. DOS output and diagnostics go to stderr.
@@ -292,6 +403,13 @@ FLAGS
   --args <string>       Set PSP command tail (program arguments at 0x80)
   --events <json|file>  Inject keyboard/mouse input (inline JSON or file path)
   --screen <mode>   Enable video framebuffer (MDA, CGA40, CGA80, VGA50)
+  --jit-threshold N Interpret a block N times before translating it (default 2)
+  --jit-cache DIR   Reuse translated code from earlier runs of the same .COM
+  --jit-eager       Translate all statically reachable code before running
+  --jit-cache-size N  Code cache size in bytes, or with a K/M suffix (default 16M)
+  --jit-stats       Add code cache occupancy and evictions to the final JSON
+  --huge-pages      Back guest memory with a transparent huge page
+  --aot <out>       Write a standalone executable with the .COM pre-translated
   -o <path>         Output path override (assemble/build modes)
   --help             This overview, or --help <flag> for detail
 
@@ -304,6 +422,12 @@ FLAGS
     agent86 --help args
     agent86 --help events
     agent86 --help screen
+    agent86 --help jit-threshold
+    agent86 --help jit-cache
+    agent86 --help jit-eager
+    agent86 --help jit-cache-size
+    agent86 --help huge-pages
+    agent86 --help aot
 
 JSON SHAPES
   Assemble OK:    {"compiled":"OK","size":N,"symbols":{...}}
@@ -1069,6 +1193,201 @@ EXAMPLE (reading args in assembly)
 )HELP" << std::flush;
 }
 
+static void helpJitThreshold() {
+    std::cout << R"HELP(--jit-threshold N -- when blocks move from the interpreter to the JIT
+
+USAGE
+  agent86 <file.com> --run --jit-threshold 0     Translate every block at once
+  agent86 <file.asm> --build_run --jit-threshold 50
+
+  Execution is tiered. A basic block starts out in a threaded interpreter
+  (decoded once, then run handler by handler) and is translated to x64 on
+  its entry after the N-th. Code that runs once or twice -- startup,
+  argument parsing, printing -- never pays for translation; loops are
+  translated after a couple of iterations and run natively from then on.
+
+  Default: 2. With 0 every block is translated on first entry. Results,
+  instruction counts and directives behave the same at any threshold.
+  Instructions the interpreter doesn't handle (shifts, MUL/DIV, BCD, far
+  transfers, I/O, REP-prefixed strings) always run translated.
+)HELP" << std::flush;
+}
+
+static void helpJitCache() {
+    std::cout << R"HELP(--jit-cache DIR -- keep translated code between runs
+
+USAGE
+  agent86 <file.com> --run --jit-cache .agent86-cache
+  agent86 <file.asm> --build_run --jit-cache /tmp/a86
+
+  At the end of the run every translated block is written to a file in DIR
+  (created if missing), named after a hash of the .COM image, the trace
+  directives and the agent86 build. The next run of the same image loads
+  that file and runs those blocks natively the first time they are
+  reached, skipping both the interpreter and the translator.
+
+  A cached block is only used if the guest bytes it was translated from
+  are unchanged when execution gets there, so programs that patch
+  themselves or take different arguments still run correctly. The file is
+  rewritten only when a run translated something new. A different build of
+  agent86 ignores files written by another.
+)HELP" << std::flush;
+}
+
+static void helpJitEager() {
+    std::cout << R"HELP(--jit-eager -- translate reachable code before running
+
+USAGE
+  agent86 <file.com> --run --jit-eager
+  agent86 <file.asm> --build_run --jit-eager
+
+  Before the first instruction runs, code is discovered from the entry
+  point at 100h by following direct jumps, calls, conditional branches,
+  LOOPs and fall-through inside the loaded image, and every block found is
+  translated to x64. The program then runs without first-execution stalls
+  in the interpreter or translator, which makes run time more predictable
+  from one test to the next.
+
+  Code only reached through indirect jumps and calls, or written at run
+  time, is found when execution gets there and goes through the usual
+  interpreter/JIT tiers. The final JSON reports both:
+
+    "eager":{"discovered":N,"untranslated":N,"dynamic":N,"translate_us":N}
+
+  discovered    blocks found up front
+  untranslated  of those, blocks left to the usual tiers because the
+                code cache (--jit-cache-size) had no room for them
+  dynamic       block addresses first reached at run time
+  translate_us  time spent on the up-front pass, in microseconds
+)HELP" << std::flush;
+}
+
+static void helpJitCacheSize() {
+    std::cout << R"HELP(--jit-cache-size N, --jit-stats -- size and occupancy of the code cache
+
+USAGE
+  agent86 <file.com> --run --jit-cache-size 64M
+  agent86 <file.asm> --build_run --jit-cache-size 256K --jit-stats
+
+  Translated blocks are bump-allocated in one executable arena. N is its
+  size in bytes, or in KiB/MiB with a K or M suffix; the default is 16M,
+  and values are clamped to 64K..1024M. When the arena is full every block
+  is evicted at once (they are all unlinked with it) and translation starts
+  over from the next block executed. Self-modifying code leaves the bytes
+  of invalidated blocks in place until then.
+
+  --jit-stats adds the arena's state at the end of the run to the final
+  JSON:
+
+    "code_cache":{"capacity":N,"used":N,"peak":N,"evictions":N,
+                  "evicted_blocks":N,"dead_bytes":N,"fragmentation":F}
+
+  used            bytes in use now, including the shared helpers
+  peak            most bytes in use at any point
+  evictions       times the arena filled up and was emptied
+  evicted_blocks  live translated blocks dropped by those evictions
+  dead_bytes      bytes still held by invalidated blocks
+  fragmentation   dead_bytes as a fraction of the bytes used by blocks
+
+  It also reports what the peephole pass over each block's code left out:
+
+    "peephole":{"bytes_saved":N,"elided":N}
+
+  bytes_saved     bytes of x64 code not emitted this run
+  elided          instructions dropped: zero-extensions of registers
+                  already zero-extended
+
+  and how many [disp16] operands were translated to a constant address
+  for the segment register values seen at translation time:
+
+    "segment_folding":{"operands":N,"retranslated":N}
+
+  operands        memory operands folded this run
+  retranslated    blocks entered with a folded segment register changed,
+                  and translated again for the new value
+
+  and whether translation still assumes the flat model a .COM starts in,
+  where all segment registers are 0 and an address is just its offset:
+
+    "flat_model":{"active":true|false,"dropped":N}
+
+  active          no segment register has been loaded with anything but 0
+  dropped         blocks thrown away when one was, to be translated again
+                  with segment arithmetic
+)HELP" << std::flush;
+}
+
+static void helpHugePages() {
+    std::cout << R"HELP(--huge-pages -- back guest memory with a transparent huge page
+
+USAGE
+  agent86 <file.com> --run --huge-pages
+  agent86 <file.asm> --build_run --huge-pages
+
+  Guest memory (the 1MB address space, kept apart from the CPU state) sits
+  in one 2MB span. By default that span is mapped twice over its first
+  64K: the 64K just past 1MB is the same memory as 0..FFFFh, so an address
+  seg*16 + offset that runs past FFFFFh reaches the byte the 8086's 20-bit
+  wraparound would, and translated code does no masking.
+
+  --huge-pages maps the span as private memory and asks the kernel for a
+  transparent huge page (madvise MADV_HUGEPAGE), so one TLB entry covers
+  all of guest memory. The double mapping can't be kept in a huge page,
+  so translated code masks every address to 20 bits again. Whether the
+  kernel actually backs it with a huge page depends on
+  /sys/kernel/mm/transparent_hugepage/enabled.
+
+  On Windows guest memory is never mapped twice, addresses are always
+  masked, and --huge-pages has no effect.
+
+  Translations made without --huge-pages (--jit-cache files, --aot
+  executables) aren't used with it, and the other way round.
+)HELP" << std::flush;
+}
+
+static void helpAot() {
+    std::cout << R"HELP(--aot <out> -- translate a .COM ahead of time into an executable
+
+USAGE
+  agent86 <file.com> --aot prog             Write ./prog
+  ./prog [N] [--trace] [--args "..."] ...   Run it; flags as for --run
+
+  Code is discovered statically from the entry point at 100h: every block
+  reachable through direct jumps, calls, branches and fall-through is
+  translated with the same emitter the JIT uses. The output is a copy of
+  this agent86 executable with the .COM image and the translated code
+  appended; running it executes the program as --run would, with N as the
+  instruction limit.
+
+  Code the static pass can't see -- targets of indirect jumps and calls,
+  code written at run time -- runs through the interpreter and JIT as
+  usual. Each pre-translated block is checked against the guest bytes it
+  was made from when first reached, so self-modifying programs stay
+  correct. --jit-threshold, --events, --screen and --trace work unchanged.
+
+JSON
+  {"aot":"OK","output":"prog","size":N,"blocks":N}
+  {"aot":"FAILED","error":"..."}
+)HELP" << std::flush;
+}
+
+// --jit-cache-size argument: bytes, or KiB/MiB with a K/M suffix
+static bool parseCacheSize(const std::string& s, size_t& bytes) {
+    size_t pos = 0;
+    unsigned long long n;
+    try {
+        n = std::stoull(s, &pos);
+    } catch (...) {
+        return false;
+    }
+    std::string unit = s.substr(pos);
+    if (unit == "K" || unit == "k")      n *= 1024;
+    else if (unit == "M" || unit == "m") n *= 1024 * 1024;
+    else if (!unit.empty())              return false;
+    bytes = (size_t)n;
+    return true;
+}
+
 static bool printHelp(const std::string& topic) {
     if (topic.empty())   { helpOverview();   return true; }
     if (topic == "o")    { helpFlagO();      return true; }
@@ -1092,15 +1411,36 @@ static bool printHelp(const std::string& topic) {
     if (topic == "screen" || topic == "video" || topic == "vram" || topic == "framebuffer") {
         helpScreen(); return true;
     }
+    if (topic == "jit-threshold" || topic == "jit_threshold" || topic == "jit") {
+        helpJitThreshold(); return true;
+    }
+    if (topic == "jit-cache" || topic == "jit_cache" || topic == "cache") {
+        helpJitCache(); return true;
+    }
+    if (topic == "jit-eager" || topic == "jit_eager" || topic == "eager") {
+        helpJitEager(); return true;
+    }
+    if (topic == "jit-cache-size" || topic == "jit_cache_size" || topic == "jit-stats" ||
+        topic == "jit_stats") {
+        helpJitCacheSize(); return true;
+    }
+    if (topic == "huge-pages" || topic == "huge_pages") {
+        helpHugePages(); return true;
+    }
+    if (topic == "aot") { helpAot();        return true; }
     if (topic == "help") { helpOverview();   return true; }
     std::cout << "Unknown topic: " << topic << "\n\n"
-              << "Available topics: asm, args, o, build_run, run, trace, directives, events, screen\n"
+              << "Available topics: asm, args, o, build_run, run, trace, directives, events, screen, jit-threshold, jit-cache, jit-eager, jit-cache-size, huge-pages, aot\n"
               << "Usage: agent86 --help <topic>\n";
     return false;
 }
 
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
+    std::vector<uint8_t> aot_com, aot_image;
+    uint64_t exe_size = 0;
+    bool aot_embedded = readAotPayload(aot_com, aot_image, exe_size);
+
+    if (argc < 2 && !aot_embedded) {
         std::vector<AsmError> errs = {{0, "", "no input file specified"}};
         printFailedJson(errs);
         return 1;
@@ -1113,11 +1453,18 @@ int main(int argc, char* argv[]) {
     std::string events_arg;
     std::string screen_mode;
     std::string program_args;
-    bool run_mode = false;
+    bool run_mode = aot_embedded;  // an --aot executable runs its program
     bool build_run_mode = false;
     bool help_mode = false;
     RunMode mode = RunMode::RUN;
     uint64_t max_cycles = 100000000;
+    uint32_t jit_threshold = JitEngine::DEFAULT_JIT_THRESHOLD;
+    std::string jit_cache;
+    bool jit_eager = false;
+    std::string jit_cache_size;
+    bool jit_stats = false;
+    bool huge_pages = false;
+    std::string aot_output;
 
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
@@ -1160,8 +1507,25 @@ int main(int argc, char* argv[]) {
             events_arg = argv[++i];
         } else if (arg == "--screen" && i + 1 < argc) {
             screen_mode = argv[++i];
+        } else if (arg == "--jit-threshold" && i + 1 < argc &&
+                   isdigit((unsigned char)argv[i + 1][0])) {
+            jit_threshold = (uint32_t)std::stoul(argv[++i]);
+        } else if (arg == "--jit-cache" && i + 1 < argc) {
+            jit_cache = argv[++i];
+        } else if (arg == "--jit-eager") {
+            jit_eager = true;
+        } else if (arg == "--jit-cache-size" && i + 1 < argc) {
+            jit_cache_size = argv[++i];
+        } else if (arg == "--jit-stats") {
+            jit_stats = true;
+        } else if (arg == "--huge-pages") {
+            huge_pages = true;
+        } else if (arg == "--aot" && i + 1 < argc) {
+            aot_output = argv[++i];
         } else if (arg == "-o" && i + 1 < argc) {
             output_file = argv[++i];
+        } else if (aot_embedded && isdigit((unsigned char)arg[0])) {
+            max_cycles = std::stoull(arg);
         } else if (input_file.empty()) {
             input_file = arg;
         }
@@ -1171,25 +1535,50 @@ int main(int argc, char* argv[]) {
         return printHelp(help_topic) ? 0 : 1;
     }
 
-    if (input_file.empty()) {
+    size_t code_cache_size = JitEngine::DEFAULT_CODE_CACHE_SIZE;
+    if (!jit_cache_size.empty() && !parseCacheSize(jit_cache_size, code_cache_size)) {
+        std::cout << "{\"executed\":\"FAILED\",\"error\":\"invalid --jit-cache-size: "
+                  << jsonEscape(jit_cache_size) << "\"}" << std::endl;
+        return 1;
+    }
+
+    if (input_file.empty() && !aot_embedded) {
         std::vector<AsmError> errs = {{0, "", "no input file specified"}};
         printFailedJson(errs);
         return 1;
     }
 
+    if (!aot_output.empty()) {
+        return buildAot(input_file, aot_output);
+    }
+
     // --run/--trace mode: execute a pre-compiled .COM file
     if (run_mode) {
-        std::ifstream ifs(input_file, std::ios::binary);
-        if (!ifs) {
-            std::cout << "{\"executed\":\"FAILED\",\"error\":\"cannot open file\"}" << std::endl;
-            return 1;
+        std::vector<uint8_t> comData;
+        if (aot_embedded) {
+            comData = std::move(aot_com);
+        } else {
+            std::ifstream ifs(input_file, std::ios::binary);
+            if (!ifs) {
+                std::cout << "{\"executed\":\"FAILED\",\"error\":\"cannot open file\"}" << std::endl;
+                return 1;
+            }
+            comData.assign(
+                (std::istreambuf_iterator<char>(ifs)),
+                std::istreambuf_iterator<char>());
+            ifs.close();
         }
-        std::vector<uint8_t> comData(
-            (std::istreambuf_iterator<char>(ifs)),
-            std::istreambuf_iterator<char>());
-        ifs.close();
 
         JitEngine jit;
+        jit.setJitThreshold(jit_threshold);
+        jit.setJitCache(jit_cache);
+        jit.setEager(jit_eager);
+        jit.setCodeCacheSize(code_cache_size);
+        jit.setStats(jit_stats);
+        jit.setHugePages(huge_pages);
+        if (aot_embedded) {
+            jit.setPrecompiled(std::move(aot_image));
+        }
         if (!program_args.empty()) {
             jit.setArgs(program_args);
         }
@@ -1215,9 +1604,10 @@ int main(int argc, char* argv[]) {
         }
         std::string dbg_path;
         if (mode == RunMode::TRACE) {
-            dbg_path = input_file;
+            dbg_path = aot_embedded ? std::string(argv[0]) : input_file;
             auto dot = dbg_path.rfind('.');
-            if (dot != std::string::npos) {
+            if (dot != std::string::npos && (!aot_embedded ||
+                    dbg_path.find_first_of("/\\", dot) == std::string::npos)) {
                 dbg_path = dbg_path.substr(0, dot);
             }
             dbg_path += ".dbg";
@@ -1469,6 +1859,12 @@ int main(int argc, char* argv[]) {
         cfs.close();
 
         JitEngine jit;
+        jit.setJitThreshold(jit_threshold);
+        jit.setJitCache(jit_cache);
+        jit.setEager(jit_eager);
+        jit.setCodeCacheSize(code_cache_size);
+        jit.setStats(jit_stats);
+        jit.setHugePages(huge_pages);
         if (!program_args.empty()) {
             jit.setArgs(program_args);
         }
@@ -0,0 +1,1305 @@
+; Flag sweep: every 8-bit input pair and carry-in (for the word forms,
+; every 16-bit value against a scrambled copy of itself) through each
+; flag-setting instruction, folding the FLAGS word PUSHF sees into one
+; checksum per instruction. Then every FLAGS word
+; through POPF and all 16 Jcc, folded into one more checksum.
+;
+; Translated (--jit-threshold 0) and interpreted (a threshold above any
+; block's 131072 runs), it must print flags_sweep.expected:
+;   agent86 tests/flags_sweep.asm --build_run --jit-threshold 0 2>&1 >/dev/null |
+;       diff - tests/flags_sweep.expected
+;
+; Generated: one unrolled loop per instruction, as the assembler has no
+; macros.
+    ORG 100h
+MOV SP, 0FFF0h
+MOV SI, 0
+MOV DI, 0
+o0:
+MOV BX, 0
+i0:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+ADD AL, CL
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i0
+INC DI
+CMP DI, 2
+JB o0
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o1:
+MOV BX, 0
+i1:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+ADC AL, CL
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i1
+INC DI
+CMP DI, 2
+JB o1
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o2:
+MOV BX, 0
+i2:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+SUB AL, CL
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i2
+INC DI
+CMP DI, 2
+JB o2
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o3:
+MOV BX, 0
+i3:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+SBB AL, CL
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i3
+INC DI
+CMP DI, 2
+JB o3
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o4:
+MOV BX, 0
+i4:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+AND AL, CL
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i4
+INC DI
+CMP DI, 2
+JB o4
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o5:
+MOV BX, 0
+i5:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+OR AL, CL
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i5
+INC DI
+CMP DI, 2
+JB o5
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o6:
+MOV BX, 0
+i6:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+XOR AL, CL
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i6
+INC DI
+CMP DI, 2
+JB o6
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o7:
+MOV BX, 0
+i7:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+CMP AL, CL
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i7
+INC DI
+CMP DI, 2
+JB o7
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o8:
+MOV BX, 0
+i8:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+TEST AL, CL
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i8
+INC DI
+CMP DI, 2
+JB o8
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o9:
+MOV BX, 0
+i9:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+INC AL
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i9
+INC DI
+CMP DI, 2
+JB o9
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o10:
+MOV BX, 0
+i10:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+DEC AL
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i10
+INC DI
+CMP DI, 2
+JB o10
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o11:
+MOV BX, 0
+i11:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+NEG AL
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i11
+INC DI
+CMP DI, 2
+JB o11
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o12:
+MOV BX, 0
+i12:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+SHL AL, CL
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i12
+INC DI
+CMP DI, 2
+JB o12
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o13:
+MOV BX, 0
+i13:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+SHR AL, CL
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i13
+INC DI
+CMP DI, 2
+JB o13
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o14:
+MOV BX, 0
+i14:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+SAR AL, CL
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i14
+INC DI
+CMP DI, 2
+JB o14
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o15:
+MOV BX, 0
+i15:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+ROL AL, CL
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i15
+INC DI
+CMP DI, 2
+JB o15
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o16:
+MOV BX, 0
+i16:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+ROR AL, CL
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i16
+INC DI
+CMP DI, 2
+JB o16
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o17:
+MOV BX, 0
+i17:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+RCL AL, CL
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i17
+INC DI
+CMP DI, 2
+JB o17
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o18:
+MOV BX, 0
+i18:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+RCR AL, CL
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i18
+INC DI
+CMP DI, 2
+JB o18
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o19:
+MOV BX, 0
+i19:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+SHL AL, 1
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i19
+INC DI
+CMP DI, 2
+JB o19
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o20:
+MOV BX, 0
+i20:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+SAR AL, 1
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i20
+INC DI
+CMP DI, 2
+JB o20
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o21:
+MOV BX, 0
+i21:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+RCR AL, 1
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i21
+INC DI
+CMP DI, 2
+JB o21
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o22:
+MOV BX, 0
+i22:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+ROL AL, 1
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i22
+INC DI
+CMP DI, 2
+JB o22
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o23:
+MOV BX, 0
+i23:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+MUL CL
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i23
+INC DI
+CMP DI, 2
+JB o23
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o24:
+MOV BX, 0
+i24:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+IMUL CL
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i24
+INC DI
+CMP DI, 2
+JB o24
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o25:
+MOV BX, 0
+i25:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+MOV DL, BH
+MOV DH, 0
+PUSH DX
+POPF
+MOV AH, BH
+DAA
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i25
+INC DI
+CMP DI, 2
+JB o25
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o26:
+MOV BX, 0
+i26:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+MOV DL, BH
+MOV DH, 0
+PUSH DX
+POPF
+MOV AH, BH
+DAS
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i26
+INC DI
+CMP DI, 2
+JB o26
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o27:
+MOV BX, 0
+i27:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+MOV DL, BH
+MOV DH, 0
+PUSH DX
+POPF
+MOV AH, BH
+AAA
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i27
+INC DI
+CMP DI, 2
+JB o27
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o28:
+MOV BX, 0
+i28:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+MOV DL, BH
+MOV DH, 0
+PUSH DX
+POPF
+MOV AH, BH
+AAS
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i28
+INC DI
+CMP DI, 2
+JB o28
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o29:
+MOV BX, 0
+i29:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+MOV DL, BH
+MOV DH, 0
+PUSH DX
+POPF
+MOV AH, 0
+AAM
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i29
+INC DI
+CMP DI, 2
+JB o29
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o30:
+MOV BX, 0
+i30:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+MOV DL, BH
+MOV DH, 0
+PUSH DX
+POPF
+MOV AH, BH
+AAD
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i30
+INC DI
+CMP DI, 2
+JB o30
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o31:
+MOV BX, 0
+i31:
+MOV AX, DI
+SHR AX, 1
+MOV AX, 0
+MOV AL, BL
+MOV CL, BH
+MOV CH, BL
+MOV DL, BH
+MOV DH, 0
+PUSH DX
+POPF
+MOV AH, BH
+SAHF
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i31
+INC DI
+CMP DI, 2
+JB o31
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o32:
+MOV BX, 0
+i32:
+MOV AX, BX
+MOV CX, BX
+ROR CX, 1
+XOR CX, 0A5C3h
+MOV DX, DI
+SHR DX, 1
+MOV DX, 0
+ADD AX, CX
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i32
+INC DI
+CMP DI, 2
+JB o32
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o33:
+MOV BX, 0
+i33:
+MOV AX, BX
+MOV CX, BX
+ROR CX, 1
+XOR CX, 0A5C3h
+MOV DX, DI
+SHR DX, 1
+MOV DX, 0
+SUB AX, CX
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i33
+INC DI
+CMP DI, 2
+JB o33
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o34:
+MOV BX, 0
+i34:
+MOV AX, BX
+MOV CX, BX
+ROR CX, 1
+XOR CX, 0A5C3h
+MOV DX, DI
+SHR DX, 1
+MOV DX, 0
+ADC AX, CX
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i34
+INC DI
+CMP DI, 2
+JB o34
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o35:
+MOV BX, 0
+i35:
+MOV AX, BX
+MOV CX, BX
+ROR CX, 1
+XOR CX, 0A5C3h
+MOV DX, DI
+SHR DX, 1
+MOV DX, 0
+SBB AX, CX
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i35
+INC DI
+CMP DI, 2
+JB o35
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o36:
+MOV BX, 0
+i36:
+MOV AX, BX
+MOV CX, BX
+ROR CX, 1
+XOR CX, 0A5C3h
+MOV DX, DI
+SHR DX, 1
+MOV DX, 0
+XOR AX, CX
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i36
+INC DI
+CMP DI, 2
+JB o36
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o37:
+MOV BX, 0
+i37:
+MOV AX, BX
+MOV CX, BX
+ROR CX, 1
+XOR CX, 0A5C3h
+MOV DX, DI
+SHR DX, 1
+MOV DX, 0
+NEG AX
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i37
+INC DI
+CMP DI, 2
+JB o37
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o38:
+MOV BX, 0
+i38:
+MOV AX, BX
+MOV CX, BX
+ROR CX, 1
+XOR CX, 0A5C3h
+MOV DX, DI
+SHR DX, 1
+MOV DX, 0
+INC AX
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i38
+INC DI
+CMP DI, 2
+JB o38
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o39:
+MOV BX, 0
+i39:
+MOV AX, BX
+MOV CX, BX
+ROR CX, 1
+XOR CX, 0A5C3h
+MOV DX, DI
+SHR DX, 1
+MOV DX, 0
+DEC AX
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i39
+INC DI
+CMP DI, 2
+JB o39
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o40:
+MOV BX, 0
+i40:
+MOV AX, BX
+MOV CX, BX
+ROR CX, 1
+XOR CX, 0A5C3h
+MOV DX, DI
+SHR DX, 1
+MOV DX, 0
+SHL AX, CL
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i40
+INC DI
+CMP DI, 2
+JB o40
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o41:
+MOV BX, 0
+i41:
+MOV AX, BX
+MOV CX, BX
+ROR CX, 1
+XOR CX, 0A5C3h
+MOV DX, DI
+SHR DX, 1
+MOV DX, 0
+RCR AX, CL
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i41
+INC DI
+CMP DI, 2
+JB o41
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o42:
+MOV BX, 0
+i42:
+MOV AX, BX
+MOV CX, BX
+ROR CX, 1
+XOR CX, 0A5C3h
+MOV DX, DI
+SHR DX, 1
+MOV DX, 0
+SAR AX, 1
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i42
+INC DI
+CMP DI, 2
+JB o42
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o43:
+MOV BX, 0
+i43:
+MOV AX, BX
+MOV CX, BX
+ROR CX, 1
+XOR CX, 0A5C3h
+MOV DX, DI
+SHR DX, 1
+MOV DX, 0
+MUL CX
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i43
+INC DI
+CMP DI, 2
+JB o43
+MOV AX, SI
+CALL print4
+MOV SI, 0
+MOV DI, 0
+o44:
+MOV BX, 0
+i44:
+MOV AX, BX
+MOV CX, BX
+ROR CX, 1
+XOR CX, 0A5C3h
+MOV DX, DI
+SHR DX, 1
+MOV DX, 0
+IMUL CX
+PUSHF
+POP DX
+XOR SI, DX
+ROL SI, 1
+ADD SI, AX
+INC BX
+JNZ i44
+INC DI
+CMP DI, 2
+JB o44
+MOV AX, SI
+CALL print4
+MOV DL, 10
+MOV AH, 2
+INT 21h
+MOV SI, 0
+MOV BX, 0
+jl0:
+MOV DX, BX
+AND DX, 0F0FFh
+MOV DI, 0
+PUSH DX
+POPF
+JO jt0
+JMP jn0
+jt0:
+OR DI, 1
+jn0:
+PUSH DX
+POPF
+JNO jt1
+JMP jn1
+jt1:
+OR DI, 2
+jn1:
+PUSH DX
+POPF
+JB jt2
+JMP jn2
+jt2:
+OR DI, 4
+jn2:
+PUSH DX
+POPF
+JNB jt3
+JMP jn3
+jt3:
+OR DI, 8
+jn3:
+PUSH DX
+POPF
+JZ jt4
+JMP jn4
+jt4:
+OR DI, 16
+jn4:
+PUSH DX
+POPF
+JNZ jt5
+JMP jn5
+jt5:
+OR DI, 32
+jn5:
+PUSH DX
+POPF
+JBE jt6
+JMP jn6
+jt6:
+OR DI, 64
+jn6:
+PUSH DX
+POPF
+JA jt7
+JMP jn7
+jt7:
+OR DI, 128
+jn7:
+PUSH DX
+POPF
+JS jt8
+JMP jn8
+jt8:
+OR DI, 256
+jn8:
+PUSH DX
+POPF
+JNS jt9
+JMP jn9
+jt9:
+OR DI, 512
+jn9:
+PUSH DX
+POPF
+JP jt10
+JMP jn10
+jt10:
+OR DI, 1024
+jn10:
+PUSH DX
+POPF
+JNP jt11
+JMP jn11
+jt11:
+OR DI, 2048
+jn11:
+PUSH DX
+POPF
+JL jt12
+JMP jn12
+jt12:
+OR DI, 4096
+jn12:
+PUSH DX
+POPF
+JGE jt13
+JMP jn13
+jt13:
+OR DI, 8192
+jn13:
+PUSH DX
+POPF
+JLE jt14
+JMP jn14
+jt14:
+OR DI, 16384
+jn14:
+PUSH DX
+POPF
+JG jt15
+JMP jn15
+jt15:
+OR DI, 32768
+jn15:
+XOR SI, DI
+ADD SI, BX
+ROL SI, 1
+INC BX
+JNZ jl0
+MOV AX, SI
+CALL print4
+MOV DL, 10
+MOV AH, 2
+INT 21h
+INT 20h
+print4:
+    PUSH CX
+    PUSH BP
+p4x:
+    MOV BP, 4
+p4l:
+    ROL AX, 1
+    ROL AX, 1
+    ROL AX, 1
+    ROL AX, 1
+    PUSH AX
+    AND AL, 0Fh
+    ADD AL, 30h
+    CMP AL, 39h
+    JBE p4d
+    ADD AL, 7
+p4d:
+    MOV DL, AL
+    MOV AH, 2
+    INT 21h
+    POP AX
+    DEC BP
+    JNZ p4l
+    MOV DL, 32
+    MOV AH, 2
+    INT 21h
+    POP BP
+    POP CX
+    RET
+
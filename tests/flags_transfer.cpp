@@ -0,0 +1,110 @@
+// Exhaustive native check of the JIT's LAHF/SETO/SAHF flag transfer
+// against PUSHFQ/POPFQ. It covers every 8-bit and 16-bit ALU input and
+// shift count, and every FLAGS word through the restore path. The asm
+// mirrors emitHostFlags, emitHostFlagBits and emitRestoreFlags in
+// jit/jit.cpp; keep them in step.
+//
+//   g++ -O2 -mno-red-zone -o flags_transfer tests/flags_transfer.cpp
+//   ./flags_transfer [op]      (all ops: about 52G cases, prints bad=0)
+//
+// -mno-red-zone because the asm pushes.
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+static const uint64_t M = 0x08D5;
+static uint64_t bad = 0, tests = 0;
+struct Out { uint64_t old_, neu, hb, rax0, rax1; };
+
+#define OP(NAME, INSN) \
+static void NAME(uint32_t a, uint32_t b, uint32_t cin, Out& o) { \
+    asm volatile( \
+        "mov %k[a], %%eax\n\tmov %k[b], %%edx\n\tmov %%edx, %%ecx\n\tbt $0, %k[cin]\n\t" \
+        INSN "\n\t" \
+        "mov %%rax, 24(%[o])\n\t" \
+        "pushfq\n\tpop %%r8\n\tmov %%r8, 0(%[o])\n\t" \
+        "mov %%eax, %%edx\n\tlahf\n\tseto %%al\n\tshl $3, %%al\n\trol $8, %%ax\n\tmov %%eax, %%ebx\n\tmov %%edx, %%eax\n\t" \
+        "mov %%rbx, 16(%[o])\n\tmov %%rax, 32(%[o])\n\t" \
+        "push %%r8\n\tpopfq\n\t" \
+        "lahf\n\tseto %%al\n\tshl $3, %%al\n\trol $8, %%ax\n\tand $0x8D5, %%eax\n\t" \
+        "mov %%rax, 8(%[o])\n\t" \
+        :: [a]"r"(a), [b]"r"(b), [cin]"r"(cin), [o]"r"(&o) \
+        : "rax", "rbx", "rcx", "rdx", "r8", "memory", "cc"); \
+}
+OP(add8, "add %%dl, %%al")   OP(adc8, "adc %%dl, %%al")   OP(sub8, "sub %%dl, %%al")
+OP(sbb8, "sbb %%dl, %%al")   OP(and8, "and %%dl, %%al")   OP(or8,  "or %%dl, %%al")
+OP(xor8, "xor %%dl, %%al")   OP(test8,"test %%dl, %%al")  OP(inc8, "inc %%al")
+OP(dec8, "dec %%al")         OP(neg8, "neg %%al")         OP(mul8, "mul %%dl")
+OP(imul8,"imul %%dl")        OP(shl8, "shl %%cl, %%al")   OP(shr8, "shr %%cl, %%al")
+OP(sar8, "sar %%cl, %%al")   OP(rol8, "rol %%cl, %%al")   OP(ror8, "ror %%cl, %%al")
+OP(rcl8, "rcl %%cl, %%al")   OP(rcr8, "rcr %%cl, %%al")
+OP(add16, "add %%dx, %%ax")  OP(adc16, "adc %%dx, %%ax")  OP(sub16, "sub %%dx, %%ax")
+OP(sbb16, "sbb %%dx, %%ax")  OP(and16, "and %%dx, %%ax")  OP(or16,  "or %%dx, %%ax")
+OP(xor16, "xor %%dx, %%ax")  OP(test16,"test %%dx, %%ax") OP(inc16, "inc %%ax")
+OP(dec16, "dec %%ax")        OP(neg16, "neg %%ax")        OP(mul16, "mul %%dx")
+OP(imul16,"imul %%dx")       OP(shl16, "shl %%cl, %%ax")  OP(shr16, "shr %%cl, %%ax")
+OP(sar16, "sar %%cl, %%ax")  OP(rol16, "rol %%cl, %%ax")  OP(ror16, "ror %%cl, %%ax")
+OP(rcl16, "rcl %%cl, %%ax")  OP(rcr16, "rcr %%cl, %%ax")
+
+typedef void (*Fn)(uint32_t, uint32_t, uint32_t, Out&);
+static void check(const char* name, Fn f, uint32_t a, uint32_t b, uint32_t cin) {
+    Out o; f(a, b, cin, o); tests++;
+    if ((o.old_ & M) != o.neu || (o.hb & M) != (o.old_ & M) || o.rax0 != o.rax1) {
+        if (bad++ < 20)
+            printf("BAD %s a=%x b=%x cin=%u old=%llx new=%llx rbx=%llx rax %llx/%llx\n", name, a, b, cin,
+                   (unsigned long long)o.old_, (unsigned long long)o.neu, (unsigned long long)o.hb,
+                   (unsigned long long)o.rax0, (unsigned long long)o.rax1);
+    }
+}
+struct T { const char* n; Fn f; bool two; bool word; bool carry; };
+int main(int argc, char** argv) {
+    T ops[] = {
+        {"add8",add8,1,0,0},{"adc8",adc8,1,0,1},{"sub8",sub8,1,0,0},{"sbb8",sbb8,1,0,1},
+        {"and8",and8,1,0,0},{"or8",or8,1,0,0},{"xor8",xor8,1,0,0},{"test8",test8,1,0,0},
+        {"inc8",inc8,0,0,1},{"dec8",dec8,0,0,1},{"neg8",neg8,0,0,0},{"mul8",mul8,1,0,0},
+        {"imul8",imul8,1,0,0},{"shl8",shl8,1,0,1},{"shr8",shr8,1,0,1},{"sar8",sar8,1,0,1},
+        {"rol8",rol8,1,0,1},{"ror8",ror8,1,0,1},{"rcl8",rcl8,1,0,1},{"rcr8",rcr8,1,0,1},
+        {"add16",add16,1,1,0},{"adc16",adc16,1,1,1},{"sub16",sub16,1,1,0},{"sbb16",sbb16,1,1,1},
+        {"and16",and16,1,1,0},{"or16",or16,1,1,0},{"xor16",xor16,1,1,0},{"test16",test16,1,1,0},
+        {"inc16",inc16,0,1,1},{"dec16",dec16,0,1,1},{"neg16",neg16,0,1,0},{"mul16",mul16,1,1,0},
+        {"imul16",imul16,1,1,0},{"shl16",shl16,1,1,1},{"shr16",shr16,1,1,1},{"sar16",sar16,1,1,1},
+        {"rol16",rol16,1,1,1},{"ror16",ror16,1,1,1},{"rcl16",rcl16,1,1,1},{"rcr16",rcr16,1,1,1},
+    };
+    const char* only = argc > 1 ? argv[1] : nullptr;
+    for (const T& t : ops) {
+        if (only && strcmp(only, t.n)) continue;
+        uint64_t before = tests;
+        uint32_t amax = t.word ? 0xFFFF : 0xFF;
+        bool shift = !strncmp(t.n, "sh", 2) || !strncmp(t.n, "sar", 3) || !strncmp(t.n, "ro", 2) || !strncmp(t.n, "rc", 2);
+        // shift counts: every CL byte
+        uint32_t bmax = !t.two ? 0 : shift ? 0xFF : amax;
+        for (uint32_t cin = 0; cin <= (t.carry ? 1u : 0u); cin++)
+            for (uint32_t a = 0; a <= amax; a++)
+                for (uint32_t b = 0; b <= bmax; b++)
+                    check(t.n, t.f, a, b, cin);
+        printf("%-7s %llu cases\n", t.n, (unsigned long long)(tests - before));
+        fflush(stdout);
+    }
+
+    // Restore: every cpu.flags word, from a clear and a set host state
+    for (uint32_t base = 0; base < 2; base++)
+        for (uint32_t f = 0; f <= 0xFFFF; f++) {
+            uint64_t old_, neu;
+            uint64_t pre = base ? M : 0;
+            asm volatile(
+                "movzx %w[f], %%eax\n\tand $0x8D5, %%eax\n\tpush %%rax\n\tpopfq\n\t"
+                "pushfq\n\tpop %[old]\n\t"
+                "push %[pre]\n\tpopfq\n\t"
+                "movzx %w[f], %%eax\n\trol $8, %%ax\n\tand $0x08, %%al\n\tadd $0x78, %%al\n\tsahf\n\t"
+                "pushfq\n\tpop %[neu]\n\t"
+                : [old]"=&r"(old_), [neu]"=&r"(neu)
+                : [f]"r"(f), [pre]"r"(pre) : "rax", "cc", "memory");
+            tests++;
+            if ((old_ & M) != (neu & M) || (neu & 0x700) != (old_ & 0x700)) {
+                if (bad++ < 20) printf("BAD restore f=%x old=%llx new=%llx\n", f,
+                                       (unsigned long long)old_, (unsigned long long)neu);
+            }
+        }
+    printf("restore 131072 cases\n");
+    printf("tests=%llu bad=%llu\n", (unsigned long long)tests, (unsigned long long)bad);
+    return bad != 0;
+}